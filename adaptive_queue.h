@@ -0,0 +1,467 @@
+#ifndef ADAPTIVE_QUEUE_H
+#define ADAPTIVE_QUEUE_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "depth_gauge.h"
+
+using namespace std::chrono_literals;
+
+enum class adaptive_backend { mutex, sharded };
+
+/*!
+ * adaptive_params - when an adaptive_queue switches backends.  A contention sample is a window of lock
+ * acquisitions, on the mutex or on one shard, and counts those that found the lock held.
+ */
+struct adaptive_params {
+    size_t shards = 0;              // sharded backend's shards; 0 for one per hardware thread, at least 4
+    size_t window = 1024;           // lock acquisitions per sample
+    double high_water = 0.05;       // a mutex sample with at least this share contended is hot
+    double low_water = 0.005;       // a shard sample with at most this share contended is calm
+    size_t persist = 4;             // consecutive hot samples to go sharded; consecutive calm samples, per shard, to go back
+};
+
+/*!
+ * adaptive_queue - a FIFO work queue that starts on a single mutex and moves, online, to a sharded backend while
+ * the mutex is contended, and back once the load drops.
+ *
+ * The mutex backend is work_queue's: one lock, one condition variable, one deque.  It is the cheapest there is
+ * while threads seldom meet on the lock.  Every acquisition first tries the lock, so the queue counts those that
+ * had to wait; persist consecutive windows with a high_water share of them switch the queue over.
+ *
+ * The sharded backend spreads the items over shards, each with its own lock, keeping FIFO order with tickets:
+ * an enqueue takes the next ticket from an atomic counter and files its item under it in shard ticket % shards,
+ * and a dequeue takes the next ticket from another counter and waits on that shard for the item.  Neighbouring
+ * operations land on different shards, so they only share the two counters.  Once the shards' samples have been
+ * calm persist times per shard in a row, the queue switches back.
+ *
+ * A switch takes the mutex and then every shard's lock, moves the queued items across in order -- tickets 0, 1,
+ * ... in queue order one way, a merge by ticket the other -- and bumps the epoch, the backend in use (even for
+ * the mutex).  Both ticket counters carry the epoch they were issued in: an operation that finds, once it holds
+ * its lock, that the epoch has moved on abandons its ticket and starts again on the new backend -- except that
+ * the items of tickets dequeues had already claimed are kept aside for them.  So no item is lost or reordered by
+ * a switch, and operations in flight only retry.
+ *
+ * Bounded as work_queue is, dropping the oldest item; on the sharded backend an enqueue finding max_depth items
+ * queued takes the oldest ticket itself and discards its item, so the bound is approximate while producers race.
+ * Halting follows work_queue.
+ */
+template <class T>
+class adaptive_queue
+{
+public:
+
+    using params = adaptive_params;
+
+    /*!
+     * \brief adaptive_queue creates the queue on the mutex backend; halt_flag, max_depth and wait_interval_ms
+     *        are as for work_queue.
+     */
+    adaptive_queue(std::atomic<bool> & halt_flag, size_t max_depth = SIZE_MAX, int wait_interval_ms = 100,
+                   const params & p = params())
+        : shutting_down(halt_flag)
+        , wait_interval(wait_interval_ms)
+        , max(max_depth)
+        , cfg(p)
+        , epoch(0)
+        , central()
+        , shards(p.shards ? p.shards : std::max<size_t>(4, std::thread::hardware_concurrency()))
+        , enq(0)
+        , deq(0)
+        , calm_samples(0)
+        , n_migrations(0)
+        , n_dropped(0)
+        , n_handled(0)
+    { }
+
+    adaptive_queue(const adaptive_queue &) = delete;
+    adaptive_queue & operator=(const adaptive_queue &) = delete;
+
+    /*!
+     * \brief enqueue adds the work item, dropping the oldest item if the queue is saturated.  Enqueues while
+     *        shutting down, and empty std::unique_ptrs, are ignored.
+     */
+    void enqueue(std::unique_ptr<T> work_item)
+    {
+        if (shutting_down || !work_item) return;
+        if (max == 0) {     // as for work_queue: the item itself is dropped, on either backend
+            n_dropped++;
+            return;
+        }
+
+        for (;;) {
+            const uint64_t e = epoch.load(std::memory_order_acquire);
+            if (is_sharded(e) ? enqueue_sharded(work_item) : enqueue_central(work_item, e)) return;
+        }
+    }
+
+    /*!
+     * \brief dequeue returns the oldest work item, waiting for one as work_queue's does.
+     * \return an empty pointer once halting.
+     */
+    std::unique_ptr<T> dequeue()
+    {
+        for (;;) {
+            if (shutting_down) return std::unique_ptr<T>{};
+
+            const uint64_t e = epoch.load(std::memory_order_acquire);
+            std::unique_ptr<T> work_item;
+            const bool taken = is_sharded(e) ? take_ticket(deq.fetch_add(1), work_item) : take_central(work_item, e);
+            if (!taken) continue;
+
+            if (work_item) n_handled++;
+            return work_item;
+        }
+    }
+
+    /*!
+     * \brief size returns the number of queued work items (or 0 if shutting down).  On the sharded backend the
+     *        shards are counted one at a time, so the total is only as exact as a concurrent snapshot can be.
+     */
+    size_t size() const {
+        if (shutting_down) return 0;
+
+        if (!is_sharded(epoch.load(std::memory_order_acquire))) {
+            std::unique_lock<std::mutex> l(central.m);
+            return central.items.size() + central.handed_off.size();
+        }
+        size_t n = 0;
+        {   // locked context
+            std::unique_lock<std::mutex> l(central.m);
+            n = central.handed_off.size();
+        }   // end locked context
+        for (const shard & s: shards) {
+            std::unique_lock<std::mutex> l(s.m);
+            n += s.items.size();
+        }
+        return n;
+    }
+
+    /*!
+     * \brief approx_size returns the number of queued work items (or 0 if shutting down) without taking a lock:
+     *        on the sharded backend, the tickets issued to enqueues less those issued to dequeues.
+     */
+    size_t approx_size() const {
+        if (is_halting()) return 0;
+        return is_sharded(epoch.load(std::memory_order_relaxed)) ? sharded_depth() : central.depth.load();
+    }
+
+    bool empty() const { return approx_size() == 0; }
+
+    bool is_halting() const { return shutting_down.load(std::memory_order_relaxed); }
+
+    /*!
+     * \brief dropped returns the number of work items dropped because the queue was saturated since the last call.
+     */
+    int dropped() { return static_cast<int>(n_dropped.exchange(0)); }
+
+    /*!
+     * \brief handled returns the number of work items dequeued since the last call.
+     */
+    int handled() { return static_cast<int>(n_handled.exchange(0)); }
+
+    adaptive_backend getBackend() const {
+        return is_sharded(epoch.load(std::memory_order_relaxed)) ? adaptive_backend::sharded : adaptive_backend::mutex;
+    }
+
+    /*!
+     * \brief setBackend switches to the given backend now, whatever the contention, as a switch on contention
+     *        does; the queue goes on switching by itself afterwards.
+     */
+    void setBackend(adaptive_backend to) { migrate(to, epoch.load(std::memory_order_acquire)); }
+
+    /*!
+     * \brief migrations returns the number of backend switches so far; unlike the counters above, not reset.
+     */
+    uint64_t migrations() const { return n_migrations.load(std::memory_order_relaxed); }
+
+private:
+
+    struct central_backend {
+        mutable std::mutex m;
+        std::condition_variable cv;
+        std::deque<std::unique_ptr<T> > items;
+        std::map<uint64_t, std::unique_ptr<T> > handed_off;     // by sharded ticket, for the dequeues holding them
+        depth_gauge depth;
+        size_t n_ops = 0;           // in the current sample
+        size_t n_contended = 0;
+        size_t n_hot = 0;           // consecutive hot samples
+    };
+
+    struct alignas(64) shard {
+        mutable std::mutex m;
+        std::condition_variable cv;
+        std::map<uint64_t, std::unique_ptr<T> > items;     // by ticket: enqueues may file them out of order
+        size_t n_ops = 0;
+        size_t n_contended = 0;
+    };
+
+    // a ticket counter holds the epoch it issues tickets for in its top bits, the ticket in the rest.
+    enum { ticket_bits = 44 };
+    static constexpr uint64_t ticket_mask = (uint64_t(1) << ticket_bits) - 1;
+
+    static bool is_sharded(uint64_t e) { return e & 1; }
+    static uint64_t pack(uint64_t e, uint64_t ticket) { return (e << ticket_bits) | ticket; }
+    static uint64_t epoch_of(uint64_t t) { return t >> ticket_bits; }
+    static uint64_t ticket_of(uint64_t t) { return t & ticket_mask; }
+    static uint64_t epoch_bits(uint64_t e) { return e & (~uint64_t(0) >> ticket_bits); }
+
+    // locks l, first trying; true if the lock was held by someone else.
+    static bool lock_counting(std::unique_lock<std::mutex> & l) {
+        if (l.try_lock()) return false;
+        l.lock();
+        return true;
+    }
+
+    // false if the backend changed before the item could be queued; work_item is untouched then.
+    bool enqueue_central(std::unique_ptr<T> & work_item, uint64_t e) {
+        bool hot = false;
+        {   // locked context
+            std::unique_lock<std::mutex> l(central.m, std::defer_lock);
+            const bool contended = lock_counting(l);
+            if (epoch.load(std::memory_order_relaxed) != e) return false;
+
+            if (central.items.size() >= max) {
+                central.items.pop_front();
+                n_dropped++;
+            }
+            central.items.push_back(std::move(work_item));
+            central.depth.publish(central.items.size() + central.handed_off.size());
+            hot = sample_central(contended);
+        }   // end locked context
+        central.cv.notify_one();
+
+        if (hot) migrate(adaptive_backend::sharded, e);
+        return true;
+    }
+
+    // false if the backend changed while waiting; true with work_item empty when halting.
+    bool take_central(std::unique_ptr<T> & work_item, uint64_t e) {
+        bool hot = false;
+        {   // locked context
+            std::unique_lock<std::mutex> l(central.m, std::defer_lock);
+            const bool contended = lock_counting(l);
+            for (;;) {
+                if (epoch.load(std::memory_order_relaxed) != e) return false;
+                if (shutting_down) return true;
+                if (!central.items.empty()) break;
+                central.cv.wait_for(l, wait_interval * 1ms);
+            }
+            work_item = std::move(central.items.front());
+            central.items.pop_front();
+            central.depth.publish(central.items.size() + central.handed_off.size());
+            hot = sample_central(contended);
+        }   // end locked context
+
+        if (hot) migrate(adaptive_backend::sharded, e);
+        return true;
+    }
+
+    // false if the ticket was issued for an epoch that has ended; work_item is untouched then.
+    bool enqueue_sharded(std::unique_ptr<T> & work_item) {
+        uint64_t oldest;
+        if (claim_oldest(oldest)) {
+            std::unique_ptr<T> discarded;
+            if (!take_ticket(oldest, discarded)) return false;
+            if (discarded) n_dropped++;
+        }
+
+        const uint64_t t = enq.fetch_add(1);
+        shard & s = shard_of(t);
+        bool calm = false;
+        uint64_t e;
+        {   // locked context
+            std::unique_lock<std::mutex> l(s.m, std::defer_lock);
+            const bool contended = lock_counting(l);
+            e = epoch.load(std::memory_order_relaxed);
+            if (epoch_bits(e) != epoch_of(t)) return false;
+
+            s.items.emplace(ticket_of(t), std::move(work_item));
+            calm = sample_shard(s, contended);
+        }   // end locked context
+        s.cv.notify_all();
+
+        if (calm) migrate(adaptive_backend::mutex, e);
+        return true;
+    }
+
+    // takes ticket t's item, waiting for its enqueue.  False if t's epoch has ended without its item; true with
+    // work_item empty when halting.
+    bool take_ticket(uint64_t t, std::unique_ptr<T> & work_item) {
+        shard & s = shard_of(t);
+        bool calm = false;
+        uint64_t e;
+        {   // locked context
+            std::unique_lock<std::mutex> l(s.m, std::defer_lock);
+            const bool contended = lock_counting(l);
+            for (;;) {
+                e = epoch.load(std::memory_order_relaxed);
+                if (epoch_bits(e) != epoch_of(t)) {
+                    l.unlock();
+                    return take_handed_off(t, work_item);
+                }
+                if (shutting_down) return true;
+
+                auto found = s.items.find(ticket_of(t));
+                if (found != s.items.end()) {
+                    work_item = std::move(found->second);
+                    s.items.erase(found);
+                    break;
+                }
+                s.cv.wait_for(l, wait_interval * 1ms);
+            }
+            calm = sample_shard(s, contended);
+        }   // end locked context
+
+        if (calm) migrate(adaptive_backend::mutex, e);
+        return true;
+    }
+
+    // a switch back to the mutex sets the items of tickets already claimed aside, for their claimants: serving
+    // them to whoever dequeues next could hand a consumer an item older than one it has already had.
+    bool take_handed_off(uint64_t t, std::unique_ptr<T> & work_item) {
+        std::unique_lock<std::mutex> l(central.m);
+        auto found = central.handed_off.find(t);
+        if (found == central.handed_off.end()) return false;
+
+        work_item = std::move(found->second);
+        central.handed_off.erase(found);
+        central.depth.publish(central.items.size() + central.handed_off.size());
+        return true;
+    }
+
+    // when max_depth items are queued, claims the oldest ticket for the enqueue to discard.  Only tickets already
+    // issued to an enqueue are claimed, so the item is on its way.
+    bool claim_oldest(uint64_t & t) {
+        t = deq.load();
+        for (;;) {
+            const uint64_t in = enq.load();
+            if (epoch_of(in) != epoch_of(t) || ticket_of(t) >= ticket_of(in)) return false;
+            if (ticket_of(in) - ticket_of(t) < max) return false;
+            if (deq.compare_exchange_weak(t, t + 1)) return true;
+        }
+    }
+
+    size_t sharded_depth() const {
+        const uint64_t out = deq.load(std::memory_order_relaxed);
+        const uint64_t in = enq.load(std::memory_order_relaxed);
+        if (epoch_of(in) != epoch_of(out) || ticket_of(in) <= ticket_of(out)) return 0;
+        return static_cast<size_t>(ticket_of(in) - ticket_of(out));
+    }
+
+    shard & shard_of(uint64_t t) { return shards[ticket_of(t) % shards.size()]; }
+
+    // called with central.m held; true when the mutex has stayed hot long enough to go sharded.
+    bool sample_central(bool contended) {
+        central.n_ops++;
+        if (contended) central.n_contended++;
+        if (central.n_ops < cfg.window) return false;
+
+        const bool hot = central.n_contended >= cfg.high_water * central.n_ops;
+        central.n_ops = central.n_contended = 0;
+        central.n_hot = hot ? central.n_hot + 1 : 0;
+        return central.n_hot >= cfg.persist;
+    }
+
+    // called with s.m held; true when the shards have stayed calm long enough to go back to the mutex.
+    bool sample_shard(shard & s, bool contended) {
+        s.n_ops++;
+        if (contended) s.n_contended++;
+        if (s.n_ops < cfg.window) return false;
+
+        const bool calm = s.n_contended <= cfg.low_water * s.n_ops;
+        s.n_ops = s.n_contended = 0;
+        if (!calm) {
+            calm_samples = 0;
+            return false;
+        }
+        return calm_samples.fetch_add(1) + 1 >= cfg.persist * shards.size();
+    }
+
+    // switches to backend to, unless the epoch has moved on from seen (someone else switched first).
+    void migrate(adaptive_backend to, uint64_t seen) {
+        {   // locked context: the mutex, then every shard in order
+            std::unique_lock<std::mutex> central_lock(central.m);
+            std::vector<std::unique_lock<std::mutex> > shard_locks;
+            shard_locks.reserve(shards.size());
+            for (shard & s: shards) shard_locks.emplace_back(s.m);
+
+            const uint64_t e = epoch.load(std::memory_order_relaxed);
+            if (e != seen || is_sharded(e) == (to == adaptive_backend::sharded)) return;
+            const uint64_t next = e + 1;
+
+            if (to == adaptive_backend::sharded) {
+                uint64_t t = 0;
+                for (std::unique_ptr<T> & work_item: central.items) {
+                    shards[t % shards.size()].items.emplace(t, std::move(work_item));
+                    t++;
+                }
+                central.items.clear();
+                deq.store(pack(epoch_bits(next), 0));
+                enq.store(pack(epoch_bits(next), t));
+            } else {
+                // tickets are issued in order, so the union of the shards, by ticket, is the queue.  Tickets issued
+                // after this load are dead: their dequeues start again.
+                const uint64_t claimed = ticket_of(deq.load());
+                std::vector<std::pair<uint64_t, std::unique_ptr<T> > > queued;
+                for (shard & s: shards) {
+                    for (auto & entry: s.items) {
+                        if (entry.first < claimed)
+                            central.handed_off.emplace(pack(epoch_bits(e), entry.first), std::move(entry.second));
+                        else
+                            queued.emplace_back(entry.first, std::move(entry.second));
+                    }
+                    s.items.clear();
+                }
+                std::sort(queued.begin(), queued.end(),
+                          [](const std::pair<uint64_t, std::unique_ptr<T> > & a,
+                             const std::pair<uint64_t, std::unique_ptr<T> > & b) { return a.first < b.first; });
+                for (auto & entry: queued) central.items.push_back(std::move(entry.second));
+            }
+            central.depth.publish(central.items.size() + central.handed_off.size());
+
+            central.n_ops = central.n_contended = central.n_hot = 0;
+            for (shard & s: shards) s.n_ops = s.n_contended = 0;
+            calm_samples = 0;
+
+            epoch.store(next, std::memory_order_release);
+            n_migrations++;
+        }   // end locked context
+
+        // waiters recheck the epoch and start again on the new backend.
+        central.cv.notify_all();
+        for (shard & s: shards) s.cv.notify_all();
+    }
+
+    std::atomic<bool> & shutting_down;
+
+    const int wait_interval; // units 1msec
+    const size_t max;
+    const params cfg;
+
+    alignas(64) std::atomic<uint64_t> epoch;    // even: mutex backend; odd: sharded.  Changed with every lock held
+
+    central_backend central;
+    std::vector<shard> shards;
+
+    alignas(64) std::atomic<uint64_t> enq;      // next ticket for an enqueue, under its epoch's bits
+    alignas(64) std::atomic<uint64_t> deq;      // next ticket for a dequeue
+    alignas(64) std::atomic<size_t> calm_samples;
+
+    std::atomic<uint64_t> n_migrations;
+    std::atomic<uint64_t> n_dropped;
+    std::atomic<uint64_t> n_handled;
+};
+
+#endif // ADAPTIVE_QUEUE_H
@@ -0,0 +1,158 @@
+#include <cxxtest/TestSuite.h>
+#include <iostream>
+#include <thread>
+#include <vector>
+#include "adaptive_queue.h"
+
+
+class adaptive_queue_test : public CxxTest::TestSuite
+{
+public:
+
+    static std::unique_ptr<int> make(int i) { return std::unique_ptr<int>(new int(i)); }
+
+    void testSwitchesKeepOrder(void) {
+        std::atomic<bool> haltflag(false);
+        adaptive_queue<int>::params p;
+        p.persist = 1 << 20;   // only the switches made here
+        adaptive_queue<int> q(haltflag, SIZE_MAX, 10, p);
+        TS_ASSERT(q.getBackend() == adaptive_backend::mutex);
+
+        const int n = 20000;
+        std::thread consumer([&]{
+            for (int i = 0; i < n; i++) {
+                std::unique_ptr<int> work_item = q.dequeue();
+                TS_ASSERT(work_item);
+                if (!work_item) return;
+                TS_ASSERT_EQUALS(*work_item, i);
+                if (*work_item != i) return;
+            }
+        });
+
+        TS_TRACE("switching back and forth while items are queued and a consumer waits on its ticket");
+        for (int i = 0; i < n; i++) {
+            q.enqueue(make(i));
+            if (i % 1000 == 0)
+                q.setBackend(i % 2000 == 0 ? adaptive_backend::sharded : adaptive_backend::mutex);
+        }
+        consumer.join();
+
+        TS_ASSERT_EQUALS(q.migrations(), 20);
+        TS_ASSERT_EQUALS(q.handled(), n);
+        TS_ASSERT_EQUALS(q.dropped(), 0);
+        TS_ASSERT_EQUALS(q.size(), 0);
+        haltflag = true;
+    }
+
+    void testConcurrentSwitchesLoseNothing(void) {
+        std::atomic<bool> haltflag(false);
+        adaptive_queue<int>::params p;
+        p.window = 64;
+        p.persist = 1;
+        p.high_water = 0;
+        p.low_water = 1;
+        adaptive_queue<int> q(haltflag, SIZE_MAX, 5, p);
+
+        TS_TRACE("every window switches: each consumer still sees each producer's items in order");
+        const int n_producers = 4, n_consumers = 4, per_producer = 20000;
+        std::atomic<int> n_taken(0), n_out_of_order(0);
+        std::vector<std::thread> threads;
+        for (int c = 0; c < n_consumers; c++)
+            threads.emplace_back([&]{
+                std::vector<int> last(n_producers, -1);
+                while (std::unique_ptr<int> work_item = q.dequeue()) {
+                    const int producer = *work_item / per_producer, i = *work_item % per_producer;
+                    if (i <= last[producer]) n_out_of_order++;
+                    last[producer] = i;
+                    if (++n_taken == n_producers * per_producer) haltflag = true;
+                }
+            });
+        for (int producer = 0; producer < n_producers; producer++)
+            threads.emplace_back([&, producer]{
+                for (int i = 0; i < per_producer; i++)
+                    q.enqueue(make(producer * per_producer + i));
+            });
+        for (auto & thread: threads) thread.join();
+
+        TS_ASSERT_EQUALS(n_taken, n_producers * per_producer);
+        TS_ASSERT_EQUALS(n_out_of_order, 0);
+        TS_ASSERT_LESS_THAN(10, q.migrations());
+    }
+
+    void testContentionSwitchesToSharded(void) {
+        std::atomic<bool> haltflag(false);
+        adaptive_queue<int>::params p;
+        p.window = 16;
+        p.persist = 2;
+        p.high_water = 0;
+        adaptive_queue<int> q(haltflag, SIZE_MAX, 10, p);
+
+        TS_TRACE("a high water of 0 makes every sample hot: the second full window switches");
+        for (int i = 0; i < 31; i++)
+            q.enqueue(make(i));
+        TS_ASSERT(q.getBackend() == adaptive_backend::mutex);
+        q.enqueue(make(31));
+        TS_ASSERT(q.getBackend() == adaptive_backend::sharded);
+
+        TS_ASSERT_EQUALS(q.size(), 32);
+        TS_ASSERT_EQUALS(q.approx_size(), 32);
+        for (int i = 0; i < 32; i++)
+            TS_ASSERT_EQUALS(*q.dequeue(), i);
+        TS_ASSERT(q.empty());
+        haltflag = true;
+    }
+
+    void testCalmSwitchesBack(void) {
+        std::atomic<bool> haltflag(false);
+        adaptive_queue<int>::params p;
+        p.shards = 2;
+        p.window = 4;
+        p.persist = 1;
+        p.low_water = 1;
+        adaptive_queue<int> q(haltflag, SIZE_MAX, 10, p);
+        q.setBackend(adaptive_backend::sharded);
+
+        TS_TRACE("every sample is calm: one full window per shard switches back");
+        for (int i = 0; i < 7; i++)
+            q.enqueue(make(i));
+        TS_ASSERT(q.getBackend() == adaptive_backend::sharded);
+        q.enqueue(make(7));
+        TS_ASSERT(q.getBackend() == adaptive_backend::mutex);
+        TS_ASSERT_EQUALS(q.migrations(), 2);
+
+        for (int i = 0; i < 8; i++)
+            TS_ASSERT_EQUALS(*q.dequeue(), i);
+        haltflag = true;
+    }
+
+    void testBoundDropsTheOldest(void) {
+        std::atomic<bool> haltflag(false);
+        adaptive_queue<int> q(haltflag, 4, 10);
+
+        for (int backend = 0; backend < 2; backend++) {
+            q.setBackend(backend ? adaptive_backend::sharded : adaptive_backend::mutex);
+            for (int i = 0; i < 10; i++)
+                q.enqueue(make(i));
+            TS_ASSERT_EQUALS(q.dropped(), 6);
+            TS_ASSERT_EQUALS(q.size(), 4);
+            for (int i = 6; i < 10; i++)
+                TS_ASSERT_EQUALS(*q.dequeue(), i);
+        }
+
+        TS_TRACE("max_depth 0 drops every item, as for work_queue, on either backend");
+        adaptive_queue<int> none(haltflag, 0, 10);
+        for (int backend = 0; backend < 2; backend++) {
+            none.setBackend(backend ? adaptive_backend::sharded : adaptive_backend::mutex);
+            for (int i = 0; i < 3; i++)
+                none.enqueue(make(i));
+            TS_ASSERT_EQUALS(none.size(), 0);
+            TS_ASSERT_EQUALS(none.dropped(), 3);
+        }
+
+        TS_TRACE("halting wakes a waiting consumer");
+        std::thread stopper([&]{ std::this_thread::sleep_for(std::chrono::milliseconds(20)); haltflag = true; });
+        TS_ASSERT(!q.dequeue());
+        stopper.join();
+    }
+
+};
@@ -0,0 +1,308 @@
+#ifndef AFFINITY_QUEUE_H
+#define AFFINITY_QUEUE_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "depth_gauge.h"
+
+using namespace std::chrono_literals;
+
+/*!
+ * item_affinity - the default affinity key of an affinity_queue item: its affinity_key() member.
+ * Items with equal keys are meant to touch the same cached state (a customer, an account, a shard).
+ */
+template <class T>
+struct item_affinity {
+    uint64_t operator()(const T & work_item) const { return work_item.affinity_key(); }
+};
+
+/*!
+ * affinity_queue - a work queue that sends items with the same key to the same consumer, so that each
+ * consumer's caches hold only its share of the keys.
+ *
+ * Every consumer owns a lane.  An item is queued on the lane its key hashes to, and that lane's consumer
+ * serves it.  Affinity is soft: a consumer whose own lane is empty steals the oldest item from the most backlogged
+ * lane, but only from a lane holding more than steal_threshold items.  So a hot key costs a little balance
+ * before it costs locality.  This differs from strict per-key ordering: once a stolen item is in service,
+ * items with the same key may be served concurrently by two consumers.
+ *
+ * An enqueue wakes the lane's consumer, and also one idle consumer once the lane's backlog passes the
+ * threshold.  Each lane is FIFO.  max_depth bounds each lane separately, and a full lane drops its oldest
+ * item.  Halting follows work_queue.
+ *
+ * Consumers identify themselves by their index, 0 .. n_consumers - 1, on every dequeue.
+ */
+template <class T, class Key = item_affinity<T> >
+class affinity_queue
+{
+public:
+
+    struct locality {
+        uint64_t local;         // items served from the consumer's own lane
+        uint64_t stolen;        // items the consumer took from other lanes
+        uint64_t stolen_from;   // items other consumers took from its lane
+        double local_fraction;  // local / (local + stolen)
+    };
+
+    /*!
+     * \brief affinity_queue creates a queue with one lane per consumer; halt_flag, max_depth and
+     *        wait_interval_ms are as for work_queue, max_depth applying to each lane.
+     * \param steal_threshold the backlog a lane must exceed before other consumers take its items.
+     */
+    affinity_queue(std::atomic<bool> & halt_flag, size_t n_consumers, size_t steal_threshold = 8,
+                   size_t max_depth = SIZE_MAX, int wait_interval_ms = 100, Key key = Key())
+        : shutting_down(halt_flag)
+        , wait_interval(wait_interval_ms)
+        , max(max_depth)
+        , threshold(steal_threshold)
+        , key_of(std::move(key))
+        , lanes(n_consumers ? n_consumers : 1)
+        , n_dropped(0)
+        , n_handled(0)
+    { }
+
+    affinity_queue(const affinity_queue &) = delete;
+    affinity_queue & operator=(const affinity_queue &) = delete;
+
+    /*!
+     * \brief enqueue adds the work item to the lane of its key.  Enqueues while shutting down, and empty
+     *        std::unique_ptrs, are ignored.
+     */
+    void enqueue(std::unique_ptr<T> work_item)
+    {
+        if (shutting_down || !work_item) return;
+
+        const size_t home = lane_of(key_of(*work_item));
+        lane & ln = lanes[home];
+        size_t backlog;
+        {   // locked context
+            std::unique_lock<std::mutex> l(ln.m);
+            push(ln, std::move(work_item));
+            backlog = ln.items.size();
+        }   // end locked context
+
+        ln.cv.notify_one();
+        if (backlog > threshold) wake_thief(home);
+    }
+
+    /*!
+     * \brief enqueue adds all the non-empty elements of bulk, each to the lane of its key, taking each
+     *        lane's lock once.
+     */
+    void enqueue(std::vector<std::unique_ptr<T> > & bulk)
+    {
+        if (shutting_down) return;
+
+        std::vector<std::vector<std::unique_ptr<T> > > by_lane(lanes.size());
+        for (auto & work_item: bulk)
+            if (work_item) by_lane[lane_of(key_of(*work_item))].push_back(std::move(work_item));
+
+        for (size_t i = 0; i < lanes.size(); i++) {
+            if (by_lane[i].empty()) continue;
+            lane & ln = lanes[i];
+            size_t backlog;
+            {   // locked context
+                std::unique_lock<std::mutex> l(ln.m);
+                for (auto & work_item: by_lane[i])
+                    push(ln, std::move(work_item));
+                backlog = ln.items.size();
+            }   // end locked context
+
+            ln.cv.notify_one();
+            if (backlog > threshold) wake_thief(i);
+        }
+    }
+
+    /*!
+     * \brief dequeue returns the oldest item of the consumer's own lane, or, when that is empty, the oldest
+     *        item of the most backlogged lane over the steal threshold; it waits while there is neither.
+     * \param consumer the calling consumer's index, below n_consumers.
+     * \return the work item, or an empty std::unique_ptr when shutting down.
+     */
+    std::unique_ptr<T> dequeue(size_t consumer)
+    {
+        lane & own = lanes[consumer % lanes.size()];
+
+        for (;;) {
+            {   // locked context
+                std::unique_lock<std::mutex> l(own.m);
+                if (shutting_down) return std::unique_ptr<T>{};
+                if (!own.items.empty()) {
+                    own.n_local.fetch_add(1, std::memory_order_relaxed);
+                    n_handled++;
+                    return pop(own);
+                }
+            }   // end locked context
+
+            // announced before looking for work to steal: a producer overloading a lane after the look
+            // sees the flag and pokes us (see wake_thief).
+            own.idle.store(true);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (std::unique_ptr<T> stolen = steal(consumer % lanes.size())) {
+                own.idle.store(false);
+                own.n_stolen.fetch_add(1, std::memory_order_relaxed);
+                n_handled++;
+                return stolen;
+            }
+
+            {   // locked context
+                std::unique_lock<std::mutex> l(own.m);
+                if (own.items.empty() && !own.poked && !shutting_down)
+                    own.cv.wait_for(l, wait_interval * 1ms);
+                own.poked = false;
+                own.idle.store(false);
+            }   // end locked context
+        }
+    }
+
+    /*!
+     * \brief size returns the number of queued work items over all lanes (0 if shutting down).
+     */
+    size_t size() const {
+        if (shutting_down) return 0;
+        size_t total = 0;
+        for (const lane & ln: lanes) total += ln.depth.load();
+        return total;
+    }
+
+    /*!
+     * \brief backlog returns the number of items queued on one consumer's lane.
+     */
+    size_t backlog(size_t consumer) const { return lanes[consumer % lanes.size()].depth.load(); }
+
+    /*!
+     * \brief approx_size, empty and is_halting need no lock; see work_queue.
+     */
+    size_t approx_size() const { return size(); }
+    bool empty() const { return size() == 0; }
+    bool is_halting() const { return shutting_down.load(std::memory_order_relaxed); }
+
+    /*!
+     * \brief dropped returns the number of work items dropped so far because a lane was full,
+     *        and resets the counter to zero.
+     */
+    int dropped() { return static_cast<int>(n_dropped.exchange(0)); }
+
+    /*!
+     * \brief handled returns the number of work items dequeued so far, and resets the counter to zero.
+     */
+    int handled() { return static_cast<int>(n_handled.exchange(0)); }
+
+    /*!
+     * \brief snapshot returns each consumer's locality counters, indexed by consumer.
+     */
+    std::vector<locality> snapshot() const {
+        std::vector<locality> result;
+        for (const lane & ln: lanes) {
+            const uint64_t local = ln.n_local.load(std::memory_order_relaxed);
+            const uint64_t stolen = ln.n_stolen.load(std::memory_order_relaxed);
+            result.push_back(locality{ local, stolen, ln.n_stolen_from.load(std::memory_order_relaxed),
+                                       local + stolen ? double(local) / (local + stolen) : 1.0 });
+        }
+        return result;
+    }
+
+    /*!
+     * \brief lane_of returns the consumer whose lane items with key are queued on.
+     */
+    size_t lane_of(uint64_t key) const {
+        // spread sequential keys: finalizer of splitmix64.
+        key = (key ^ (key >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        key = (key ^ (key >> 27)) * 0x94d049bb133111ebULL;
+        key ^= key >> 31;
+        return static_cast<size_t>(key % lanes.size());
+    }
+
+private:
+
+    struct alignas(64) lane {
+        std::mutex m;
+        std::condition_variable cv;
+        std::deque<std::unique_ptr<T> > items;
+        depth_gauge depth;                  // items.size(), read by thieves without m
+        std::atomic<bool> idle{ false };    // the lane's consumer found no work and is about to wait
+        bool poked = false;                 // a thief is wanted: don't wait (guarded by m)
+        std::atomic<uint64_t> n_local{ 0 };
+        std::atomic<uint64_t> n_stolen{ 0 };
+        std::atomic<uint64_t> n_stolen_from{ 0 };
+    };
+
+    // called with ln.m held.
+    void push(lane & ln, std::unique_ptr<T> work_item) {
+        if (ln.items.size() >= max) {
+            n_dropped++;
+            if (ln.items.empty()) return;   // max 0: the item itself is dropped
+            ln.items.pop_front();
+        }
+        ln.items.push_back(std::move(work_item));
+        ln.depth.publish(ln.items.size());
+    }
+
+    // called with ln.m held and ln.items not empty.
+    std::unique_ptr<T> pop(lane & ln) {
+        std::unique_ptr<T> work_item = std::move(ln.items.front());
+        ln.items.pop_front();
+        ln.depth.publish(ln.items.size());
+        return work_item;
+    }
+
+    // takes the oldest item of the most backlogged other lane, if any is over the threshold.
+    std::unique_ptr<T> steal(size_t thief) {
+        for (;;) {
+            size_t victim = thief;
+            size_t deepest = threshold;
+            for (size_t i = 0; i < lanes.size(); i++) {
+                const size_t depth = lanes[i].depth.load();
+                if (i != thief && depth > deepest) {
+                    victim = i;
+                    deepest = depth;
+                }
+            }
+            if (victim == thief) return std::unique_ptr<T>{};
+
+            lane & ln = lanes[victim];
+            std::unique_lock<std::mutex> l(ln.m);
+            if (ln.items.size() <= threshold) continue;   // drained since we looked: look again
+            ln.n_stolen_from.fetch_add(1, std::memory_order_relaxed);
+            return pop(ln);
+        }
+    }
+
+    // wakes one idle consumer other than the overloaded lane's own, to steal from it.
+    void wake_thief(size_t overloaded) {
+        std::atomic_thread_fence(std::memory_order_seq_cst);    // pairs with the one in dequeue
+        for (size_t k = 1; k < lanes.size(); k++) {
+            lane & ln = lanes[(overloaded + k) % lanes.size()];
+            if (ln.idle.load()) {
+                {   // locked context
+                    std::unique_lock<std::mutex> l(ln.m);
+                    ln.poked = true;
+                }   // end locked context
+                ln.cv.notify_one();
+                return;
+            }
+        }
+    }
+
+    std::atomic<bool> & shutting_down;
+
+    const int wait_interval; // units 1msec
+    const size_t max;
+    const size_t threshold;
+
+    Key key_of;
+
+    std::vector<lane> lanes;
+
+    std::atomic<uint64_t> n_dropped;
+    std::atomic<uint64_t> n_handled;
+};
+
+#endif // AFFINITY_QUEUE_H
@@ -0,0 +1,143 @@
+#include <cxxtest/TestSuite.h>
+#include <iostream>
+#include <thread>
+#include "affinity_queue.h"
+
+
+class affinity_queue_test : public CxxTest::TestSuite
+{
+public:
+
+    struct order {
+        uint64_t customer;
+        int seq;
+        uint64_t affinity_key() const { return customer; }
+    };
+
+    typedef affinity_queue<order> queue;
+
+    // the first customer at or after from whose lane is consumer.
+    static uint64_t customer_for(const queue & q, size_t consumer, uint64_t from = 0) {
+        while (q.lane_of(from) != consumer) from++;
+        return from;
+    }
+
+    void testSameKeyGoesToSameConsumer(void) {
+        std::atomic<bool> haltflag(false);
+        queue q(haltflag, 4, 8, SIZE_MAX, 10);
+
+        const uint64_t a = customer_for(q, 1), b = customer_for(q, 2);
+        for (int i = 0; i < 3; i++) {
+            q.enqueue(std::unique_ptr<order>(new order{ a, i }));
+            q.enqueue(std::unique_ptr<order>(new order{ b, i }));
+        }
+        TS_ASSERT_EQUALS(q.size(), 6);
+        TS_ASSERT_EQUALS(q.backlog(1), 3);
+        TS_ASSERT_EQUALS(q.backlog(2), 3);
+
+        for (int i = 0; i < 3; i++) {
+            std::unique_ptr<order> o = q.dequeue(1);
+            TS_ASSERT_EQUALS(o->customer, a);
+            TS_ASSERT_EQUALS(o->seq, i);
+        }
+
+        TS_TRACE("consumer 0 has nothing of its own, and lane 2 is under the threshold: nothing to steal");
+        std::thread idle([&]{ TS_ASSERT_EQUALS(q.dequeue(0).get(), nullptr); });
+        std::this_thread::sleep_for(30ms);
+        TS_ASSERT_EQUALS(q.backlog(2), 3);
+        haltflag = true;
+        idle.join();
+
+        std::vector<queue::locality> s = q.snapshot();
+        TS_ASSERT_EQUALS(s[1].local, 3);
+        TS_ASSERT_EQUALS(s[1].stolen, 0);
+        TS_ASSERT_EQUALS(s[1].local_fraction, 1.0);
+    }
+
+    void testBackloggedLaneIsStolenFrom(void) {
+        std::atomic<bool> haltflag(false);
+        queue q(haltflag, 2, 4, SIZE_MAX, 1000);
+
+        const uint64_t hot = customer_for(q, 0);
+        std::unique_ptr<order> got;
+        std::thread thief([&]{ got = q.dequeue(1); });
+        std::this_thread::sleep_for(20ms);
+
+        TS_TRACE("the fifth item pushes lane 0 over the threshold, which wakes the idle consumer well within its wait");
+        const auto started = std::chrono::steady_clock::now();
+        for (int i = 0; i < 5; i++)
+            q.enqueue(std::unique_ptr<order>(new order{ hot, i }));
+        thief.join();
+        TS_ASSERT_LESS_THAN(std::chrono::steady_clock::now() - started, 500ms);
+        TS_ASSERT_EQUALS(got->customer, hot);
+        TS_ASSERT_EQUALS(got->seq, 0);
+        TS_ASSERT_EQUALS(q.backlog(0), 4);
+
+        std::vector<queue::locality> s = q.snapshot();
+        TS_ASSERT_EQUALS(s[1].stolen, 1);
+        TS_ASSERT_EQUALS(s[0].stolen_from, 1);
+        TS_ASSERT_EQUALS(s[1].local_fraction, 0.0);
+    }
+
+    void testFullLaneDropsOldest(void) {
+        std::atomic<bool> haltflag(false);
+        queue q(haltflag, 2, 100, 3, 10);
+
+        const uint64_t c = customer_for(q, 0);
+        std::vector<std::unique_ptr<order> > bulk;
+        for (int i = 0; i < 5; i++)
+            bulk.push_back(std::unique_ptr<order>(new order{ c, i }));
+        bulk.push_back(std::unique_ptr<order>());
+        q.enqueue(bulk);
+
+        TS_ASSERT_EQUALS(q.size(), 3);
+        TS_ASSERT_EQUALS(q.dropped(), 2);
+        TS_ASSERT_EQUALS(q.dequeue(0)->seq, 2);
+        TS_ASSERT_EQUALS(q.handled(), 1);
+    }
+
+    void testZeroDepthDropsEverything(void) {
+        std::atomic<bool> haltflag(false);
+        queue q(haltflag, 2, 100, 0, 10);
+
+        q.enqueue(std::unique_ptr<order>(new order{ customer_for(q, 0), 0 }));
+        std::vector<std::unique_ptr<order> > bulk;
+        bulk.push_back(std::unique_ptr<order>(new order{ customer_for(q, 1), 1 }));
+        bulk.push_back(std::unique_ptr<order>(new order{ customer_for(q, 0), 2 }));
+        q.enqueue(bulk);
+
+        TS_TRACE("max_depth 0, as for work_queue: every item is dropped");
+        TS_ASSERT_EQUALS(q.size(), 0);
+        TS_ASSERT_EQUALS(q.dropped(), 3);
+        haltflag = true;
+        TS_ASSERT(!q.dequeue(0));
+    }
+
+    void testConcurrentConsumersServeEverything(void) {
+        std::atomic<bool> haltflag(false);
+        const size_t n_consumers = 4;
+        queue q(haltflag, n_consumers, 8, SIZE_MAX, 10);
+
+        const int n = 40000;
+        std::atomic<int> served(0);
+        std::vector<std::thread> consumers;
+        for (size_t c = 0; c < n_consumers; c++) {
+            consumers.emplace_back([&, c]{
+                while (std::unique_ptr<order> o = q.dequeue(c))
+                    served++;
+            });
+        }
+        for (int i = 0; i < n; i++)
+            q.enqueue(std::unique_ptr<order>(new order{ uint64_t(i % 100), i }));
+
+        while (served < n)
+            std::this_thread::sleep_for(1ms);
+        haltflag = true;
+        for (auto & consumer: consumers) consumer.join();
+
+        uint64_t total = 0;
+        for (const queue::locality & l: q.snapshot()) total += l.local + l.stolen;
+        TS_ASSERT_EQUALS(total, uint64_t(n));
+    }
+
+};
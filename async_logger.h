@@ -0,0 +1,523 @@
+#ifndef ASYNC_LOGGER_H
+#define ASYNC_LOGGER_H
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <unistd.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include "work_queue.h"
+
+/*!
+ * log_clock - the timestamps log calls take: the CPU's time-stamp counter where there is one (x86), a fraction
+ * of the cost of reading the system clock; steady_clock's count elsewhere.  async_logger's consumer turns the
+ * ticks into wall-clock time, calibrating them against the system clock as it goes.
+ */
+struct log_clock {
+    static uint64_t ticks() {
+#if defined(__x86_64__) || defined(__i386__)
+        return __rdtsc();
+#else
+        return static_cast<uint64_t>(std::chrono::steady_clock::now().time_since_epoch().count());
+#endif
+    }
+};
+
+/*!
+ * log_record - one captured log call: the format string, the raw arguments and the function that knows
+ * how to decode and format them.  128 bytes, so two to a cache line pair and nothing allocated per call.
+ */
+struct log_record {
+    static constexpr size_t arg_capacity = 104;
+
+    typedef int (*format_fn)(char * out, size_t n, const char * fmt, const unsigned char * args);
+
+    const char * fmt;           // must outlive the logger: in practice, a string literal
+    format_fn format;
+    uint64_t when;              // log_clock ticks
+    unsigned char args[arg_capacity];
+};
+
+/*!
+ * log_capture - how log arguments are copied into a log_record and read back out by the formatter.
+ *
+ * Trivially copyable arguments are copied as raw bytes.  Strings (const char *, char *, std::string) are
+ * copied as their characters, nul-terminated, truncated to the room the arguments after them leave.
+ */
+namespace log_capture {
+
+template <class A>
+struct arg
+{
+    static_assert(std::is_trivially_copyable<A>::value,
+                  "log arguments are captured as raw bytes; pass strings as const char * or std::string");
+
+    typedef A stored;
+    static constexpr size_t reserved = sizeof(A);
+
+    static unsigned char * put(unsigned char * p, const unsigned char *, const A & a) {
+        std::memcpy(p, &a, sizeof(A));
+        return p + sizeof(A);
+    }
+
+    static A get(const unsigned char * & p) {
+        A a;
+        std::memcpy(&a, p, sizeof(A));
+        p += sizeof(A);
+        return a;
+    }
+};
+
+struct string_arg
+{
+    typedef const char * stored;
+    static constexpr size_t reserved = 1;   // the nul; the characters take whatever room is left
+
+    static unsigned char * put(unsigned char * p, const unsigned char * end, const char * s) {
+        const size_t n = s ? strnlen(s, static_cast<size_t>(end - p) - 1) : 0;
+        if (n > 0) std::memcpy(p, s, n);
+        p[n] = 0;
+        return p + n + 1;
+    }
+
+    static const char * get(const unsigned char * & p) {
+        const char * s = reinterpret_cast<const char *>(p);
+        p += std::strlen(s) + 1;
+        return s;
+    }
+};
+
+template <> struct arg<const char *> : string_arg { };
+template <> struct arg<char *> : string_arg { };
+template <> struct arg<std::string> : string_arg {
+    static unsigned char * put(unsigned char * p, const unsigned char * end, const std::string & s) {
+        return string_arg::put(p, end, s.c_str());
+    }
+};
+
+// the bytes the arguments need at least.
+template <class... A> struct reserved;
+template <> struct reserved<> { static constexpr size_t value = 0; };
+template <class A, class... Rest> struct reserved<A, Rest...> {
+    static constexpr size_t value = arg<A>::reserved + reserved<Rest...>::value;
+};
+
+inline void encode(unsigned char *, const unsigned char *) { }
+
+template <class A, class... Rest>
+void encode(unsigned char * p, const unsigned char * end, const A & a, const Rest &... rest) {
+    p = arg<typename std::decay<A>::type>::put(p, end - reserved<typename std::decay<Rest>::type...>::value, a);
+    encode(p, end, rest...);
+}
+
+template <class... A, size_t... I>
+int format(char * out, size_t n, const char * fmt, const unsigned char * p, std::index_sequence<I...>) {
+    // braced initialisation decodes the arguments left to right.
+    const std::tuple<typename arg<A>::stored...> args{ arg<A>::get(p)... };
+    (void)p;
+    // the trailing 0 is never formatted; it lets a format without arguments through -Wformat-security.
+    return std::snprintf(out, n, fmt, std::get<I>(args)..., 0);
+}
+
+template <class... A>
+int format_record(char * out, size_t n, const char * fmt, const unsigned char * args) {
+    return format<A...>(out, n, fmt, args, std::index_sequence_for<A...>());
+}
+
+} // namespace log_capture
+
+/*!
+ * log_overflow - what a log call does when its thread has no free record batch: the consumer is behind.
+ */
+enum class log_overflow {
+    drop,       // discard the record, counted by dropped()
+    block       // wait for the consumer to hand a batch back
+};
+
+/*!
+ * async_log_params - tuning of an async_logger.
+ */
+struct async_log_params {
+    size_t records_per_batch = 256;
+    size_t batches_per_thread = 4;          // records in flight per thread: records_per_batch * batches_per_thread
+    log_overflow overflow = log_overflow::drop;
+    std::chrono::microseconds linger = std::chrono::milliseconds(5);    // see async_logger::log
+    size_t max_line = 512;                  // formatted lines are truncated to this, including the timestamp
+    size_t write_size = 64 * 1024;          // formatted text gathered before calling the sink
+};
+
+/*!
+ * async_logger - printf-style logging whose calls only capture their arguments, formatting and writing them
+ * on a background thread.
+ *
+ * Enqueueing a formatted std::string per log call costs an allocation, the formatting and a queue lock on the
+ * calling thread.  Here a log call copies the format string pointer, a timestamp and the raw arguments (see
+ * log_capture) into the next record of a batch preallocated for the calling thread: no allocation, no lock.
+ * A full batch goes to the consumer over a work_queue, one lock per batch; the consumer formats its records,
+ * hands the batch back to its thread over that thread's work_queue of free batches, and passes the text to the
+ * sink in writes of up to write_size.
+ *
+ * A thread's records are written in the order it logged them; the lines of different threads interleave by
+ * batch.  A thread's records reach the consumer when its batch fills, when a log call finds the batch's first
+ * record older than linger, when the thread calls flush(), or when the thread exits.  So a thread that logs
+ * a few lines and then goes quiet holds them until one of those.
+ *
+ * When a thread has no free batch its log calls drop or block, by params::overflow.
+ *
+ * Each thread that logs gets its batches on its first log call, and keeps them until it exits, even past the
+ * logger's destruction.  Threads still logging when the logger is destroyed lose those records.
+ */
+class async_logger
+{
+public:
+
+    using params = async_log_params;
+    using sink_type = std::function<void(const char *, size_t)>;
+
+    /*!
+     * \brief async_logger starts the consumer thread, which passes formatted text to sink.
+     */
+    explicit async_logger(sink_type sink, const params & p = params())
+        : id(next_id())
+        , shared(std::make_shared<core>(p))
+        , write(std::move(sink))
+        , flush_m()
+        , flush_cv()
+        , flush_requested(0)
+        , flushed(0)
+        , consumer()
+    {
+        consumer = std::thread([this]{ run(); });
+    }
+
+    /*!
+     * \brief ~async_logger writes everything submitted so far, including the calling thread's batch.
+     */
+    ~async_logger() {
+        if (producer * p = local(false)) p->submit();
+
+        std::unique_ptr<batch> stop(new batch(0));
+        stop->kind = batch::stop_marker;
+        shared->filled.enqueue(std::move(stop));
+        consumer.join();
+
+        // batches submitted after the stop marker are lost; discarding them releases their threads' producers.
+        while (shared->filled.size() > 0)
+            shared->filled.dequeue();
+        shared->halt = true;
+    }
+
+    async_logger(const async_logger &) = delete;
+    async_logger & operator=(const async_logger &) = delete;
+
+    /*!
+     * \brief log captures a printf-style log call, written later by the consumer as a timestamped line.
+     *        fmt must outlive the logger (a string literal); the arguments are copied.
+     */
+    template <class... Args>
+    void log(const char * fmt, const Args &... args) {
+        static_assert(log_capture::reserved<typename std::decay<Args>::type...>::value <= log_record::arg_capacity,
+                      "too many log arguments to capture");
+
+        producer & p = *local(true);
+        if (!p.current && !p.refill()) return;
+
+        batch & b = *p.current;
+        log_record & r = b.entries[b.count];
+        r.fmt = fmt;
+        r.format = &log_capture::format_record<typename std::decay<Args>::type...>;
+        r.when = log_clock::ticks();
+        log_capture::encode(r.args, r.args + log_record::arg_capacity, args...);
+
+        if (b.count++ == 0) b.opened = r.when;
+        if (b.count == b.entries.size() || r.when - b.opened >= shared->linger_ticks.load(std::memory_order_relaxed))
+            p.submit();
+    }
+
+    /*!
+     * \brief flush returns once everything submitted so far, including the calling thread's batch, is written.
+     */
+    void flush() {
+        if (producer * p = local(false)) p->submit();
+
+        std::unique_ptr<batch> marker(new batch(0));
+        marker->kind = batch::flush_marker;
+        std::unique_lock<std::mutex> l(flush_m);
+        const uint64_t ticket = marker->ticket = ++flush_requested;
+        l.unlock();
+
+        shared->filled.enqueue(std::move(marker));
+
+        l.lock();
+        flush_cv.wait(l, [&]{ return flushed >= ticket; });
+    }
+
+    /*!
+     * \brief dropped returns the number of records dropped for want of a free batch since the last call.
+     */
+    int dropped() { return shared->n_dropped.exchange(0); }
+
+    /*!
+     * \brief handled returns the number of records written since the last call.
+     */
+    int handled() { return shared->n_handled.exchange(0); }
+
+    /*!
+     * \brief fd_sink returns a sink writing to the file descriptor fd, which the caller keeps open.
+     */
+    static sink_type fd_sink(int fd) {
+        return [fd](const char * data, size_t n) {
+            while (n > 0) {
+                const ssize_t written = ::write(fd, data, n);
+                if (written < 0) {
+                    if (errno == EINTR) continue;
+                    return;
+                }
+                data += written;
+                n -= static_cast<size_t>(written);
+            }
+        };
+    }
+
+private:
+
+    struct producer;
+
+    struct batch {
+        enum kind_type { records, flush_marker, stop_marker };
+
+        explicit batch(size_t capacity)
+            : kind(records)
+            , entries(capacity)
+            , count(0)
+            , opened()
+            , ticket(0)
+            , owner()
+        { }
+
+        kind_type kind;
+        std::vector<log_record> entries;
+        size_t count;
+        uint64_t opened;                                // when its first record was logged, in log_clock ticks
+        uint64_t ticket;                                // of a flush marker
+        std::shared_ptr<producer> owner;                // while submitted: where the batch goes back to
+    };
+
+    // what the logger shares with its threads' producers, which may outlive it.
+    struct core {
+        explicit core(const params & p)
+            : cfg(p)
+            , halt(false)
+            , filled(halt, SIZE_MAX, 10)
+            , n_dropped(0)
+            , n_handled(0)
+            , linger_ticks(static_cast<uint64_t>(std::chrono::nanoseconds(p.linger).count()))
+        {
+            cfg.records_per_batch = std::max<size_t>(cfg.records_per_batch, 1);
+            cfg.batches_per_thread = std::max<size_t>(cfg.batches_per_thread, 1);
+            cfg.max_line = std::max<size_t>(cfg.max_line, 64);
+        }
+
+        params cfg;
+        std::atomic<bool> halt;
+        work_queue<batch> filled;
+        std::atomic<int> n_dropped;
+        std::atomic<int> n_handled;
+        std::atomic<uint64_t> linger_ticks;     // taking a tick for a nanosecond until the consumer calibrates
+    };
+
+    // one thread's batches.  Only that thread touches current; free is filled by the consumer.
+    struct producer : std::enable_shared_from_this<producer> {
+        explicit producer(std::shared_ptr<core> c)
+            : shared(std::move(c))
+            , free(shared->halt, SIZE_MAX, 10)
+            , current()
+        {
+            std::vector<std::unique_ptr<batch> > batches;
+            for (size_t i = 0; i < shared->cfg.batches_per_thread; i++)
+                batches.emplace_back(new batch(shared->cfg.records_per_batch));
+            free.enqueue(batches);
+        }
+
+        bool refill() {
+            // only this thread takes from free, so a non-zero approx_size means dequeue won't wait.
+            if (shared->cfg.overflow == log_overflow::drop && free.approx_size() == 0) {
+                shared->n_dropped++;
+                return false;
+            }
+            current = free.dequeue();
+            if (!current) {
+                shared->n_dropped++;    // the logger is gone
+                return false;
+            }
+            current->count = 0;
+            return true;
+        }
+
+        // hands the current batch, if it holds any records, to the consumer; refused and lost when halting.
+        void submit() {
+            if (!current || current->count == 0) return;
+            current->owner = shared_from_this();
+            shared->filled.enqueue(std::move(current));
+            current.reset();
+        }
+
+        std::shared_ptr<core> shared;
+        work_queue<batch> free;
+        std::unique_ptr<batch> current;
+    };
+
+    // submits its thread's last records when the thread exits.
+    struct producer_handle {
+        explicit producer_handle(std::shared_ptr<producer> p) : p(std::move(p)) { }
+        producer_handle(producer_handle &&) = default;
+        ~producer_handle() { if (p) p->submit(); }
+
+        std::shared_ptr<producer> p;
+    };
+
+    static uint64_t next_id() {
+        static std::atomic<uint64_t> last(0);
+        return ++last;
+    }
+
+    // the calling thread's producer for this logger, made if create is set.  Logger ids are never reused, so
+    // entries left by destroyed loggers are never matched.
+    producer * local(bool create) {
+        thread_local uint64_t cached_id = 0;
+        thread_local producer * cached = nullptr;
+        if (cached_id == id) return cached;
+
+        thread_local std::unordered_map<uint64_t, producer_handle> producers;
+        auto found = producers.find(id);
+        if (found == producers.end()) {
+            if (!create) return nullptr;
+            found = producers.emplace(id, producer_handle(std::make_shared<producer>(shared))).first;
+        }
+        cached_id = id;
+        cached = found->second.p.get();
+        return cached;
+    }
+
+    // turns log_clock ticks into system_clock time.  The tick rate is measured over the consumer's life so far;
+    // each record is dated back from a fresh reading of both clocks, so rate errors scale only with its age.
+    struct tick_calibration {
+        tick_calibration()
+            : first_ticks(log_clock::ticks())
+            , first_time(std::chrono::system_clock::now())
+            , now_ticks(first_ticks)
+            , now_time(first_time)
+            , ns_per_tick(1.0)
+        { }
+
+        // rereads both clocks; returns whether the rate was remeasured.
+        bool update() {
+            now_ticks = log_clock::ticks();
+            now_time = std::chrono::system_clock::now();
+            const std::chrono::duration<double, std::nano> elapsed = now_time - first_time;
+            if (elapsed < std::chrono::milliseconds(1) || now_ticks <= first_ticks) return false;
+            ns_per_tick = elapsed.count() / static_cast<double>(now_ticks - first_ticks);
+            return true;
+        }
+
+        std::chrono::system_clock::time_point time_of(uint64_t ticks) const {
+            const double age_ns = static_cast<double>(static_cast<int64_t>(now_ticks - ticks)) * ns_per_tick;
+            return now_time - std::chrono::duration_cast<std::chrono::system_clock::duration>(
+                        std::chrono::duration<double, std::nano>(age_ns));
+        }
+
+        const uint64_t first_ticks;
+        const std::chrono::system_clock::time_point first_time;
+        uint64_t now_ticks;
+        std::chrono::system_clock::time_point now_time;
+        double ns_per_tick;
+    };
+
+    void run() {
+        std::string out;
+        out.reserve(shared->cfg.write_size + shared->cfg.max_line);
+        std::vector<char> line(shared->cfg.max_line);
+        tick_calibration clock;
+
+        while (std::unique_ptr<batch> b = shared->filled.dequeue()) {
+            if (b->kind == batch::records) {
+                if (clock.update()) {
+                    const double linger_ns = std::chrono::duration<double, std::nano>(shared->cfg.linger).count();
+                    shared->linger_ticks.store(static_cast<uint64_t>(linger_ns / clock.ns_per_tick),
+                                               std::memory_order_relaxed);
+                }
+                for (size_t i = 0; i < b->count; i++)
+                    append(out, line, b->entries[i], clock.time_of(b->entries[i].when));
+                shared->n_handled += static_cast<int>(b->count);
+                recycle(std::move(b));
+                if (out.size() >= shared->cfg.write_size || shared->filled.approx_size() == 0)
+                    write_out(out);
+                continue;
+            }
+
+            write_out(out);
+            if (b->kind == batch::stop_marker) return;
+            {   // locked context
+                std::unique_lock<std::mutex> l(flush_m);
+                flushed = std::max(flushed, b->ticket);
+            }   // end locked context
+            flush_cv.notify_all();
+        }
+    }
+
+    static void append(std::string & out, std::vector<char> & line, const log_record & r,
+                       std::chrono::system_clock::time_point when) {
+        const long long us = std::chrono::duration_cast<std::chrono::microseconds>(when.time_since_epoch()).count();
+        const size_t room = line.size();
+        int n = std::snprintf(line.data(), room, "%lld.%06lld ", us / 1000000, us % 1000000);
+        n = std::max(n, 0);
+        const int m = r.format(line.data() + n, room - n, r.fmt, r.args);
+        const size_t length = std::min(static_cast<size_t>(n) + static_cast<size_t>(std::max(m, 0)), room - 1);
+        out.append(line.data(), length);
+        out.push_back('\n');
+    }
+
+    static void recycle(std::unique_ptr<batch> b) {
+        std::shared_ptr<producer> owner = std::move(b->owner);
+        b->count = 0;
+        owner->free.enqueue(std::move(b));
+    }
+
+    void write_out(std::string & out) {
+        if (out.empty()) return;
+        write(out.data(), out.size());
+        out.clear();
+    }
+
+    const uint64_t id;
+    std::shared_ptr<core> shared;
+    sink_type write;
+
+    std::mutex flush_m;
+    std::condition_variable flush_cv;
+    uint64_t flush_requested;
+    uint64_t flushed;
+
+    std::thread consumer;
+};
+
+#endif // ASYNC_LOGGER_H
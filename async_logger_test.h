@@ -0,0 +1,126 @@
+#include <cxxtest/TestSuite.h>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include "async_logger.h"
+
+
+class async_logger_test : public CxxTest::TestSuite
+{
+public:
+
+    // the lines written so far, without their timestamps.  Read them after a flush.
+    struct captured {
+        std::string text;
+        async_logger::sink_type sink() { return [this](const char * data, size_t n){ text.append(data, n); }; }
+
+        std::vector<std::string> lines() const {
+            std::vector<std::string> result;
+            std::istringstream in(text);
+            std::string line;
+            while (std::getline(in, line))
+                result.push_back(line.substr(line.find(' ') + 1));
+            return result;
+        }
+    };
+
+    void testFormatsCapturedArguments(void) {
+        captured out;
+        async_logger logger(out.sink());
+
+        {
+            std::string customer("acme");
+            char buffer[] = "mutable";
+            logger.log("order %d for %s: %.2f (%c)", 42, customer, 9.5, 'x');
+            logger.log("%s and %s", buffer, "a literal");
+            TS_TRACE("arguments are captured by value: the std::string may go before the line is written");
+        }
+        logger.log("no arguments, 100%%");
+        logger.log("%s|%d", std::string(500, 'y').c_str(), 7);
+        logger.flush();
+
+        const std::vector<std::string> lines = out.lines();
+        TS_ASSERT_EQUALS(lines.size(), 4);
+        TS_ASSERT_EQUALS(lines[0], "order 42 for acme: 9.50 (x)");
+        TS_ASSERT_EQUALS(lines[1], "mutable and a literal");
+        TS_ASSERT_EQUALS(lines[2], "no arguments, 100%");
+
+        TS_TRACE("a long string is truncated to leave room for the arguments after it");
+        TS_ASSERT_EQUALS(lines[3].size(), log_record::arg_capacity - 4 - 1 + 2);
+        TS_ASSERT_EQUALS(lines[3].substr(lines[3].size() - 3), "y|7");
+        TS_ASSERT_EQUALS(logger.handled(), 4);
+        TS_ASSERT_EQUALS(logger.dropped(), 0);
+    }
+
+    void testDropPolicyCountsOverflow(void) {
+        std::atomic<bool> open(false);
+        async_logger::params p;
+        p.records_per_batch = 4;
+        p.batches_per_thread = 2;
+        p.overflow = log_overflow::drop;
+        async_logger logger([&](const char *, size_t){ while (!open) std::this_thread::yield(); }, p);
+
+        TS_TRACE("the consumer is stuck in the sink, so the thread runs out of batches");
+        const int n = 100;
+        for (int i = 0; i < n; i++)
+            logger.log("%d", i);
+        const int dropped = logger.dropped();
+        TS_ASSERT_LESS_THAN(0, dropped);
+
+        open = true;
+        logger.flush();
+        TS_ASSERT_EQUALS(logger.handled() + dropped, n);
+    }
+
+    void testBlockPolicyKeepsEveryThreadsOrder(void) {
+        captured out;
+        async_logger::params p;
+        p.records_per_batch = 16;
+        p.batches_per_thread = 2;
+        p.overflow = log_overflow::block;
+        async_logger logger(out.sink(), p);
+
+        const int n_threads = 4, per_thread = 5000;
+        std::vector<std::thread> threads;
+        for (int t = 0; t < n_threads; t++)
+            threads.emplace_back([&, t]{
+                for (int i = 0; i < per_thread; i++)
+                    logger.log("%d %d", t, i);
+            });
+        TS_TRACE("each thread's last, partial batch goes out when the thread exits");
+        for (auto & thread: threads) thread.join();
+        logger.flush();
+
+        std::vector<int> next(n_threads, 0);
+        size_t n_lines = 0;
+        for (const std::string & line: out.lines()) {
+            int t = -1, i = -1;
+            std::istringstream(line) >> t >> i;
+            TS_ASSERT(t >= 0 && t < n_threads);
+            if (t < 0 || t >= n_threads) break;
+            TS_ASSERT_EQUALS(i, next[t]);
+            next[t] = i + 1;
+            n_lines++;
+        }
+        TS_ASSERT_EQUALS(n_lines, size_t(n_threads) * per_thread);
+        TS_ASSERT_EQUALS(logger.dropped(), 0);
+    }
+
+    void testLingerSubmitsAQuietThreadsBatch(void) {
+        captured out;
+        async_logger::params p;
+        p.linger = std::chrono::microseconds(0);
+        async_logger logger(out.sink(), p);
+
+        TS_TRACE("with no linger, every record is submitted as it is logged: written without a flush");
+        logger.log("first");
+        int handled = 0;
+        for (int i = 0; i < 1000 && handled == 0; i++) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            handled += logger.handled();
+        }
+        TS_ASSERT_EQUALS(handled, 1);
+    }
+
+};
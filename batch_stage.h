@@ -0,0 +1,253 @@
+#ifndef BATCH_STAGE_H
+#define BATCH_STAGE_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "work_queue.h"
+
+/*!
+ * item_destination - the default destination of a batch_stage item: its destination() member.
+ */
+template <class T>
+struct item_destination {
+    auto operator()(const T & work_item) const -> decltype(work_item.destination()) { return work_item.destination(); }
+};
+
+/*!
+ * batch_stage - sits between a work_queue and its consumers, gathering the queue's items into one batch per
+ * destination, for consumers whose sends cost far less per item in batches.
+ *
+ * A pump thread dequeues the input queue's items and appends each to the open batch of its destination.  A
+ * batch is released to the consumers when
+ *   - it reaches batch_size items (release_reason::size);
+ *   - its oldest item is older than linger (release_reason::linger), as timed by a timer wheel: a ring of
+ *     tick slots spanning the linger, each listing the batches falling due in it, advanced by a ticker thread.
+ *     So a batch goes out between linger and linger + tick after its first item, and neither timing nor
+ *     releasing a batch scans the others;
+ *   - the open batches together hold max_buffered items and an item arrives (release_reason::memory): the
+ *     largest open batch goes, freeing the most memory and making the fullest send;
+ *   - the halt flag is set (release_reason::halt): every open batch goes, and the consumers get them all before
+ *     dequeue() reports the halt.
+ * Items keep their order within a destination.
+ *
+ * The input queue is halted by the same flag, dropping what it still holds, as work_queue does.
+ * Released batches wait in a work_queue of their own, which max_buffered doesn't count.
+ *
+ * Destination maps an item to its destination key, which must be hashable.
+ */
+template <class T, class Destination = item_destination<T>, class Queue = work_queue<T> >
+class batch_stage
+{
+public:
+
+    typedef typename std::decay<decltype(std::declval<Destination>()(std::declval<const T &>()))>::type key_type;
+
+    enum class release_reason { size, linger, memory, halt };
+
+    struct batch {
+        key_type destination;
+        std::vector<std::unique_ptr<T> > items;     // oldest first
+        release_reason reason;
+    };
+
+    struct stats {
+        size_t open_batches;
+        size_t buffered;                // items in open batches
+        uint64_t released_by_size;
+        uint64_t released_by_linger;
+        uint64_t released_by_memory;
+        uint64_t released_by_halt;
+    };
+
+    /*!
+     * \brief batch_stage starts the pump and ticker threads on input, whose halt flag is halt_flag.
+     * \param tick the timer wheel's resolution: how late after linger a batch may go.
+     */
+    batch_stage(Queue & input, std::atomic<bool> & halt_flag, size_t batch_size, std::chrono::milliseconds linger,
+                size_t max_buffered = SIZE_MAX, std::chrono::milliseconds tick = 1ms, Destination destination = Destination())
+        : in(input)
+        , shutting_down(halt_flag)
+        , max_batch(std::max<size_t>(batch_size, 1))
+        , max_items(std::max<size_t>(max_buffered, 1))
+        , tick_length(std::max(tick, std::chrono::milliseconds(1)))
+        , linger_ticks(static_cast<uint64_t>((linger + tick_length - 1ms) / tick_length))
+        , destination_of(std::move(destination))
+        , m()
+        , open()
+        , wheel(linger_ticks + 2)
+        , now_tick(0)
+        , n_generations(0)
+        , n_buffered(0)
+        , n_released{ 0, 0, 0, 0 }
+        , closed(false)
+        , pumped_out(false)
+        , ready(closed, SIZE_MAX, 10)
+        , pump()
+        , ticker()
+    {
+        pump = std::thread([this]{ run_pump(); });
+        ticker = std::thread([this]{ run_ticker(); });
+    }
+
+    ~batch_stage() {
+        if (pump.joinable()) pump.join();
+        if (ticker.joinable()) ticker.join();
+    }
+
+    batch_stage(const batch_stage &) = delete;
+    batch_stage & operator=(const batch_stage &) = delete;
+
+    /*!
+     * \brief dequeue returns the next released batch, blocking until there is one.
+     * \return an empty pointer once halting and every batch has been handed out.
+     */
+    std::unique_ptr<batch> dequeue() {
+        std::unique_ptr<batch> released = ready.dequeue();
+        close_if_drained();
+        return released;
+    }
+
+    /*!
+     * \brief approx_size returns the number of released batches waiting for a consumer, as work_queue's does.
+     */
+    size_t approx_size() const { return ready.approx_size(); }
+
+    bool empty() const { return ready.empty(); }
+
+    bool is_halting() const { return shutting_down; }
+
+    /*!
+     * \brief handled returns the number of batches handed to consumers since the last call.
+     */
+    int handled() { return ready.handled(); }
+
+    stats snapshot() const {
+        std::unique_lock<std::mutex> l(m);
+        return stats{ open.size(), n_buffered, n_released[0], n_released[1], n_released[2], n_released[3] };
+    }
+
+private:
+
+    struct open_batch {
+        std::vector<std::unique_ptr<T> > items;
+        uint64_t generation;    // tells the wheel's entry for this batch from those of earlier batches for the key
+    };
+
+    typedef std::unordered_map<key_type, open_batch> open_map;
+
+    struct wheel_entry {
+        key_type destination;
+        uint64_t generation;
+    };
+
+    void run_pump() {
+        while (std::unique_ptr<T> work_item = in.dequeue()) {
+            {   // locked context
+                std::unique_lock<std::mutex> l(m);
+                add(std::move(work_item));
+            }   // end locked context
+            in.finished();
+        }
+
+        {   // locked context
+            std::unique_lock<std::mutex> l(m);
+            while (!open.empty())
+                release(open.begin(), release_reason::halt);
+        }   // end locked context
+        pumped_out = true;
+        close_if_drained();
+    }
+
+    void run_ticker() {
+        auto next = std::chrono::steady_clock::now();
+        while (!shutting_down) {
+            next += tick_length;
+            std::this_thread::sleep_until(next);
+
+            std::unique_lock<std::mutex> l(m);
+            now_tick++;
+            std::vector<wheel_entry> & due = wheel[now_tick % wheel.size()];
+            for (const wheel_entry & entry: due) {
+                auto batch_it = open.find(entry.destination);
+                if (batch_it != open.end() && batch_it->second.generation == entry.generation)
+                    release(batch_it, release_reason::linger);
+            }
+            due.clear();
+        }
+    }
+
+    // called with m held.
+    void add(std::unique_ptr<T> work_item) {
+        if (n_buffered >= max_items) release(largest(), release_reason::memory);
+
+        const key_type destination = destination_of(*work_item);
+        auto batch_it = open.find(destination);
+        if (batch_it == open.end()) {
+            batch_it = open.emplace(destination, open_batch{ {}, ++n_generations }).first;
+            wheel[(now_tick + linger_ticks + 1) % wheel.size()].push_back(wheel_entry{ destination, n_generations });
+        }
+
+        batch_it->second.items.push_back(std::move(work_item));
+        n_buffered++;
+        if (batch_it->second.items.size() >= max_batch) release(batch_it, release_reason::size);
+    }
+
+    // called with m held, and at least one batch open.  Linear in the open batches, but it frees at least
+    // max_items / open.size() items, so the scans stay rare.
+    typename open_map::iterator largest() {
+        return std::max_element(open.begin(), open.end(),
+                                [](const typename open_map::value_type & a, const typename open_map::value_type & b) {
+            return a.second.items.size() < b.second.items.size();
+        });
+    }
+
+    // called with m held.  A released batch's wheel entry stays behind, matching no open batch.
+    void release(typename open_map::iterator batch_it, release_reason reason) {
+        n_buffered -= batch_it->second.items.size();
+        n_released[static_cast<int>(reason)]++;
+        ready.enqueue(std::unique_ptr<batch>(new batch{ batch_it->first, std::move(batch_it->second.items), reason }));
+        open.erase(batch_it);
+    }
+
+    // once the pump has released its last batch and the consumers have taken them all, wakes the consumers
+    // to report the halt.  Both the pump and each consumer check after their own step, so one of them sees both.
+    void close_if_drained() {
+        if (pumped_out && ready.size() == 0) closed = true;
+    }
+
+    Queue & in;
+    std::atomic<bool> & shutting_down;
+
+    const size_t max_batch;
+    const size_t max_items;
+    const std::chrono::milliseconds tick_length;
+    const uint64_t linger_ticks;
+    Destination destination_of;
+
+    mutable std::mutex m;
+    open_map open;
+    std::vector<std::vector<wheel_entry> > wheel;   // slot i lists the batches due at a tick ≡ i, mod its size
+    uint64_t now_tick;
+    uint64_t n_generations;
+    size_t n_buffered;
+    uint64_t n_released[4];                         // by release_reason
+
+    std::atomic<bool> closed;                       // the halt flag of ready
+    std::atomic<bool> pumped_out;
+    work_queue<batch> ready;
+
+    std::thread pump;
+    std::thread ticker;
+};
+
+#endif // BATCH_STAGE_H
@@ -0,0 +1,108 @@
+#include <cxxtest/TestSuite.h>
+#include <iostream>
+#include <thread>
+#include "batch_stage.h"
+
+
+class batch_stage_test : public CxxTest::TestSuite
+{
+public:
+
+    struct message {
+        int dest;
+        int seq;
+        int destination() const { return dest; }
+    };
+
+    typedef batch_stage<message> stage_type;
+
+    static std::unique_ptr<message> make(int dest, int seq) { return std::unique_ptr<message>(new message{ dest, seq }); }
+
+    void testSizeThresholdKeepsOrder(void) {
+        std::atomic<bool> haltflag(false);
+        work_queue<message> q(haltflag, SIZE_MAX, 10);
+        stage_type stage(q, haltflag, 3, std::chrono::milliseconds(10000));
+
+        q.enqueue(make(1, 0));
+        q.enqueue(make(2, 0));
+        q.enqueue(make(1, 1));
+        q.enqueue(make(1, 2));
+
+        std::unique_ptr<stage_type::batch> b = stage.dequeue();
+        TS_ASSERT_EQUALS(b->destination, 1);
+        TS_ASSERT(b->reason == stage_type::release_reason::size);
+        TS_ASSERT_EQUALS(b->items.size(), 3);
+        for (int i = 0; i < 3; i++)
+            TS_ASSERT_EQUALS(b->items[i]->seq, i);
+
+        const stage_type::stats s = stage.snapshot();
+        TS_ASSERT_EQUALS(s.open_batches, 1);
+        TS_ASSERT_EQUALS(s.buffered, 1);
+        TS_ASSERT_EQUALS(s.released_by_size, 1);
+        haltflag = true;
+    }
+
+    void testLingerReleasesAnOldBatch(void) {
+        std::atomic<bool> haltflag(false);
+        work_queue<message> q(haltflag, SIZE_MAX, 10);
+        stage_type stage(q, haltflag, 100, std::chrono::milliseconds(20), SIZE_MAX, std::chrono::milliseconds(5));
+
+        const auto started = std::chrono::steady_clock::now();
+        q.enqueue(make(7, 0));
+        std::unique_ptr<stage_type::batch> b = stage.dequeue();
+        const auto waited = std::chrono::steady_clock::now() - started;
+
+        TS_ASSERT(b->reason == stage_type::release_reason::linger);
+        TS_ASSERT_EQUALS(b->items.size(), 1);
+        TS_ASSERT(waited >= std::chrono::milliseconds(20));
+        TS_ASSERT_EQUALS(stage.snapshot().released_by_linger, 1);
+        haltflag = true;
+    }
+
+    void testMemoryBoundReleasesTheLargest(void) {
+        std::atomic<bool> haltflag(false);
+        work_queue<message> q(haltflag, SIZE_MAX, 10);
+        stage_type stage(q, haltflag, 100, std::chrono::milliseconds(10000), 4);
+
+        q.enqueue(make(1, 0));
+        q.enqueue(make(2, 0));
+        q.enqueue(make(2, 1));
+        q.enqueue(make(2, 2));
+        TS_TRACE("four items buffered: a fifth releases destination 2's three first");
+        q.enqueue(make(3, 0));
+
+        std::unique_ptr<stage_type::batch> b = stage.dequeue();
+        TS_ASSERT_EQUALS(b->destination, 2);
+        TS_ASSERT(b->reason == stage_type::release_reason::memory);
+        TS_ASSERT_EQUALS(b->items.size(), 3);
+        while (stage.snapshot().buffered < 2)
+            std::this_thread::yield();
+        TS_ASSERT_EQUALS(stage.snapshot().open_batches, 2);
+        haltflag = true;
+    }
+
+    void testHaltReleasesEverything(void) {
+        std::atomic<bool> haltflag(false);
+        work_queue<message> q(haltflag, SIZE_MAX, 10);
+        stage_type stage(q, haltflag, 100, std::chrono::milliseconds(10000));
+
+        for (int i = 0; i < 10; i++)
+            q.enqueue(make(i % 3, i));
+        while (stage.snapshot().buffered < 10)
+            std::this_thread::yield();
+        haltflag = true;
+
+        TS_TRACE("the consumers get every open batch before the halt");
+        size_t n_items = 0, n_batches = 0;
+        while (std::unique_ptr<stage_type::batch> b = stage.dequeue()) {
+            TS_ASSERT(b->reason == stage_type::release_reason::halt);
+            n_items += b->items.size();
+            n_batches++;
+        }
+        TS_ASSERT_EQUALS(n_items, 10);
+        TS_ASSERT_EQUALS(n_batches, 3);
+        TS_ASSERT(!stage.dequeue());
+        TS_ASSERT_EQUALS(stage.handled(), 3);
+    }
+
+};
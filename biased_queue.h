@@ -0,0 +1,341 @@
+#ifndef BIASED_QUEUE_H
+#define BIASED_QUEUE_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "depth_gauge.h"
+
+using namespace std::chrono_literals;
+
+/*!
+ * biased_queue - a work queue biased towards one owning thread, for queues mostly filled and drained by
+ * the same thread.
+ *
+ * While the bias holds, the owner enqueues into and dequeues from a private std::deque with no lock and no
+ * atomic read-modify-write: its only synchronisation is a relaxed load of the revocation flag and relaxed
+ * stores publishing its counters.  Other threads enqueue into a shared side queue under a mutex; the owner
+ * serves that side queue first whenever it is non-empty, so their items are not held back by its own.
+ *
+ * A thread other than the owner that wants to dequeue while the shared side is empty requests revocation.
+ * The owner honours the request at its next operation (or on flush()): it publishes its private items to the
+ * shared side and from then on uses the shared path like everyone else, until it calls rebias().  Because
+ * revocation needs the owner's cooperation, an owner that may go idle while holding items should call
+ * flush() before it does.
+ *
+ * Ordering is FIFO per producer.  max_depth bounds the owner's private buffer and the shared side queue
+ * separately, each dropping its oldest item when full.  Halting follows work_queue.
+ */
+template <class T>
+class biased_queue
+{
+public:
+
+    struct stats {
+        uint64_t fast_path;     // owner operations served from the private buffer
+        uint64_t slow_path;     // operations that took the mutex
+        uint64_t revocations;
+        bool biased;
+    };
+
+    /*!
+     * \brief biased_queue creates a queue owned by the constructing thread; see work_queue for the parameters.
+     */
+    biased_queue(std::atomic<bool> & halt_flag, size_t max_depth = SIZE_MAX, int wait_interval_ms = 100)
+        : shutting_down(halt_flag)
+        , wait_interval(wait_interval_ms)
+        , max(max_depth)
+        , owner(std::this_thread::get_id())
+        , local()
+        , local_fast_path(0)
+        , local_dropped(0)
+        , published_size()
+        , published_fast_path(0)
+        , published_dropped(0)
+        , biased(true)
+        , revoke_requested(false)
+        , m()
+        , cv()
+        , shared()
+        , shared_size()
+        , n_dropped(0)
+        , n_slow_path(0)
+        , n_revocations(0)
+    { }
+
+    /*!
+     * \brief enqueue adds the work item; on the owner thread while biased this is a plain deque push.
+     *        Enqueues while shutting down, and empty std::unique_ptrs, are ignored.
+     */
+    void enqueue(std::unique_ptr<T> work_item)
+    {
+        if (shutting_down || !work_item) return;
+
+        if (is_owner()) {
+            honour_revocation();
+            if (biased.load(std::memory_order_relaxed)) {
+                if (local.size() >= max) {
+                    local_dropped++;
+                    published_dropped.store(local_dropped, std::memory_order_relaxed);
+                    if (local.empty()) return;      // max 0: the item itself is dropped
+                    local.pop_front();
+                }
+                local.push_back(std::move(work_item));
+                local_fast_path++;
+                publish_local();
+                return;
+            }
+        }
+
+        {   // locked context
+            std::unique_lock<std::mutex> l(m);
+            push_shared(std::move(work_item));
+        }   // end locked context
+
+        cv.notify_one();
+    }
+
+    /*!
+     * \brief enqueue adds all the non-empty elements of bulk, as enqueue does for one.
+     */
+    void enqueue(std::vector<std::unique_ptr<T> > & bulk)
+    {
+        if (shutting_down) return;
+
+        if (is_owner()) {
+            honour_revocation();
+            if (biased.load(std::memory_order_relaxed)) {
+                for (auto & work_item: bulk) {
+                    if (!work_item) continue;
+                    if (local.size() >= max) {
+                        local_dropped++;
+                        if (local.empty()) continue;
+                        local.pop_front();
+                    }
+                    local.push_back(std::move(work_item));
+                    local_fast_path++;
+                }
+                published_dropped.store(local_dropped, std::memory_order_relaxed);
+                publish_local();
+                return;
+            }
+        }
+
+        bool pushed = false;
+        {   // locked context
+            std::unique_lock<std::mutex> l(m);
+            for (auto & work_item: bulk) {
+                if (!work_item) continue;
+                push_shared(std::move(work_item));
+                pushed = true;
+            }
+        }   // end locked context
+
+        if (pushed) cv.notify_one();
+    }
+
+    /*!
+     * \brief dequeue removes and returns the next work item, blocking until one is available or halting.
+     *        The owner takes from the shared side queue first while it holds items, then from its own buffer.
+     * \return a work item, or the empty std::unique_ptr when shutting down.
+     */
+    std::unique_ptr<T> dequeue()
+    {
+        if (shutting_down) return std::unique_ptr<T>{};
+
+        const bool mine = is_owner();
+        if (mine) {
+            honour_revocation();
+            if (!local.empty() && shared_size.load() == 0) {
+                std::unique_ptr<T> val = std::move(local.front());
+                local.pop_front();
+                local_fast_path++;
+                publish_local();
+                return val;
+            }
+        }
+
+        std::unique_lock<std::mutex> l(m);
+        for (;;) {
+            if (shutting_down) return std::unique_ptr<T>{};
+
+            if (!shared.empty()) {
+                std::unique_ptr<T> val = std::move(shared.front());
+                shared.pop_front();
+                shared_size.publish(shared.size());
+                n_slow_path++;
+                return val;
+            }
+
+            if (mine) {
+                // the owner's own items are next; it never needs to wait while it holds some.
+                if (!local.empty()) {
+                    l.unlock();
+                    std::unique_ptr<T> val = std::move(local.front());
+                    local.pop_front();
+                    local_fast_path++;
+                    publish_local();
+                    return val;
+                }
+                if (revoke_requested.load(std::memory_order_relaxed)) revoke_locked();
+            } else if (biased.load(std::memory_order_relaxed)) {
+                revoke_requested.store(true, std::memory_order_release);
+            }
+
+            cv.wait_for(l, wait_interval * 1ms);
+        }
+    }
+
+    /*!
+     * \brief flush, called by the owner, honours a pending revocation request now rather than at its next
+     *        enqueue or dequeue.  Call it before the owner goes idle.
+     */
+    void flush() {
+        if (is_owner()) honour_revocation();
+    }
+
+    /*!
+     * \brief rebias, called by the owner, re-enables its private fast path after a revocation.
+     */
+    void rebias() {
+        if (!is_owner()) return;
+
+        std::unique_lock<std::mutex> l(m);
+        revoke_requested.store(false, std::memory_order_relaxed);
+        biased.store(true, std::memory_order_relaxed);
+    }
+
+    /*!
+     * \brief size returns the number of queued work items (0 if shutting down).  The owner's share is as of its
+     *        last operation.
+     */
+    size_t size() const {
+        std::unique_lock<std::mutex> l(m);
+        if (shutting_down) return 0;
+        return shared.size() + published_size.load();
+    }
+
+    /*!
+     * \brief approx_size returns the number of queued work items (0 if shutting down) by relaxed loads, taking
+     *        no lock.  The shared side lags by the operations in progress (see depth_gauge); the owner's share is
+     *        as of its last operation, as for size().
+     */
+    size_t approx_size() const {
+        if (is_halting()) return 0;
+        return shared_size.load() + published_size.load();
+    }
+
+    /*!
+     * \brief empty returns whether approx_size() is 0.
+     */
+    bool empty() const { return approx_size() == 0; }
+
+    /*!
+     * \brief is_halting returns the halt flag by a relaxed load.
+     */
+    bool is_halting() const { return shutting_down.load(std::memory_order_relaxed); }
+
+    /*!
+     * \brief dropped returns the number of work items dropped because the queue was saturated, over its lifetime.
+     */
+    uint64_t dropped() const {
+        std::unique_lock<std::mutex> l(m);
+        return n_dropped + published_dropped.load(std::memory_order_relaxed);
+    }
+
+    stats snapshot() const {
+        std::unique_lock<std::mutex> l(m);
+        return stats{ published_fast_path.load(std::memory_order_relaxed), n_slow_path, n_revocations,
+                      biased.load(std::memory_order_relaxed) };
+    }
+
+private:
+
+    bool is_owner() const { return std::this_thread::get_id() == owner; }
+
+    // owner only.  Relaxed stores compile to plain moves: no read-modify-write on the fast path.
+    void publish_local() {
+        published_size.publish(local.size());
+        published_fast_path.store(local_fast_path, std::memory_order_relaxed);
+    }
+
+    // owner only.
+    void honour_revocation() {
+        if (!revoke_requested.load(std::memory_order_acquire)) return;
+
+        {   // locked context
+            std::unique_lock<std::mutex> l(m);
+            revoke_locked();
+        }   // end locked context
+
+        cv.notify_all();
+    }
+
+    // owner only, called with m held: publish the private buffer and drop the bias.
+    void revoke_locked() {
+        for (auto & work_item: local) {
+            if (shared.size() >= max) {
+                n_dropped++;
+                if (shared.empty()) continue;   // max 0: the item itself is dropped, as local.clear() goes
+                shared.pop_front();
+            }
+            shared.push_back(std::move(work_item));
+        }
+        local.clear();
+        shared_size.publish(shared.size());
+        publish_local();
+
+        if (biased.load(std::memory_order_relaxed)) n_revocations++;
+        biased.store(false, std::memory_order_relaxed);
+        revoke_requested.store(false, std::memory_order_relaxed);
+    }
+
+    // called with m held.
+    void push_shared(std::unique_ptr<T> work_item) {
+        if (shared.size() >= max) {
+            n_dropped++;
+            if (shared.empty()) return;
+            shared.pop_front();
+        }
+        shared.push_back(std::move(work_item));
+        shared_size.publish(shared.size());
+        n_slow_path++;
+    }
+
+    std::atomic<bool> & shutting_down;
+
+    const int wait_interval; // units 1msec
+    const size_t max;
+
+    const std::thread::id owner;
+
+    // owner-private state
+    std::deque<std::unique_ptr<T> > local;
+    uint64_t local_fast_path;
+    uint64_t local_dropped;
+
+    // written only by the owner, read by anyone
+    depth_gauge published_size;
+    std::atomic<uint64_t> published_fast_path;
+    std::atomic<uint64_t> published_dropped;
+    std::atomic<bool> biased;
+
+    std::atomic<bool> revoke_requested;
+
+    // shared state, guarded by m
+    mutable std::mutex m;
+    std::condition_variable cv;
+    std::deque<std::unique_ptr<T> > shared;
+    depth_gauge shared_size;    // also read by the owner without m
+    uint64_t n_dropped;
+    uint64_t n_slow_path;
+    uint64_t n_revocations;
+};
+
+#endif // BIASED_QUEUE_H
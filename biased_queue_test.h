@@ -0,0 +1,126 @@
+#include <cxxtest/TestSuite.h>
+#include <iostream>
+#include <thread>
+#include <vector>
+#include "biased_queue.h"
+
+
+class biased_queue_test : public CxxTest::TestSuite
+{
+public:
+
+    void testOwnerFastPath(void) {
+        std::atomic<bool> haltflag(false);
+        biased_queue<int> q(haltflag);
+
+        for (int i = 0; i < 10; i++)
+            q.enqueue(std::make_unique<int>(i));
+        TS_ASSERT_EQUALS(q.size(), 10);
+
+        for (int i = 0; i < 10; i++)
+            TS_ASSERT_EQUALS(*q.dequeue(), i);
+
+        biased_queue<int>::stats s = q.snapshot();
+        TS_ASSERT_EQUALS(s.fast_path, 20);
+        TS_ASSERT_EQUALS(s.slow_path, 0);
+        TS_ASSERT(s.biased);
+        TS_ASSERT_EQUALS(q.size(), 0);
+    }
+
+    void testOtherProducersServedFirst(void) {
+        std::atomic<bool> haltflag(false);
+        biased_queue<int> q(haltflag);
+
+        q.enqueue(std::make_unique<int>(1));
+        std::thread([&]{ q.enqueue(std::make_unique<int>(100)); }).join();
+        q.enqueue(std::make_unique<int>(2));
+
+        TS_ASSERT_EQUALS(q.size(), 3);
+        TS_ASSERT_EQUALS(q.approx_size(), 3);
+        TS_ASSERT_EQUALS(*q.dequeue(), 100);
+        TS_ASSERT_EQUALS(*q.dequeue(), 1);
+        TS_ASSERT_EQUALS(*q.dequeue(), 2);
+        TS_ASSERT(q.snapshot().biased);
+    }
+
+    void testForeignConsumerRevokesBias(void) {
+        std::atomic<bool> haltflag(false);
+        biased_queue<int> q(haltflag, SIZE_MAX, 10);
+
+        q.enqueue(std::make_unique<int>(1));
+        q.enqueue(std::make_unique<int>(2));
+
+        std::unique_ptr<int> taken;
+        std::thread consumer([&]{ taken = q.dequeue(); });
+
+        TS_TRACE("the consumer waits for the owner to honour its revocation request");
+        while (q.snapshot().biased) {
+            std::this_thread::sleep_for(5ms);
+            q.flush();
+        }
+        consumer.join();
+        TS_ASSERT_EQUALS(*taken, 1);
+
+        biased_queue<int>::stats s = q.snapshot();
+        TS_ASSERT_EQUALS(s.revocations, 1);
+        TS_ASSERT(!s.biased);
+
+        TS_TRACE("revoked: the owner goes through the shared queue until it rebiases");
+        q.enqueue(std::make_unique<int>(3));
+        TS_ASSERT_EQUALS(*q.dequeue(), 2);
+        TS_ASSERT_EQUALS(*q.dequeue(), 3);
+        TS_ASSERT_EQUALS(q.snapshot().fast_path, 2);
+
+        q.rebias();
+        q.enqueue(std::make_unique<int>(4));
+        TS_ASSERT_EQUALS(*q.dequeue(), 4);
+        TS_ASSERT_EQUALS(q.snapshot().fast_path, 4);
+    }
+
+    void testBoundedAndHalting(void) {
+        std::atomic<bool> haltflag(false);
+        biased_queue<int> q(haltflag, 3);
+
+        for (int i = 0; i < 5; i++)
+            q.enqueue(std::make_unique<int>(i));
+        TS_ASSERT_EQUALS(q.size(), 3);
+        TS_ASSERT_EQUALS(q.dropped(), 2);
+        TS_ASSERT_EQUALS(*q.dequeue(), 2);
+
+        haltflag = true;
+        TS_ASSERT_EQUALS(q.dequeue().get(), nullptr);
+        TS_ASSERT_EQUALS(q.size(), 0);
+    }
+
+    void testZeroDepthDropsEverything(void) {
+        std::atomic<bool> haltflag(false);
+        biased_queue<int> q(haltflag, 0, 10);
+
+        TS_TRACE("max_depth 0: the owner's pushes are dropped, one by one and in bulk");
+        q.enqueue(std::make_unique<int>(1));
+        std::vector<std::unique_ptr<int> > bulk;
+        bulk.push_back(std::make_unique<int>(2));
+        bulk.push_back(std::make_unique<int>(3));
+        q.enqueue(bulk);
+        TS_ASSERT_EQUALS(q.size(), 0);
+        TS_ASSERT_EQUALS(q.dropped(), 3);
+
+        TS_TRACE("a foreign consumer revokes the bias; pushes to the shared queue are dropped too");
+        std::unique_ptr<int> taken(new int(0));
+        std::thread consumer([&]{ taken = q.dequeue(); });
+        while (q.snapshot().biased) {
+            std::this_thread::sleep_for(5ms);
+            q.flush();
+        }
+        TS_ASSERT_EQUALS(q.snapshot().revocations, 1);
+        q.enqueue(std::make_unique<int>(4));
+        std::thread([&]{ q.enqueue(std::make_unique<int>(5)); }).join();
+        TS_ASSERT_EQUALS(q.size(), 0);
+        TS_ASSERT_EQUALS(q.dropped(), 5);    // a lifetime count
+
+        haltflag = true;
+        consumer.join();
+        TS_ASSERT(!taken);
+    }
+
+};
@@ -0,0 +1,270 @@
+#ifndef CAPABILITY_QUEUE_H
+#define CAPABILITY_QUEUE_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include "depth_gauge.h"
+
+using namespace std::chrono_literals;
+
+/*!
+ * capability_mask - a set of capabilities, one bit each (e.g. gpu, large memory, a licensed library).
+ * An item's mask is what it requires; a consumer's mask is what it has.
+ */
+typedef uint64_t capability_mask;
+
+/*!
+ * capability_queue - a work queue routing each item only to consumers having every capability it requires.
+ *
+ * Items wait in one FIFO sub-queue per capability class (the exact mask they require).  A dequeue looks only at
+ * the heads of the non-empty classes its consumer can serve and takes the oldest of them, so consumers never
+ * see, let alone re-enqueue, items they cannot handle, and each consumer gets FIFO order across its classes.
+ * The cost of a dequeue grows with the number of non-empty classes, not with the number of queued items.
+ *
+ * Parked consumers wait on their own condition variables; an enqueue wakes the longest-waiting consumer able to
+ * serve the new item, not an arbitrary one.  max_depth bounds all classes together, dropping the oldest item.
+ * Halting follows work_queue.
+ */
+template <class T>
+class capability_queue
+{
+public:
+
+    capability_queue(std::atomic<bool> & halt_flag, size_t max_depth = SIZE_MAX, int wait_interval_ms = 100)
+        : shutting_down(halt_flag)
+        , wait_interval(wait_interval_ms)
+        , n_dropped(0)
+        , n_handled(0)
+        , max(max_depth)
+        , next_seq(0)
+        , n_queued(0)
+        , depth()
+        , m()
+        , classes()
+        , waiters()
+    { }
+
+    ~capability_queue() {  }
+
+    /*!
+     * \brief enqueue adds a work item requiring the given capabilities (0: any consumer will do).
+     *        Enqueues while shutting down, and empty std::unique_ptrs, are ignored.
+     */
+    void enqueue(std::unique_ptr<T> work_item, capability_mask required = 0)
+    {
+        std::unique_lock<std::mutex> l(m);
+
+        if (shutting_down || !work_item) return;
+
+        push_bounded(std::move(work_item), required);
+        wake_one_for(required);
+    }
+
+    /*!
+     * \brief enqueue adds all the non-empty elements of bulk, each requiring the given capabilities.
+     */
+    void enqueue(std::vector<std::unique_ptr<T> > & bulk, capability_mask required = 0)
+    {
+        std::unique_lock<std::mutex> l(m);
+
+        if (shutting_down) return;
+
+        size_t pushed = 0;
+        for (auto & work_item: bulk) {
+            if (!work_item) continue;
+            push_bounded(std::move(work_item), required);
+            pushed++;
+        }
+        for (size_t i = 0; i < pushed; i++)
+            if (!wake_one_for(required)) break;
+    }
+
+    /*!
+     * \brief dequeue removes and returns the oldest work item the consumer's capabilities cover,
+     *        blocking until there is one or the queue is halting.
+     * \param capabilities what the calling consumer can do.
+     * \return a work item, or the empty std::unique_ptr when shutting down.
+     */
+    std::unique_ptr<T> dequeue(capability_mask capabilities)
+    {
+        std::unique_lock<std::mutex> l(m);
+
+        waiter self{ capabilities, false, {} };
+        typename std::list<waiter *>::iterator parked = waiters.end();
+
+        for (;;) {
+            if (shutting_down) break;
+
+            if (std::unique_ptr<T> val = pop_oldest(capabilities)) {
+                if (parked != waiters.end()) waiters.erase(parked);
+                // woken for one item but took an older one: pass the wakeup on so the newer item isn't stranded.
+                if (self.signalled) pass_on_wakeup();
+                n_handled++;
+                return val;
+            }
+
+            if (parked == waiters.end()) parked = waiters.insert(waiters.end(), &self);
+            self.signalled = false;
+            self.cv.wait_for(l, wait_interval * 1ms, [&]{ return self.signalled || shutting_down; });
+        }
+
+        if (parked != waiters.end()) waiters.erase(parked);
+        return std::unique_ptr<T>{};
+    }
+
+    /*!
+     * \brief size returns the number of queued work items (0 if shutting down).
+     */
+    size_t size() const {
+        std::unique_lock<std::mutex> l(m);
+        if (shutting_down) return 0;
+        return n_queued;
+    }
+
+    /*!
+     * \brief approx_size returns the number of queued work items, over all classes (0 if shutting down), by
+     *        relaxed loads without the lock.  It may lag size() by the operations in progress; see depth_gauge.
+     */
+    size_t approx_size() const {
+        if (is_halting()) return 0;
+        return depth.load();
+    }
+
+    /*!
+     * \brief empty returns whether approx_size() is 0.  A consumer may still find nothing it can handle
+     *        when it is not.
+     */
+    bool empty() const { return approx_size() == 0; }
+
+    /*!
+     * \brief is_halting returns the halt flag by a relaxed load.
+     */
+    bool is_halting() const { return shutting_down.load(std::memory_order_relaxed); }
+
+    /*!
+     * \brief size returns the number of queued work items requiring exactly the given capabilities.
+     */
+    size_t size(capability_mask required) const {
+        std::unique_lock<std::mutex> l(m);
+        auto found = classes.find(required);
+        return found == classes.end() ? 0 : found->second.size();
+    }
+
+    /*!
+     * \brief dropped returns the number of work items dropped so far because the queue was saturated,
+     *        and resets the counter to zero.
+     */
+    int dropped () {
+        std::unique_lock<std::mutex> l(m);
+
+        int so_far = n_dropped;
+        n_dropped = 0;
+        return so_far;
+    }
+
+    /*!
+     * \brief handled returns the number of work items dequeued so far, and resets the counter to zero.
+     */
+    int handled () {
+        std::unique_lock<std::mutex> l(m);
+
+        int so_far = n_handled;
+        n_handled = 0;
+        return so_far;
+    }
+
+private:
+
+    struct entry {
+        uint64_t seq;
+        std::unique_ptr<T> work_item;
+    };
+
+    struct waiter {
+        capability_mask capabilities;
+        bool signalled;
+        std::condition_variable cv;
+    };
+
+    static bool covers(capability_mask capabilities, capability_mask required) {
+        return (required & ~capabilities) == 0;
+    }
+
+    // called with m held.
+    void push_bounded(std::unique_ptr<T> work_item, capability_mask required) {
+        if (n_queued >= max) {
+            n_dropped++;
+            if (n_queued == 0) return;
+            pop_oldest(~capability_mask(0));
+        }
+        classes[required].push_back(entry{ next_seq++, std::move(work_item) });
+        n_queued++;
+        depth.publish(n_queued);
+    }
+
+    // called with m held.  Takes the oldest item among the classes capabilities covers.
+    std::unique_ptr<T> pop_oldest(capability_mask capabilities) {
+        auto oldest = classes.end();
+        for (auto it = classes.begin(); it != classes.end(); ++it) {
+            if (!covers(capabilities, it->first)) continue;
+            if (oldest == classes.end() || it->second.front().seq < oldest->second.front().seq)
+                oldest = it;
+        }
+        if (oldest == classes.end()) return std::unique_ptr<T>{};
+
+        std::unique_ptr<T> val = std::move(oldest->second.front().work_item);
+        oldest->second.pop_front();
+        if (oldest->second.empty()) classes.erase(oldest);
+        n_queued--;
+        depth.publish(n_queued);
+        return val;
+    }
+
+    // called with m held.  Wakes the longest-parked consumer that can serve required and isn't already woken.
+    bool wake_one_for(capability_mask required) {
+        for (waiter * w: waiters) {
+            if (w->signalled || !covers(w->capabilities, required)) continue;
+            w->signalled = true;
+            w->cv.notify_one();
+            return true;
+        }
+        return false;
+    }
+
+    // called with m held.
+    void pass_on_wakeup() {
+        for (auto & c: classes)
+            if (wake_one_for(c.first)) return;
+    }
+
+    std::atomic<bool> & shutting_down;
+
+    int wait_interval; // units 1msec
+
+    int n_dropped;
+    int n_handled;
+
+    size_t max;
+
+    uint64_t next_seq;
+    size_t n_queued;
+    depth_gauge depth;      // n_queued, for lock-free readers
+
+    mutable std::mutex m;
+
+    // only non-empty classes are kept, so a dequeue visits only classes holding work.
+    std::unordered_map<capability_mask, std::deque<entry> > classes;
+    std::list<waiter *> waiters;
+};
+
+#endif // CAPABILITY_QUEUE_H
@@ -0,0 +1,89 @@
+#include <cxxtest/TestSuite.h>
+#include <iostream>
+#include <thread>
+#include "capability_queue.h"
+
+
+class capability_queue_test : public CxxTest::TestSuite
+{
+public:
+
+    enum { gpu = 1, big_memory = 2 };
+
+    void testConsumersOnlySeeWhatTheyCanHandle(void) {
+        std::atomic<bool> haltflag(false);
+        capability_queue<int> q(haltflag, SIZE_MAX, 10);
+
+        q.enqueue(std::make_unique<int>(1), gpu);
+        q.enqueue(std::make_unique<int>(2));
+        q.enqueue(std::make_unique<int>(3), gpu | big_memory);
+        q.enqueue(std::make_unique<int>(4), big_memory);
+        q.enqueue(std::make_unique<int>(5));
+        TS_ASSERT_EQUALS(q.size(), 5);
+        TS_ASSERT_EQUALS(q.size(gpu), 1);
+        TS_ASSERT_EQUALS(q.approx_size(), 5);
+
+        TS_TRACE("a plain consumer skips the gpu and big memory items, oldest first among the rest");
+        TS_ASSERT_EQUALS(*q.dequeue(0), 2);
+        TS_ASSERT_EQUALS(*q.dequeue(0), 5);
+
+        TS_TRACE("a gpu consumer takes in order across the classes it covers");
+        TS_ASSERT_EQUALS(*q.dequeue(gpu), 1);
+        TS_ASSERT_EQUALS(*q.dequeue(gpu | big_memory), 3);
+        TS_ASSERT_EQUALS(*q.dequeue(gpu | big_memory), 4);
+        TS_ASSERT_EQUALS(q.size(), 0);
+        TS_ASSERT(q.empty());
+        TS_ASSERT_EQUALS(q.handled(), 5);
+    }
+
+    void testEnqueueWakesACapableConsumer(void) {
+        std::atomic<bool> haltflag(false);
+        capability_queue<int> q(haltflag, SIZE_MAX, 5000);
+
+        std::unique_ptr<int> plain_got, gpu_got;
+        std::thread plain([&]{ plain_got = q.dequeue(0); });
+        std::this_thread::sleep_for(20ms);
+        std::thread with_gpu([&]{ gpu_got = q.dequeue(gpu); });
+        std::this_thread::sleep_for(20ms);
+
+        TS_TRACE("the longest-waiting consumer can't take a gpu item, so the gpu consumer is the one woken");
+        const auto start = std::chrono::steady_clock::now();
+        q.enqueue(std::make_unique<int>(9), gpu);
+        with_gpu.join();
+        TS_ASSERT_LESS_THAN(std::chrono::steady_clock::now() - start, 1000ms);
+        TS_ASSERT_EQUALS(*gpu_got, 9);
+
+        q.enqueue(std::make_unique<int>(10));
+        plain.join();
+        TS_ASSERT_EQUALS(*plain_got, 10);
+    }
+
+    void testSaturationDropsOldest(void) {
+        std::atomic<bool> haltflag(false);
+        capability_queue<int> q(haltflag, 2, 10);
+
+        q.enqueue(std::make_unique<int>(1), gpu);
+        q.enqueue(std::make_unique<int>(2));
+        q.enqueue(std::make_unique<int>(3), big_memory);
+        TS_ASSERT_EQUALS(q.size(), 2);
+        TS_ASSERT_EQUALS(q.size(gpu), 0);
+        TS_ASSERT_EQUALS(q.dropped(), 1);
+        TS_ASSERT_EQUALS(*q.dequeue(big_memory), 2);
+    }
+
+    void testHaltReleasesWaiters(void) {
+        std::atomic<bool> haltflag(false);
+        capability_queue<int> q(haltflag, SIZE_MAX, 10);
+
+        q.enqueue(std::make_unique<int>(1), gpu);
+        std::unique_ptr<int> got = std::make_unique<int>(0);
+        std::thread consumer([&]{ got = q.dequeue(0); });
+
+        std::this_thread::sleep_for(20ms);
+        haltflag = true;
+        consumer.join();
+        TS_ASSERT_EQUALS(got.get(), nullptr);
+        TS_ASSERT_EQUALS(q.size(), 0);
+    }
+
+};
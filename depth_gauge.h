@@ -0,0 +1,42 @@
+#ifndef DEPTH_GAUGE_H
+#define DEPTH_GAUGE_H
+
+#include <atomic>
+#include <cstddef>
+
+/*!
+ * depth_gauge - a queue depth published for readers that must not take the queue's lock.
+ *
+ * The owning queue stores its depth with a relaxed store, while still holding its lock, after every change;
+ * readers load it with a relaxed load.  The counter is padded onto a cache line of its own, whatever the
+ * alignment of the enclosing object, so polling readers don't share a line with the queue's mutex or data.
+ *
+ * Staleness: a read returns a depth the queue really had, at the end of some completed enqueue or dequeue,
+ * and a reader never sees it go back to an older value.  It may miss the changes made since -- at most one
+ * item per enqueue or dequeue in progress, or one bulk enqueue's worth -- and, as relaxed operations carry no
+ * ordering, it implies nothing about the items themselves: a dequeue may still block after a non-zero read.
+ */
+class depth_gauge
+{
+public:
+
+    depth_gauge() : depth(0) { }
+
+    depth_gauge(const depth_gauge &) = delete;
+    depth_gauge & operator=(const depth_gauge &) = delete;
+
+    // called by one writer at a time -- the queue holds its lock, or owns the count -- so stores never race.
+    void publish(size_t value) { depth.store(value, std::memory_order_relaxed); }
+
+    size_t load() const { return depth.load(std::memory_order_relaxed); }
+
+private:
+
+    enum { cache_line = 64 };
+
+    char pad_before[cache_line];
+    std::atomic<size_t> depth;
+    char pad_after[cache_line - sizeof(std::atomic<size_t>)];
+};
+
+#endif // DEPTH_GAUGE_H
@@ -0,0 +1,246 @@
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <system_error>
+#include <type_traits>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/*!
+ * journal_codec - trait turning a work item into journal bytes and back.
+ * The primary template copies trivially copyable types byte for byte; specialize it for other types.
+ */
+template <class T>
+struct journal_codec
+{
+    static_assert(std::is_trivially_copyable<T>::value,
+                  "specialize journal_codec<T> for work items that are not trivially copyable");
+
+    static std::string encode(const T & work_item) {
+        return std::string(reinterpret_cast<const char *>(&work_item), sizeof(T));
+    }
+
+    static std::unique_ptr<T> decode(const std::string & bytes) {
+        if (bytes.size() != sizeof(T)) return std::unique_ptr<T>{};
+        std::unique_ptr<T> work_item(new T);
+        std::memcpy(static_cast<void *>(work_item.get()), bytes.data(), sizeof(T));
+        return work_item;
+    }
+};
+
+/*!
+ * journal_record - the on-disk (and on-the-wire) framing of journal entries.
+ *
+ *     u32 payload length | u8 type | u64 seq | u32 crc32 of type, seq and payload | payload
+ *
+ * An item record carries an encoded work item with its sequence number; a consumed record carries, as its seq,
+ * the sequence number up to which items have been removed from the queue.  Integers are in host byte order,
+ * so a journal is only portable between hosts of the same endianness.
+ */
+struct journal_record
+{
+    enum kind : uint8_t { item = 1, consumed = 2 };
+
+    static const size_t header_size = 4 + 1 + 8 + 4;
+
+    static uint32_t crc32(const char * data, size_t length, uint32_t crc = 0) {
+        static const std::vector<uint32_t> table = []{
+            std::vector<uint32_t> t(256);
+            for (uint32_t i = 0; i < 256; i++) {
+                uint32_t c = i;
+                for (int k = 0; k < 8; k++) c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+                t[i] = c;
+            }
+            return t;
+        }();
+
+        crc = ~crc;
+        for (size_t i = 0; i < length; i++)
+            crc = table[(crc ^ static_cast<uint8_t>(data[i])) & 0xFF] ^ (crc >> 8);
+        return ~crc;
+    }
+
+    // appends the framed record to out.
+    static void frame(std::string & out, kind type, uint64_t seq, const std::string & payload) {
+        char header[header_size];
+        const uint32_t length = static_cast<uint32_t>(payload.size());
+        const uint8_t t = type;
+
+        std::memcpy(header, &length, 4);
+        std::memcpy(header + 4, &t, 1);
+        std::memcpy(header + 5, &seq, 8);
+        uint32_t crc = crc32(header + 4, 9);
+        crc = crc32(payload.data(), payload.size(), crc);
+        std::memcpy(header + 13, &crc, 4);
+
+        out.append(header, header_size);
+        out.append(payload);
+    }
+
+    /*!
+     * \brief parse reads the record at offset in data.
+     * \return the offset past the record, or 0 when data holds no complete, intact record there
+     *         (a torn or corrupted tail).
+     */
+    static size_t parse(const std::string & data, size_t offset, kind & type, uint64_t & seq, std::string & payload) {
+        if (data.size() - offset < header_size) return 0;
+
+        uint32_t length, crc;
+        uint8_t t;
+        std::memcpy(&length, data.data() + offset, 4);
+        std::memcpy(&t, data.data() + offset + 4, 1);
+        std::memcpy(&seq, data.data() + offset + 5, 8);
+        std::memcpy(&crc, data.data() + offset + 13, 4);
+
+        if (data.size() - offset - header_size < length) return 0;
+
+        uint32_t actual = crc32(data.data() + offset + 4, 9);
+        actual = crc32(data.data() + offset + header_size, length, actual);
+        if (actual != crc || (t != item && t != consumed)) return 0;
+
+        type = static_cast<kind>(t);
+        payload.assign(data, offset + header_size, length);
+        return offset + header_size + length;
+    }
+};
+
+/*!
+ * journal_file - an append-only file of journal records.
+ *
+ * Opening a journal recovers it: records are read up to the first torn or corrupt one, the file is truncated
+ * there, and the items not yet covered by a consumed record are handed back in sequence order.
+ * Errors opening, reading or writing the file are thrown as std::system_error.
+ */
+class journal_file
+{
+public:
+
+    struct recovered_item {
+        uint64_t seq;
+        std::string payload;
+    };
+
+    /*!
+     * \param path the journal file, created if missing.
+     * \param discard when true, an existing journal is emptied instead of recovered (a standby being reseeded).
+     */
+    explicit journal_file(const std::string & path, bool discard = false)
+        : fd(::open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC | (discard ? O_TRUNC : 0), 0644))
+        , length(0)
+        , last_seq(0)
+        , consumed_seq(0)
+        , pending()
+    {
+        if (fd < 0) throw std::system_error(errno, std::generic_category(), "open " + path);
+        recover();
+    }
+
+    ~journal_file() { if (fd >= 0) ::close(fd); }
+
+    journal_file(const journal_file &) = delete;
+    journal_file & operator=(const journal_file &) = delete;
+
+    // items still to be consumed at open time, in sequence order.
+    const std::vector<recovered_item> & recovered() const { return pending; }
+    void release_recovered() { std::vector<recovered_item>().swap(pending); }
+
+    uint64_t getLastSeq() const { return last_seq; }
+    uint64_t getConsumedSeq() const { return consumed_seq; }
+
+    // the byte length of the journal, i.e. the offset the next append lands at.
+    uint64_t size() const { return length; }
+
+    /*!
+     * \brief append writes already framed records at the end of the journal.
+     */
+    void append(const std::string & records) {
+        write_all(fd, records.data(), records.size());
+        length += records.size();
+    }
+
+    void sync() {
+        if (::fdatasync(fd) != 0) throw std::system_error(errno, std::generic_category(), "fdatasync");
+    }
+
+    // reads the whole journal as written so far, e.g. to ship it to a newly attached standby.
+    std::string contents() const {
+        std::string data(length, '\0');
+        size_t done = 0;
+        while (done < length) {
+            const ssize_t n = ::pread(fd, &data[done], length - done, done);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) throw std::system_error(n < 0 ? errno : EIO, std::generic_category(), "pread journal");
+            done += n;
+        }
+        return data;
+    }
+
+    static void write_all(int to, const char * data, size_t n) {
+        while (n > 0) {
+            const ssize_t written = ::write(to, data, n);
+            if (written < 0 && errno == EINTR) continue;
+            if (written < 0) throw std::system_error(errno, std::generic_category(), "write journal");
+            data += written;
+            n -= written;
+        }
+    }
+
+private:
+
+    void recover() {
+        struct stat st;
+        if (::fstat(fd, &st) != 0) throw std::system_error(errno, std::generic_category(), "fstat journal");
+
+        std::string data(static_cast<size_t>(st.st_size), '\0');
+        size_t done = 0;
+        while (done < data.size()) {
+            const ssize_t n = ::pread(fd, &data[done], data.size() - done, done);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) break;
+            done += n;
+        }
+        data.resize(done);
+
+        std::vector<recovered_item> items;
+        size_t offset = 0;
+        journal_record::kind type;
+        uint64_t seq;
+        std::string payload;
+        while (size_t next = journal_record::parse(data, offset, type, seq, payload)) {
+            if (type == journal_record::item) {
+                items.push_back(recovered_item{ seq, std::move(payload) });
+                last_seq = std::max(last_seq, seq);
+            } else {
+                consumed_seq = std::max(consumed_seq, seq);
+            }
+            offset = next;
+        }
+
+        // drop a torn tail left by a crash mid-append.
+        if (offset != data.size() && ::ftruncate(fd, offset) != 0)
+            throw std::system_error(errno, std::generic_category(), "truncate journal");
+        if (::lseek(fd, offset, SEEK_SET) < 0)
+            throw std::system_error(errno, std::generic_category(), "seek journal");
+        length = offset;
+
+        for (auto & item: items)
+            if (item.seq > consumed_seq) pending.push_back(std::move(item));
+    }
+
+    int fd;
+    uint64_t length;
+    uint64_t last_seq;
+    uint64_t consumed_seq;
+    std::vector<recovered_item> pending;
+};
+
+#endif // JOURNAL_H
@@ -0,0 +1,580 @@
+#ifndef JOURNALED_QUEUE_H
+#define JOURNALED_QUEUE_H
+
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <system_error>
+#include <thread>
+
+#include <netdb.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "work_queue.h"
+#include "journal.h"
+
+/*!
+ * commit_mode - when a journaled_queue considers an enqueued item committed.
+ *
+ *  async:     as soon as it is queued; the journal is written and shipped to the standby in the background.
+ *  semi_sync: once the standby has received it (it is then held by two processes, though neither need
+ *             have it on disk yet).
+ *  sync:      once it is on disk both locally and on the standby.
+ */
+enum class commit_mode : uint32_t { async = 0, semi_sync = 1, sync = 2 };
+
+/*!
+ * journal_socket - helpers opening the stream sockets a primary and its standby talk over.
+ * Each returns a connected (or listening) descriptor and throws std::system_error on failure.
+ */
+struct journal_socket
+{
+    static int unix_listen(const std::string & path) {
+        sockaddr_un addr = unix_address(path);
+        ::unlink(path.c_str());
+        int fd = checked(::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0), "socket");
+        if (::bind(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0 || ::listen(fd, 1) != 0) {
+            const int error = errno;
+            ::close(fd);
+            throw std::system_error(error, std::generic_category(), "listen on " + path);
+        }
+        return fd;
+    }
+
+    static int unix_connect(const std::string & path) {
+        sockaddr_un addr = unix_address(path);
+        int fd = checked(::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0), "socket");
+        if (::connect(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0) {
+            const int error = errno;
+            ::close(fd);
+            throw std::system_error(error, std::generic_category(), "connect to " + path);
+        }
+        return fd;
+    }
+
+    static int tcp_listen(uint16_t port) {
+        int fd = checked(::socket(AF_INET6, SOCK_STREAM | SOCK_CLOEXEC, 0), "socket");
+        const int on = 1;
+        ::setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+
+        sockaddr_in6 addr;
+        std::memset(&addr, 0, sizeof(addr));
+        addr.sin6_family = AF_INET6;
+        addr.sin6_addr = in6addr_any;
+        addr.sin6_port = htons(port);
+        if (::bind(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0 || ::listen(fd, 1) != 0) {
+            const int error = errno;
+            ::close(fd);
+            throw std::system_error(error, std::generic_category(), "listen on port " + std::to_string(port));
+        }
+        return fd;
+    }
+
+    static int tcp_connect(const std::string & host, uint16_t port) {
+        addrinfo hints;
+        std::memset(&hints, 0, sizeof(hints));
+        hints.ai_socktype = SOCK_STREAM;
+
+        addrinfo * found = nullptr;
+        if (::getaddrinfo(host.c_str(), std::to_string(port).c_str(), &hints, &found) != 0 || !found)
+            throw std::system_error(EHOSTUNREACH, std::generic_category(), "resolve " + host);
+
+        int fd = -1;
+        int error = ECONNREFUSED;
+        for (addrinfo * a = found; a && fd < 0; a = a->ai_next) {
+            fd = ::socket(a->ai_family, a->ai_socktype | SOCK_CLOEXEC, a->ai_protocol);
+            if (fd >= 0 && ::connect(fd, a->ai_addr, a->ai_addrlen) != 0) {
+                error = errno;
+                ::close(fd);
+                fd = -1;
+            }
+        }
+        ::freeaddrinfo(found);
+        if (fd < 0) throw std::system_error(error, std::generic_category(), "connect to " + host);
+        return fd;
+    }
+
+    static int accept_one(int listen_fd) {
+        int fd;
+        do { fd = ::accept4(listen_fd, nullptr, nullptr, SOCK_CLOEXEC); } while (fd < 0 && errno == EINTR);
+        return checked(fd, "accept");
+    }
+
+    // the first bytes a primary sends on a new replication stream.
+    struct hello {
+        uint32_t magic;
+        uint32_t mode;
+    };
+    static const uint32_t hello_magic = 0x524a5157;   // "WQJR"
+
+    // what a standby reports back: journal bytes received, and of those, bytes on disk.
+    struct ack {
+        uint64_t received;
+        uint64_t durable;
+    };
+
+    static bool send_all(int fd, const char * data, size_t n) {
+        while (n > 0) {
+            const ssize_t sent = ::send(fd, data, n, MSG_NOSIGNAL);
+            if (sent < 0 && errno == EINTR) continue;
+            if (sent <= 0) return false;
+            data += sent;
+            n -= sent;
+        }
+        return true;
+    }
+
+    static bool recv_all(int fd, char * data, size_t n) {
+        while (n > 0) {
+            const ssize_t got = ::recv(fd, data, n, 0);
+            if (got < 0 && errno == EINTR) continue;
+            if (got <= 0) return false;
+            data += got;
+            n -= got;
+        }
+        return true;
+    }
+
+private:
+
+    static int checked(int fd, const char * what) {
+        if (fd < 0) throw std::system_error(errno, std::generic_category(), what);
+        return fd;
+    }
+
+    static sockaddr_un unix_address(const std::string & path) {
+        sockaddr_un addr;
+        std::memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        if (path.size() >= sizeof(addr.sun_path))
+            throw std::system_error(ENAMETOOLONG, std::generic_category(), path);
+        std::memcpy(addr.sun_path, path.c_str(), path.size());
+        return addr;
+    }
+};
+
+/*!
+ * journaled_queue - a FIFO work_queue whose items are recorded in a journal file, optionally streamed to a
+ * standby process (see journal_standby) that can take over consumption if this one dies.
+ *
+ * Every enqueue appends an item record and every dequeue a consumed record; a background writer thread
+ * writes the records to the journal and to the standby in batches, so concurrent producers share one write,
+ * one fdatasync and one send.  Opening an existing journal re-queues the items no consumed record covers.
+ * Items are journaled as consumed when dequeued.  In sync and semi_sync modes dequeue waits for the consumed
+ * record to commit, as enqueue does for the item, so an item in service when the process dies is not
+ * redelivered once its consumed record has committed.  In async mode the record may not have reached the journal
+ * or the standby when the process dies, and the item is then redelivered on reopen or takeover.
+ * The queue is unbounded: a journaled item is never dropped.
+ *
+ * Journal I/O errors are thrown as std::system_error from the constructor; errors while writing in the
+ * background stop commits from completing (enqueue returns false).
+ */
+template <class T, class Codec = journal_codec<T> >
+class journaled_queue
+{
+public:
+
+    struct stats {
+        uint64_t appended;          // journal bytes produced
+        uint64_t written;           // ... of those, written to the journal file
+        uint64_t durable;           // ... and fdatasync'ed (sync mode only)
+        uint64_t standby_received;  // journal bytes acknowledged by the standby
+        uint64_t standby_durable;   // ... and on its disk
+        bool standby_attached;
+        bool failed;                // a journal write failed; nothing commits any more
+    };
+
+    /*!
+     * \brief journaled_queue opens (or creates) the journal at journal_path and re-queues its unconsumed items.
+     * \param halt_flag as for work_queue.
+     * \param journal_path the journal file.
+     * \param mode when enqueue considers an item committed; see commit_mode.
+     * \param wait_interval_ms as for work_queue.
+     * \param commit_timeout_ms how long enqueue and dequeue wait for a commit before giving up (enqueue returns false).
+     */
+    journaled_queue(std::atomic<bool> & halt_flag, const std::string & journal_path,
+                    commit_mode mode = commit_mode::sync, int wait_interval_ms = 100, int commit_timeout_ms = 1000)
+        : shutting_down(halt_flag)
+        , commit(mode)
+        , commit_timeout(commit_timeout_ms)
+        , q(halt_flag, SIZE_MAX, wait_interval_ms)
+        , journal(journal_path)
+        , m()
+        , cv()
+        , unwritten()
+        , last_seq(journal.getLastSeq())
+        , consumed_seq(journal.getConsumedSeq())
+        , appended(journal.size())
+        , written(journal.size())
+        , durable(journal.size())
+        , standby_fd(-1)
+        , attaching_fd(-1)
+        , replica_fd(-1)
+        , standby_received(0)
+        , standby_durable(0)
+        , failed(false)
+        , stopping(false)
+        , writer()
+        , ack_reader()
+    {
+        for (const auto & item: journal.recovered()) {
+            std::unique_ptr<T> work_item = Codec::decode(item.payload);
+            if (work_item) q.enqueue(std::move(work_item));
+        }
+        journal.release_recovered();
+
+        writer = std::thread([this]{ write_loop(); });
+    }
+
+    ~journaled_queue() {
+        int unclaimed;
+        {   // locked context
+            std::unique_lock<std::mutex> l(m);
+            stopping = true;
+        }   // end locked context
+        cv.notify_all();
+        writer.join();
+
+        {   // locked context
+            std::unique_lock<std::mutex> l(m);
+            unclaimed = attaching_fd;
+        }   // end locked context
+        if (unclaimed >= 0) ::close(unclaimed);
+        retire_standby();
+    }
+
+    /*!
+     * \brief replicate_to attaches a standby over a connected stream socket, which the queue then owns.
+     *        The whole journal is shipped first, then every record as it is written.  A standby that was lost
+     *        can be replaced by attaching a new one.
+     * \return false if a standby is already attached (socket_fd is left untouched).
+     */
+    bool replicate_to(int socket_fd) {
+        {   // locked context
+            std::unique_lock<std::mutex> l(m);
+            if (standby_fd >= 0 || attaching_fd >= 0 || stopping) return false;
+            attaching_fd = socket_fd;
+        }   // end locked context
+        cv.notify_all();
+        return true;
+    }
+
+    /*!
+     * \brief enqueue journals and queues the work item.  Empty std::unique_ptrs and enqueues while halting
+     *        are ignored.
+     * \return true once the item is committed as the commit_mode requires; false if it could not be within
+     *         the commit timeout -- e.g. semi_sync or sync with no standby attached.  The item is queued and
+     *         journaled locally either way.
+     */
+    bool enqueue(std::unique_ptr<T> work_item) {
+        if (shutting_down || !work_item) return false;
+
+        uint64_t end;
+        {   // locked context: the journal order is the queue order
+            std::unique_lock<std::mutex> l(m);
+            const size_t before = unwritten.size();
+            journal_record::frame(unwritten, journal_record::item, ++last_seq, Codec::encode(*work_item));
+            appended += unwritten.size() - before;
+            end = appended;
+            q.enqueue(std::move(work_item));
+        }   // end locked context
+        cv.notify_all();
+
+        return wait_committed(end);
+    }
+
+    /*!
+     * \brief dequeue removes the oldest work item and journals it as consumed, waiting for that record to
+     *        commit in sync and semi_sync modes (up to the commit timeout); otherwise as work_queue::dequeue.
+     */
+    std::unique_ptr<T> dequeue() {
+        std::unique_ptr<T> val = q.dequeue();
+        if (!val) return val;
+        q.finished();
+
+        uint64_t end;
+        {   // locked context
+            std::unique_lock<std::mutex> l(m);
+            const size_t before = unwritten.size();
+            journal_record::frame(unwritten, journal_record::consumed, ++consumed_seq, std::string());
+            appended += unwritten.size() - before;
+            end = appended;
+        }   // end locked context
+        cv.notify_all();
+
+        wait_committed(end);    // a record that fails to commit leaves the item to be redelivered
+        return val;
+    }
+
+    size_t size() const { return q.size(); }
+
+    /*!
+     * \brief approx_size, empty and is_halting read the in-memory queue without its lock; see work_queue.
+     */
+    size_t approx_size() const { return q.approx_size(); }
+    bool empty() const { return q.empty(); }
+    bool is_halting() const { return q.is_halting(); }
+
+    stats snapshot() const {
+        std::unique_lock<std::mutex> l(m);
+        return stats{ appended, written, durable, standby_received, standby_durable, standby_fd >= 0, failed };
+    }
+
+private:
+
+    bool wait_committed(uint64_t end) {
+        if (commit == commit_mode::async) return true;
+
+        std::unique_lock<std::mutex> l(m);
+        auto local = [&]{ return commit != commit_mode::sync || durable >= end; };
+        auto replicated = [&]{ return (commit == commit_mode::sync ? standby_durable : standby_received) >= end; };
+
+        // without a standby there is nothing to wait for: one attaching later would get the item, but not
+        // within any bound.
+        cv.wait_for(l, commit_timeout, [&]{
+            return failed || (local() && (replicated() || (standby_fd < 0 && attaching_fd < 0)));
+        });
+        return !failed && local() && replicated();
+    }
+
+    // called by the writer, or once it has exited.  Disconnects the current standby, if any.
+    void retire_standby() {
+        if (replica_fd < 0) return;
+        ::shutdown(replica_fd, SHUT_RDWR);
+        ack_reader.join();
+        ::close(replica_fd);
+        replica_fd = -1;
+    }
+
+    // the only thread touching the journal file and sending on the standby socket.
+    void write_loop() {
+        for (;;) {
+            std::string batch;
+            int to;
+            bool attach = false;
+            {   // locked context
+                std::unique_lock<std::mutex> l(m);
+                cv.wait(l, [&]{ return stopping || !unwritten.empty() || attaching_fd >= 0; });
+                if (unwritten.empty() && attaching_fd < 0) return;
+
+                batch.swap(unwritten);
+                if (attaching_fd >= 0) {
+                    standby_fd = attaching_fd;
+                    attaching_fd = -1;
+                    standby_received = standby_durable = 0;
+                    attach = true;
+                }
+                to = standby_fd;
+            }   // end locked context
+
+            std::string shipment;
+            if (attach) {
+                retire_standby();
+                replica_fd = to;
+                ack_reader = std::thread([this, to]{ read_acks(to); });
+
+                const journal_socket::hello h{ journal_socket::hello_magic, static_cast<uint32_t>(commit) };
+                shipment.assign(reinterpret_cast<const char *>(&h), sizeof(h));
+            }
+
+            bool ok = true;
+            try {
+                if (attach) shipment += journal.contents();
+                if (!batch.empty()) {
+                    journal.append(batch);
+                    if (commit == commit_mode::sync) journal.sync();
+                }
+            } catch (const std::system_error &) {
+                ok = false;
+            }
+
+            bool shipped = true;
+            if (ok && to >= 0) {
+                shipment += batch;
+                shipped = journal_socket::send_all(to, shipment.data(), shipment.size());
+            }
+
+            {   // locked context
+                std::unique_lock<std::mutex> l(m);
+                if (!ok) {
+                    failed = true;
+                } else {
+                    written += batch.size();
+                    if (commit == commit_mode::sync) durable = written;
+                }
+                if (!shipped && standby_fd == to) standby_fd = -1;
+            }   // end locked context
+            cv.notify_all();
+        }
+    }
+
+    void read_acks(int fd) {
+        journal_socket::ack a;
+        while (journal_socket::recv_all(fd, reinterpret_cast<char *>(&a), sizeof(a))) {
+            {   // locked context
+                std::unique_lock<std::mutex> l(m);
+                standby_received = std::max(standby_received, a.received);
+                standby_durable = std::max(standby_durable, a.durable);
+            }   // end locked context
+            cv.notify_all();
+        }
+
+        {   // locked context
+            std::unique_lock<std::mutex> l(m);
+            if (standby_fd == fd) standby_fd = -1;
+        }   // end locked context
+        cv.notify_all();
+    }
+
+    std::atomic<bool> & shutting_down;
+
+    const commit_mode commit;
+    const std::chrono::milliseconds commit_timeout;
+
+    work_queue<T> q;
+    journal_file journal;   // touched only by the writer thread once constructed
+
+    mutable std::mutex m;
+    std::condition_variable cv;
+
+    std::string unwritten;  // framed records not yet handed to the writer
+
+    uint64_t last_seq;
+    uint64_t consumed_seq;
+
+    // journal byte offsets
+    uint64_t appended;
+    uint64_t written;
+    uint64_t durable;
+
+    int standby_fd;     // the standby being streamed to, or -1 once it is lost
+    int attaching_fd;   // handed to replicate_to, not yet picked up by the writer
+    int replica_fd;     // the socket owned, lost or not; touched only by the writer and the destructor
+    uint64_t standby_received;
+    uint64_t standby_durable;
+
+    bool failed;
+    bool stopping;
+
+    std::thread writer;
+    std::thread ack_reader;
+};
+
+/*!
+ * journal_standby - receives a primary journaled_queue's journal over a connected stream socket and keeps an
+ * identical copy at journal_path, acknowledging what it has received (and, in sync mode, written to disk)
+ * once per batch read.
+ *
+ * When the primary goes away, take_over() and then open a journaled_queue on journal_path: it resumes
+ * consumption after the last consumed record the primary got to stream.
+ */
+class journal_standby
+{
+public:
+
+    /*!
+     * \brief journal_standby starts receiving on socket_fd, which it then owns.  Any existing journal at
+     *        journal_path is discarded, since the primary ships its journal from the beginning.
+     */
+    journal_standby(const std::string & journal_path, int socket_fd)
+        : journal(new journal_file(journal_path, true))
+        , fd(socket_fd)
+        , m()
+        , cv()
+        , received(0)
+        , connected(true)
+        , receiver()
+    {
+        receiver = std::thread([this]{ receive(); });
+    }
+
+    ~journal_standby() { take_over(); }
+
+    bool primary_connected() const {
+        std::unique_lock<std::mutex> l(m);
+        return connected;
+    }
+
+    uint64_t getReceived() const {
+        std::unique_lock<std::mutex> l(m);
+        return received;
+    }
+
+    /*!
+     * \brief wait_for_primary_loss blocks until the replication stream ends or timeout passes.
+     * \return true if the primary is gone.
+     */
+    bool wait_for_primary_loss(std::chrono::milliseconds timeout) {
+        std::unique_lock<std::mutex> l(m);
+        return cv.wait_for(l, timeout, [&]{ return !connected; });
+    }
+
+    /*!
+     * \brief take_over stops replication (disconnecting from the primary if it is still there) and closes the
+     *        journal, so that a journaled_queue can be opened on it.
+     */
+    void take_over() {
+        if (fd >= 0) ::shutdown(fd, SHUT_RDWR);
+        if (receiver.joinable()) receiver.join();
+        if (fd >= 0) ::close(fd);
+        fd = -1;
+        journal.reset();
+    }
+
+private:
+
+    void receive() {
+        journal_socket::hello h;
+        bool ok = journal_socket::recv_all(fd, reinterpret_cast<char *>(&h), sizeof(h))
+                  && h.magic == journal_socket::hello_magic;
+        const bool sync = ok && h.mode == static_cast<uint32_t>(commit_mode::sync);
+
+        std::vector<char> buffer(1 << 16);
+        while (ok) {
+            const ssize_t n = ::recv(fd, buffer.data(), buffer.size(), 0);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) break;
+
+            journal_socket::ack a;
+            try {
+                journal->append(std::string(buffer.data(), n));
+                if (sync) journal->sync();
+            } catch (const std::system_error &) {
+                break;
+            }
+            {   // locked context
+                std::unique_lock<std::mutex> l(m);
+                received += n;
+                a.received = received;
+                a.durable = sync ? received : 0;
+            }   // end locked context
+
+            ok = journal_socket::send_all(fd, reinterpret_cast<const char *>(&a), sizeof(a));
+        }
+
+        {   // locked context
+            std::unique_lock<std::mutex> l(m);
+            connected = false;
+        }   // end locked context
+        cv.notify_all();
+    }
+
+    std::unique_ptr<journal_file> journal;
+    int fd;
+
+    mutable std::mutex m;
+    std::condition_variable cv;
+
+    uint64_t received;
+    bool connected;
+
+    std::thread receiver;
+};
+
+#endif // JOURNALED_QUEUE_H
@@ -0,0 +1,124 @@
+#include <cxxtest/TestSuite.h>
+#include <iostream>
+#include <cstdlib>
+#include <sys/wait.h>
+#include "journaled_queue.h"
+
+
+class journaled_queue_test : public CxxTest::TestSuite
+{
+public:
+
+    std::string dir;
+
+    void setUp() {
+        char tmpl[] = "/tmp/journaled_queue_test.XXXXXX";
+        dir = mkdtemp(tmpl);
+    }
+
+    void tearDown() {
+        std::system(("rm -rf " + dir).c_str());
+    }
+
+    void testRecoversUnconsumedItems(void) {
+        std::atomic<bool> haltflag(false);
+        const std::string path = dir + "/journal";
+
+        {
+            journaled_queue<int> q(haltflag, path, commit_mode::async);
+            for (int i = 1; i <= 10; i++)
+                q.enqueue(std::make_unique<int>(i));
+            TS_ASSERT_EQUALS(*q.dequeue(), 1);
+            TS_ASSERT_EQUALS(*q.dequeue(), 2);
+            TS_ASSERT_EQUALS(*q.dequeue(), 3);
+        }
+
+        TS_TRACE("tear the last record, as a crash mid-append would");
+        TS_ASSERT_EQUALS(::truncate(path.c_str(), journal_file(path).size() - 2), 0);
+
+        TS_TRACE("the torn record was the third consumed marker, so item 3 is delivered again");
+        journaled_queue<int> q(haltflag, path, commit_mode::sync);
+        TS_ASSERT_EQUALS(q.size(), 8);
+        TS_ASSERT_EQUALS(*q.dequeue(), 3);
+
+        TS_TRACE("with no standby to replicate to, sync commits only reach the local disk");
+        TS_ASSERT(!q.enqueue(std::make_unique<int>(11)));
+        journaled_queue<int>::stats s = q.snapshot();
+        TS_ASSERT_EQUALS(s.durable, s.appended);
+        TS_ASSERT(!s.standby_attached);
+    }
+
+    void testStandbyTakesOverInAnotherProcess(void) {
+        const std::string primary_path = dir + "/primary";
+        const std::string standby_path = dir + "/standby";
+        const std::string socket_path = dir + "/replication.sock";
+
+        const int listener = journal_socket::unix_listen(socket_path);
+
+        const pid_t standby = fork();
+        if (standby == 0) {
+            // the standby process: receive until the primary is gone, then consume what it left.
+            int status = 1;
+            try {
+                journal_standby replica(standby_path, journal_socket::accept_one(listener));
+                if (replica.wait_for_primary_loss(std::chrono::seconds(20))) {
+                    replica.take_over();
+
+                    std::atomic<bool> halt(false);
+                    journaled_queue<int> q(halt, standby_path);
+                    status = (q.size() == 60) ? 0 : 2;
+                    for (int expected = 41; expected <= 100 && status == 0; expected++)
+                        if (*q.dequeue() != expected) status = 3;
+                }
+            } catch (...) {
+                status = 4;
+            }
+            _exit(status);
+        }
+        ::close(listener);
+
+        {
+            std::atomic<bool> haltflag(false);
+            journaled_queue<int> q(haltflag, primary_path, commit_mode::sync);
+            TS_ASSERT(q.replicate_to(journal_socket::unix_connect(socket_path)));
+
+            bool all_committed = true;
+            for (int i = 1; i <= 100; i++)
+                all_committed = q.enqueue(std::make_unique<int>(i)) && all_committed;
+            TS_ASSERT(all_committed);
+
+            journaled_queue<int>::stats s = q.snapshot();
+            TS_ASSERT(s.standby_attached);
+            TS_ASSERT_LESS_THAN_EQUALS(s.appended, s.standby_durable);
+
+            for (int i = 1; i <= 40; i++)
+                TS_ASSERT_EQUALS(*q.dequeue(), i);
+
+            TS_TRACE("the primary goes away here, after flushing its consumed markers to the standby");
+        }
+
+        int status = -1;
+        TS_ASSERT_EQUALS(waitpid(standby, &status, 0), standby);
+        TS_ASSERT(WIFEXITED(status));
+        TS_ASSERT_EQUALS(WEXITSTATUS(status), 0);
+    }
+
+    void testSemiSyncWaitsForStandby(void) {
+        int fds[2];
+        TS_ASSERT_EQUALS(::socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+
+        std::atomic<bool> haltflag(false);
+        journal_standby replica(dir + "/standby", fds[1]);
+        journaled_queue<int> q(haltflag, dir + "/primary", commit_mode::semi_sync);
+
+        TS_ASSERT(q.replicate_to(fds[0]));
+        TS_ASSERT(!q.replicate_to(fds[0]));
+
+        for (int i = 0; i < 20; i++)
+            TS_ASSERT(q.enqueue(std::make_unique<int>(i)));
+
+        TS_ASSERT_LESS_THAN_EQUALS(q.snapshot().appended, replica.getReceived());
+        TS_ASSERT_EQUALS(q.snapshot().standby_durable, 0);
+    }
+
+};
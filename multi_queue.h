@@ -0,0 +1,300 @@
+#ifndef MULTI_QUEUE_H
+#define MULTI_QUEUE_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+using namespace std::chrono_literals;
+
+/*!
+ * item_priority - the default priority of a multi_queue item: its priority() member, lower served first.
+ * Specialize, or pass another functor, for items that don't have one.
+ */
+template <class T>
+struct item_priority {
+    double operator()(const T & work_item) const { return work_item.priority(); }
+};
+
+/*!
+ * multi_queue - a relaxed priority queue (a MultiQueue) that scales with the number of threads.
+ *
+ * A single locked heap serializes every operation on one mutex.  Instead this keeps c * n_threads small heaps,
+ * each with its own lock.  An enqueue goes to a random heap; a dequeue looks at the published tops of two random
+ * heaps, without locking either, and pops the better one.  Operations rarely meet on a lock, so throughput grows
+ * nearly linearly with threads, and the item served is close to the true minimum: its expected rank error (how
+ * many queued items were better) is O(c * n_threads), independent of the queue's depth.
+ *
+ * Locks are only ever tried: a thread finding a heap busy picks another instead of waiting.
+ *
+ * Bounded: with max_depth items queued, an enqueue replaces the worst item of the heap it lands on if it is
+ * better than that item, and is dropped otherwise -- a local approximation of dropping the lowest priority.
+ *
+ * Consumers with nothing to take park on a condition variable; halting follows work_queue.
+ */
+template <class T, class Priority = item_priority<T> >
+class multi_queue
+{
+public:
+
+    /*!
+     * \brief multi_queue creates the queue; halt_flag, max_depth and wait_interval_ms are as for work_queue.
+     * \param n_threads how many threads will use the queue, sizing the number of heaps.
+     * \param c heaps per thread: more heaps mean less contention but a larger rank error.
+     */
+    multi_queue(std::atomic<bool> & halt_flag, size_t max_depth = SIZE_MAX, int wait_interval_ms = 100,
+                size_t n_threads = std::max(1u, std::thread::hardware_concurrency()), size_t c = 2,
+                Priority priority = Priority())
+        : shutting_down(halt_flag)
+        , wait_interval(wait_interval_ms)
+        , max(max_depth)
+        , priority_of(std::move(priority))
+        , heaps(std::max<size_t>(1, n_threads * c))
+        , depth(0)
+        , n_dropped(0)
+        , n_handled(0)
+        , n_sleeping(0)
+        , m()
+        , cv()
+    { }
+
+    multi_queue(const multi_queue &) = delete;
+    multi_queue & operator=(const multi_queue &) = delete;
+
+    /*!
+     * \brief enqueue adds the work item to a random heap.  Enqueues while shutting down, and empty
+     *        std::unique_ptrs, are ignored.
+     */
+    void enqueue(std::unique_ptr<T> work_item)
+    {
+        if (shutting_down || !work_item) return;
+
+        const double key = priority_of(*work_item);
+        const bool room = reserve();
+
+        heap & h = lock_random();
+        std::unique_lock<std::mutex> l(h.m, std::adopt_lock);
+        if (room) {
+            push(h, entry{ key, std::move(work_item) });
+        } else {
+            n_dropped++;
+            replace_worst(h, entry{ key, std::move(work_item) });
+        }
+        l.unlock();
+
+        if (room) wake_sleepers();
+    }
+
+    /*!
+     * \brief enqueue adds all the non-empty elements of bulk to one random heap under a single lock.
+     *        If the queue is shutting down, bulk is left untouched.
+     */
+    void enqueue(std::vector<std::unique_ptr<T> > & bulk)
+    {
+        if (shutting_down) return;
+
+        heap & h = lock_random();
+        std::unique_lock<std::mutex> l(h.m, std::adopt_lock);
+        bool pushed = false;
+        for (auto & work_item: bulk) {
+            if (!work_item) continue;
+            const double key = priority_of(*work_item);
+            if (reserve()) {
+                push(h, entry{ key, std::move(work_item) });
+                pushed = true;
+            } else {
+                n_dropped++;
+                replace_worst(h, entry{ key, std::move(work_item) });
+            }
+        }
+        l.unlock();
+
+        if (pushed) wake_sleepers();
+    }
+
+    /*!
+     * \brief dequeue removes and returns a work item near the best, waiting until there is one.
+     * \return the work item, or an empty std::unique_ptr when shutting down.
+     */
+    std::unique_ptr<T> dequeue()
+    {
+        for (;;) {
+            if (shutting_down) return std::unique_ptr<T>{};
+
+            if (std::unique_ptr<T> work_item = try_pop()) {
+                n_handled++;
+                return work_item;
+            }
+
+            std::unique_lock<std::mutex> l(m);
+            n_sleeping++;
+            // re-checked after announcing ourselves: an enqueue either sees n_sleeping or is counted here.
+            if (depth.load() == 0 && !shutting_down)
+                cv.wait_for(l, wait_interval * 1ms);
+            n_sleeping--;
+        }
+    }
+
+    /*!
+     * \brief size returns the number of queued work items (0 if shutting down).
+     */
+    size_t size() const {
+        if (shutting_down) return 0;
+        return depth.load();
+    }
+
+    /*!
+     * \brief approx_size, empty and is_halting need no lock; see work_queue.
+     */
+    size_t approx_size() const { return size(); }
+    bool empty() const { return size() == 0; }
+    bool is_halting() const { return shutting_down.load(std::memory_order_relaxed); }
+
+    /*!
+     * \brief dropped returns the number of work items dropped so far because the queue was full,
+     *        and resets the counter to zero.
+     */
+    int dropped() { return static_cast<int>(n_dropped.exchange(0)); }
+
+    /*!
+     * \brief handled returns the number of work items dequeued so far, and resets the counter to zero.
+     */
+    int handled() { return static_cast<int>(n_handled.exchange(0)); }
+
+    /*!
+     * \brief heap_count returns the number of internal heaps, c * n_threads.
+     */
+    size_t heap_count() const { return heaps.size(); }
+
+private:
+
+    struct entry {
+        double key;
+        std::unique_ptr<T> work_item;
+    };
+
+    // orders std::push_heap and friends as a min-heap on key.
+    struct later {
+        bool operator()(const entry & a, const entry & b) const { return a.key > b.key; }
+    };
+
+    struct alignas(64) heap {
+        std::mutex m;
+        std::vector<entry> items;
+        std::atomic<double> top{ empty_key() };    // key of items.front(), readable without m
+    };
+
+    static double empty_key() { return std::numeric_limits<double>::infinity(); }
+
+    static size_t random_index(size_t n) {
+        static thread_local uint64_t state = 0x9e3779b97f4a7c15ULL ^ reinterpret_cast<uintptr_t>(&state);
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        return static_cast<size_t>((state >> 32) * n >> 32);
+    }
+
+    // locks and returns a random heap, trying others while the chosen one is busy.
+    heap & lock_random() {
+        for (;;) {
+            heap & h = heaps[random_index(heaps.size())];
+            if (h.m.try_lock()) return h;
+        }
+    }
+
+    // called with h.m held.
+    void push(heap & h, entry e) {
+        h.items.push_back(std::move(e));
+        std::push_heap(h.items.begin(), h.items.end(), later());
+        h.top.store(h.items.front().key, std::memory_order_relaxed);
+    }
+
+    // called with h.m held.  The worst item of a min-heap is a leaf: only the second half need be searched.
+    void replace_worst(heap & h, entry e) {
+        if (h.items.empty()) return;
+
+        size_t worst = h.items.size() / 2;
+        for (size_t i = worst + 1; i < h.items.size(); i++)
+            if (h.items[i].key > h.items[worst].key) worst = i;
+        if (!(e.key < h.items[worst].key)) return;   // the new item is the worst: it's the one dropped
+
+        // sift the replacement up from the leaf.
+        size_t at = worst;
+        while (at > 0 && e.key < h.items[(at - 1) / 2].key) {
+            h.items[at] = std::move(h.items[(at - 1) / 2]);
+            at = (at - 1) / 2;
+        }
+        h.items[at] = std::move(e);
+        h.top.store(h.items.front().key, std::memory_order_relaxed);
+    }
+
+    // the better of two random heaps, by their published tops; after a few empty draws, any non-empty heap.
+    std::unique_ptr<T> try_pop() {
+        for (int attempt = 0; depth.load() > 0; attempt++) {
+            size_t i = random_index(heaps.size());
+            if (attempt < 8) {
+                const size_t j = random_index(heaps.size());
+                if (heaps[j].top.load(std::memory_order_relaxed) < heaps[i].top.load(std::memory_order_relaxed))
+                    i = j;
+            } else {
+                // the items left are few and scattered: scan for one rather than keep missing.
+                for (size_t k = 0; k < heaps.size(); k++, i = (i + 1) % heaps.size())
+                    if (heaps[i].top.load(std::memory_order_relaxed) != empty_key()) break;
+            }
+
+            heap & h = heaps[i];
+            if (h.top.load(std::memory_order_relaxed) == empty_key() || !h.m.try_lock()) continue;
+            std::unique_lock<std::mutex> l(h.m, std::adopt_lock);
+            if (h.items.empty()) continue;
+
+            std::pop_heap(h.items.begin(), h.items.end(), later());
+            std::unique_ptr<T> work_item = std::move(h.items.back().work_item);
+            h.items.pop_back();
+            h.top.store(h.items.empty() ? empty_key() : h.items.front().key, std::memory_order_relaxed);
+            depth--;
+            return work_item;
+        }
+        return std::unique_ptr<T>{};
+    }
+
+    // claims room for one item; false when the queue is full.
+    bool reserve() {
+        size_t current = depth.load();
+        while (current < max) {
+            if (depth.compare_exchange_weak(current, current + 1)) return true;
+        }
+        return false;
+    }
+
+    void wake_sleepers() {
+        if (n_sleeping.load() == 0) return;
+        std::unique_lock<std::mutex> l(m);
+        cv.notify_one();
+    }
+
+    std::atomic<bool> & shutting_down;
+
+    const int wait_interval; // units 1msec
+    const size_t max;
+
+    Priority priority_of;
+
+    std::vector<heap> heaps;
+
+    alignas(64) std::atomic<size_t> depth;
+    std::atomic<uint64_t> n_dropped;
+    std::atomic<uint64_t> n_handled;
+
+    alignas(64) std::atomic<int> n_sleeping;
+    std::mutex m;
+    std::condition_variable cv;
+};
+
+#endif // MULTI_QUEUE_H
@@ -0,0 +1,128 @@
+#include <cxxtest/TestSuite.h>
+#include <iostream>
+#include <thread>
+#include "multi_queue.h"
+
+
+class multi_queue_test : public CxxTest::TestSuite
+{
+public:
+
+    struct job {
+        int id;
+        double urgency;
+        double priority() const { return urgency; }
+    };
+
+    void testSingleHeapIsExact(void) {
+        std::atomic<bool> haltflag(false);
+        multi_queue<job> q(haltflag, SIZE_MAX, 10, 1, 1);
+        TS_ASSERT_EQUALS(q.heap_count(), 1);
+
+        const double urgencies[] = { 5, 1, 4, 2, 3 };
+        for (int i = 0; i < 5; i++)
+            q.enqueue(std::unique_ptr<job>(new job{ i, urgencies[i] }));
+
+        std::vector<std::unique_ptr<job> > bulk;
+        bulk.push_back(std::unique_ptr<job>(new job{ 5, 0 }));
+        bulk.push_back(std::unique_ptr<job>());
+        q.enqueue(bulk);
+        TS_ASSERT_EQUALS(q.size(), 6);
+
+        TS_TRACE("with one heap the queue is an exact priority queue");
+        for (double expected = 0; expected < 6; expected++)
+            TS_ASSERT_EQUALS(q.dequeue()->urgency, expected);
+        TS_ASSERT(q.empty());
+        TS_ASSERT_EQUALS(q.handled(), 6);
+    }
+
+    void testManyHeapsAreNearlyOrdered(void) {
+        std::atomic<bool> haltflag(false);
+        multi_queue<job> q(haltflag, SIZE_MAX, 10, 4, 2);
+
+        const int n = 10000;
+        for (int i = 0; i < n; i++)
+            q.enqueue(std::unique_ptr<job>(new job{ i, double((i * 7919) % n) }));
+
+        TS_TRACE("every key is distinct, so a dequeued key minus the keys already taken below it is its rank error");
+        std::vector<bool> taken(n, false);
+        int below = 0;
+        long total_error = 0;
+        int worst = 0;
+        for (int i = 0; i < n; i++) {
+            const int key = int(q.dequeue()->urgency);
+            taken[key] = true;
+            while (below < n && taken[below]) below++;
+            int error = 0;
+            for (int k = below; k < key; k++)
+                if (!taken[k]) error++;
+            total_error += error;
+            worst = std::max(worst, error);
+        }
+        TS_ASSERT(q.empty());
+        TS_ASSERT_LESS_THAN(double(total_error) / n, 4.0 * q.heap_count());
+        TS_ASSERT_LESS_THAN(worst, n / 10);
+    }
+
+    void testFullQueueDropsTheWorst(void) {
+        std::atomic<bool> haltflag(false);
+        multi_queue<job> q(haltflag, 3, 10, 1, 1);
+
+        for (int i = 0; i < 3; i++)
+            q.enqueue(std::unique_ptr<job>(new job{ i, double(10 + i) }));
+        q.enqueue(std::unique_ptr<job>(new job{ 3, 1 }));
+        q.enqueue(std::unique_ptr<job>(new job{ 4, 99 }));
+
+        TS_TRACE("the urgent arrival displaces the least urgent item; the least urgent arrival is itself dropped");
+        TS_ASSERT_EQUALS(q.size(), 3);
+        TS_ASSERT_EQUALS(q.dropped(), 2);
+        TS_ASSERT_EQUALS(q.dequeue()->id, 3);
+        TS_ASSERT_EQUALS(q.dequeue()->id, 0);
+        TS_ASSERT_EQUALS(q.dequeue()->id, 1);
+    }
+
+    void testConcurrentUseLosesNothing(void) {
+        std::atomic<bool> haltflag(false);
+        multi_queue<job> q(haltflag, SIZE_MAX, 10, 8);
+
+        const int n_threads = 8, per_thread = 20000;
+        std::atomic<long> popped_sum(0);
+        std::vector<std::thread> threads;
+        for (int t = 0; t < n_threads; t++) {
+            threads.emplace_back([&, t]{
+                long sum = 0;
+                for (int i = 0; i < per_thread; i++) {
+                    const int id = t * per_thread + i;
+                    q.enqueue(std::unique_ptr<job>(new job{ id, double(id % 97) }));
+                    sum += q.dequeue()->id;
+                }
+                popped_sum += sum;
+            });
+        }
+        for (auto & thread: threads) thread.join();
+
+        const long n = long(n_threads) * per_thread;
+        TS_ASSERT_EQUALS(popped_sum, n * (n - 1) / 2);
+        TS_ASSERT(q.empty());
+    }
+
+    void testHaltReleasesConsumers(void) {
+        std::atomic<bool> haltflag(false);
+        multi_queue<job> q(haltflag, SIZE_MAX, 10);
+
+        std::unique_ptr<job> got(new job{ 0, 0 });
+        std::thread consumer([&]{ got = q.dequeue(); });
+        std::this_thread::sleep_for(20ms);
+        q.enqueue(std::unique_ptr<job>(new job{ 1, 0 }));
+        consumer.join();
+        TS_ASSERT_EQUALS(got->id, 1);
+
+        std::thread waiter([&]{ got = q.dequeue(); });
+        std::this_thread::sleep_for(20ms);
+        haltflag = true;
+        waiter.join();
+        TS_ASSERT_EQUALS(got.get(), nullptr);
+        TS_ASSERT(q.is_halting());
+    }
+
+};
@@ -0,0 +1,149 @@
+#ifndef PERF_COUNTERS_H
+#define PERF_COUNTERS_H
+
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+/*!
+ * perf_counters - hardware and software event counters of the calling thread, via perf_event_open(2).
+ *
+ * Each counter is opened on its own, so one that the kernel, the CPU or perf_event_paranoid refuses is
+ * simply reported unavailable while the others still count.  On other platforms every counter is unavailable.
+ *
+ * Cache-line transfers (loads hitting a line modified in another core's cache, "HITM") have no generic perf
+ * event; when the environment variable WORK_QUEUE_PERF_HITM holds the raw event code for this CPU
+ * (e.g. 0x04d2 for MEM_LOAD_L3_HIT_RETIRED.XSNP_HITM on Skylake) that counter is opened as well.
+ *
+ * Context switches are taken from getrusage(RUSAGE_THREAD), which needs no privilege and, unlike the
+ * software perf event, also counts when perf_event_paranoid restricts counting to user space.
+ *
+ * A perf_counters instance counts only the thread that constructed it, between start() and stop().
+ */
+class perf_counters
+{
+public:
+
+    enum event { cycles, instructions, llc_misses, context_switches, hitm, n_events };
+
+    struct sample {
+        unsigned threads;   // number of per-thread samples summed into this one
+        bool valid[n_events];
+        uint64_t value[n_events];
+
+        sample() : threads(0) { for (int i = 0; i < n_events; i++) { valid[i] = false; value[i] = 0; } }
+
+        // accumulates another thread's counts; a counter stays valid only if it was valid in every thread.
+        sample & operator+=(const sample & other) {
+            for (int i = 0; i < n_events; i++) {
+                valid[i] = (threads == 0 ? other.valid[i] : valid[i] && other.valid[i]);
+                value[i] += other.value[i];
+            }
+            threads += other.threads;
+            return *this;
+        }
+    };
+
+    static const char * name(int e) {
+        static const char * const names[n_events] = { "cycles", "instr", "llc-miss", "ctx-sw", "hitm" };
+        return names[e];
+    }
+
+    perf_counters() {
+        for (int i = 0; i < n_events; i++) fds[i] = -1;
+#ifdef __linux__
+        open_counter(cycles, PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES);
+        open_counter(instructions, PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS);
+        open_counter(llc_misses, PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES);
+        if (const char * raw = std::getenv("WORK_QUEUE_PERF_HITM"))
+            open_counter(hitm, PERF_TYPE_RAW, std::strtoull(raw, nullptr, 0));
+#endif
+    }
+
+    ~perf_counters() {
+#ifdef __linux__
+        for (int i = 0; i < n_events; i++)
+            if (fds[i] >= 0) close(fds[i]);
+#endif
+    }
+
+    perf_counters(const perf_counters &) = delete;
+    perf_counters & operator=(const perf_counters &) = delete;
+
+    /*!
+     * \brief available tells whether any counter could be opened at all.
+     */
+    bool available() const {
+        for (int i = 0; i < n_events; i++)
+            if (fds[i] >= 0) return true;
+        return false;
+    }
+
+    void start() {
+#ifdef __linux__
+        switches_at_start = thread_switches();
+        for (int i = 0; i < n_events; i++) {
+            if (fds[i] < 0) continue;
+            ioctl(fds[i], PERF_EVENT_IOC_RESET, 0);
+            ioctl(fds[i], PERF_EVENT_IOC_ENABLE, 0);
+        }
+#endif
+    }
+
+    sample stop() {
+        sample s;
+        s.threads = 1;
+#ifdef __linux__
+        for (int i = 0; i < n_events; i++) {
+            if (fds[i] < 0) continue;
+            ioctl(fds[i], PERF_EVENT_IOC_DISABLE, 0);
+            uint64_t count = 0;
+            s.valid[i] = (read(fds[i], &count, sizeof(count)) == sizeof(count));
+            s.value[i] = count;
+        }
+        s.valid[context_switches] = true;
+        s.value[context_switches] = thread_switches() - switches_at_start;
+#endif
+        return s;
+    }
+
+private:
+
+#ifdef __linux__
+    static uint64_t thread_switches() {
+        struct rusage usage;
+        if (getrusage(RUSAGE_THREAD, &usage) != 0) return 0;
+        return static_cast<uint64_t>(usage.ru_nvcsw) + static_cast<uint64_t>(usage.ru_nivcsw);
+    }
+
+    void open_counter(int e, uint32_t type, uint64_t config) {
+        struct perf_event_attr attr;
+        std::memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = type;
+        attr.config = config;
+        attr.disabled = 1;
+
+        // counting kernel time needs perf_event_paranoid < 2; fall back to user space only.
+        fds[e] = static_cast<int>(syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0));
+        if (fds[e] < 0) {
+            attr.exclude_kernel = 1;
+            attr.exclude_hv = 1;
+            fds[e] = static_cast<int>(syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0));
+        }
+    }
+#endif
+
+    int fds[n_events];
+    uint64_t switches_at_start = 0;
+};
+
+#endif // PERF_COUNTERS_H
@@ -0,0 +1,235 @@
+#ifndef RENDEZVOUS_QUEUE_H
+#define RENDEZVOUS_QUEUE_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "depth_gauge.h"
+
+using namespace std::chrono_literals;
+
+/*!
+ * rendezvous_queue - a zero-capacity channel: an enqueue completes only when a consumer has taken the item.
+ *
+ * There is no buffer.  A producer or consumer that finds no partner waiting parks on its own condition
+ * variable in a FIFO list of waiters; the partner that arrives later hands the item over directly (from the
+ * parked producer's unique_ptr, or into the parked consumer's) and wakes exactly that waiter, so a handoff
+ * costs one wakeup.
+ *
+ * Halting follows work_queue: when the halt flag becomes true, parked calls return within one wait interval,
+ * dequeue returning an empty std::unique_ptr.
+ */
+template <class T>
+class rendezvous_queue
+{
+public:
+
+    /*!
+     * \brief rendezvous_queue creates a channel.
+     * \param halt_flag as for work_queue.
+     * \param wait_interval_ms how often parked calls check the halt flag, defaulting to 100ms.
+     */
+    rendezvous_queue(std::atomic<bool> & halt_flag, int wait_interval_ms = 100)
+        : shutting_down(halt_flag)
+        , wait_interval(wait_interval_ms)
+        , n_handled(0)
+        , m()
+        , producers()
+        , waiting_producers()
+        , consumers()
+    { }
+
+    ~rendezvous_queue() {  }
+
+    /*!
+     * \brief enqueue hands the work item to a consumer, blocking until one has taken it.
+     *        If the queue is shutting down before that, the item is discarded.  Empty std::unique_ptrs are ignored.
+     */
+    void enqueue(std::unique_ptr<T> work_item)
+    {
+        handoff(work_item, nullptr);
+    }
+
+    /*!
+     * \brief enqueue_for hands the work item to a consumer, waiting at most timeout for one to take it.
+     * \return true when a consumer took the item; otherwise false, and work_item still holds it.
+     */
+    bool enqueue_for(std::unique_ptr<T> & work_item, std::chrono::milliseconds timeout)
+    {
+        const auto deadline = std::chrono::steady_clock::now() + timeout;
+        return handoff(work_item, &deadline);
+    }
+
+    /*!
+     * \brief enqueue hands each element of bulk to a consumer in turn.  Items not handed over because the queue
+     *        is shutting down are left in bulk.  Empty std::unique_ptrs are skipped.
+     */
+    void enqueue(std::vector<std::unique_ptr<T> > & bulk)
+    {
+        for (auto & work_item: bulk) {
+            if (work_item && !handoff(work_item, nullptr)) return;
+        }
+    }
+
+    /*!
+     * \brief dequeue takes an item from a waiting producer, or waits for one to arrive.
+     * \return the work item, or an empty std::unique_ptr when shutting down.
+     */
+    std::unique_ptr<T> dequeue()
+    {
+        std::unique_lock<std::mutex> l(m);
+        if (shutting_down) return std::unique_ptr<T>{};
+
+        if (!producers.empty()) {
+            producer_slot * producer = producers.front();
+            producers.pop_front();
+            waiting_producers.publish(producers.size());
+            std::unique_ptr<T> val = std::move(*producer->work_item);
+            producer->taken = true;
+            n_handled++;
+            // notified with m held: once m is released the producer may return and destroy its slot.
+            producer->cv.notify_one();
+            return val;
+        }
+
+        consumer_slot self;
+        consumers.push_back(&self);
+        while (!self.filled && !shutting_down)
+            self.cv.wait_for(l, wait_interval * 1ms);
+
+        if (!self.filled) {
+            consumers.erase(std::find(consumers.begin(), consumers.end(), &self));
+            return std::unique_ptr<T>{};
+        }
+        return std::move(self.work_item);
+    }
+
+    /*!
+     * \brief size returns the number of producers waiting for a consumer (0 if shutting down).
+     */
+    size_t size() const {
+        std::unique_lock<std::mutex> l(m);
+        if (shutting_down) return 0;
+        return producers.size();
+    }
+
+    /*!
+     * \brief approx_size returns the number of waiting producers (0 if shutting down) by relaxed loads, without
+     *        the lock.  It may lag size() by the handoffs in progress; see depth_gauge.
+     */
+    size_t approx_size() const {
+        if (is_halting()) return 0;
+        return waiting_producers.load();
+    }
+
+    /*!
+     * \brief empty returns whether no producer is waiting, per approx_size().
+     */
+    bool empty() const { return approx_size() == 0; }
+
+    /*!
+     * \brief is_halting returns the halt flag by a relaxed load.
+     */
+    bool is_halting() const { return shutting_down.load(std::memory_order_relaxed); }
+
+    /*!
+     * \brief waiting_consumers returns the number of consumers parked in dequeue.
+     */
+    size_t waiting_consumers() const {
+        std::unique_lock<std::mutex> l(m);
+        return consumers.size();
+    }
+
+    /*!
+     * \brief handled returns the number of items handed over so far and resets the counter to zero.
+     */
+    int handled () {
+        std::unique_lock<std::mutex> l(m);
+
+        int so_far = n_handled;
+        n_handled = 0;
+        return so_far;
+    }
+
+    int getWaitInterval() const {
+        std::unique_lock<std::mutex> l(m);
+        return wait_interval;
+    }
+    void setWaitInterval(int value) {
+        std::unique_lock<std::mutex> l(m);
+        wait_interval = value;
+    }
+
+private:
+
+    // a parked producer; the item stays in the producer's own unique_ptr until a consumer moves it out.
+    struct producer_slot {
+        std::unique_ptr<T> * work_item;
+        bool taken = false;
+        std::condition_variable cv;
+    };
+
+    // a parked consumer, filled in place by the producer that arrives.
+    struct consumer_slot {
+        std::unique_ptr<T> work_item;
+        bool filled = false;
+        std::condition_variable cv;
+    };
+
+    // deadline null means wait until taken or halting.  Returns whether a consumer took the item.
+    bool handoff(std::unique_ptr<T> & work_item, const std::chrono::steady_clock::time_point * deadline)
+    {
+        std::unique_lock<std::mutex> l(m);
+        if (shutting_down || !work_item) return false;
+
+        if (!consumers.empty()) {
+            consumer_slot * consumer = consumers.front();
+            consumers.pop_front();
+            consumer->work_item = std::move(work_item);
+            consumer->filled = true;
+            n_handled++;
+            // notified with m held: once m is released the consumer may return and destroy its slot.
+            consumer->cv.notify_one();
+            return true;
+        }
+
+        producer_slot self;
+        self.work_item = &work_item;
+        producers.push_back(&self);
+        waiting_producers.publish(producers.size());
+        while (!self.taken && !shutting_down) {
+            auto wake = std::chrono::steady_clock::now() + wait_interval * 1ms;
+            if (deadline) {
+                if (std::chrono::steady_clock::now() >= *deadline) break;
+                wake = std::min(wake, *deadline);
+            }
+            self.cv.wait_until(l, wake);
+        }
+
+        if (!self.taken) {
+            producers.erase(std::find(producers.begin(), producers.end(), &self));
+            waiting_producers.publish(producers.size());
+        }
+        return self.taken;
+    }
+
+    std::atomic<bool> & shutting_down;
+
+    int wait_interval; // units 1msec
+
+    int n_handled;
+
+    mutable std::mutex m;
+
+    std::deque<producer_slot *> producers;
+    depth_gauge waiting_producers;  // producers.size(), for lock-free readers
+    std::deque<consumer_slot *> consumers;
+};
+
+#endif // RENDEZVOUS_QUEUE_H
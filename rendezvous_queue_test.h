@@ -0,0 +1,115 @@
+#include <cxxtest/TestSuite.h>
+#include <iostream>
+#include <thread>
+#include "rendezvous_queue.h"
+
+
+class rendezvous_queue_test : public CxxTest::TestSuite
+{
+public:
+
+    void testEnqueueWaitsForConsumer(void) {
+        std::atomic<bool> haltflag(false);
+        rendezvous_queue<int> q(haltflag, 10);
+
+        std::atomic<bool> enqueued(false);
+        std::thread producer([&]{
+            q.enqueue(std::make_unique<int>(42));
+            enqueued = true;
+        });
+
+        TS_TRACE("no consumer yet: the producer must still be blocked, and nothing is buffered");
+        std::this_thread::sleep_for(50ms);
+        TS_ASSERT(!enqueued);
+        TS_ASSERT_EQUALS(q.size(), 1);
+        TS_ASSERT_EQUALS(q.approx_size(), 1);
+
+        std::unique_ptr<int> item = q.dequeue();
+        producer.join();
+        TS_ASSERT(enqueued);
+        TS_ASSERT_EQUALS(*item, 42);
+        TS_ASSERT_EQUALS(q.size(), 0);
+        TS_ASSERT_EQUALS(q.handled(), 1);
+    }
+
+    void testConsumerWaitingFirst(void) {
+        std::atomic<bool> haltflag(false);
+        rendezvous_queue<int> q(haltflag, 10);
+
+        std::unique_ptr<int> item;
+        std::thread consumer([&]{ item = q.dequeue(); });
+
+        while (q.waiting_consumers() == 0)
+            std::this_thread::sleep_for(1ms);
+
+        std::unique_ptr<int> offered = std::make_unique<int>(7);
+        TS_ASSERT(q.enqueue_for(offered, 1000ms));
+        TS_ASSERT_EQUALS(offered.get(), nullptr);
+
+        consumer.join();
+        TS_ASSERT_EQUALS(*item, 7);
+    }
+
+    void testTimedEnqueueReturnsItem(void) {
+        std::atomic<bool> haltflag(false);
+        rendezvous_queue<int> q(haltflag, 10);
+
+        std::unique_ptr<int> offered = std::make_unique<int>(3);
+        TS_ASSERT(!q.enqueue_for(offered, 30ms));
+        TS_ASSERT_DIFFERS(offered.get(), nullptr);
+        TS_ASSERT_EQUALS(*offered, 3);
+        TS_ASSERT_EQUALS(q.size(), 0);
+    }
+
+    void testHaltReleasesWaiters(void) {
+        std::atomic<bool> haltflag(false);
+        rendezvous_queue<int> q(haltflag, 10);
+
+        std::unique_ptr<int> item = std::make_unique<int>(1);
+        std::thread consumer([&]{ item = q.dequeue(); });
+
+        std::vector<std::unique_ptr<int> > bulk;
+        bulk.push_back(std::make_unique<int>(1));
+        bulk.push_back(std::make_unique<int>(2));
+
+        while (q.waiting_consumers() == 0)
+            std::this_thread::sleep_for(1ms);
+
+        std::thread producer([&]{ q.enqueue(bulk); });
+        consumer.join();
+        TS_ASSERT_EQUALS(*item, 1);
+
+        std::this_thread::sleep_for(20ms);
+        haltflag = true;
+        producer.join();
+
+        TS_TRACE("the item no consumer took stays with the producer");
+        TS_ASSERT_EQUALS(bulk[0].get(), nullptr);
+        TS_ASSERT_EQUALS(*bulk[1], 2);
+        TS_ASSERT_EQUALS(q.dequeue().get(), nullptr);
+    }
+
+    void testManyPairs(void) {
+        std::atomic<bool> haltflag(false);
+        rendezvous_queue<int> q(haltflag, 10);
+
+        std::atomic<long> sum(0);
+        std::vector<std::thread> threads;
+        for (int t = 0; t < 4; t++) {
+            threads.emplace_back([&, t]{
+                for (int i = 0; i < 250; i++)
+                    q.enqueue(std::make_unique<int>(t * 250 + i));
+            });
+            threads.emplace_back([&]{
+                for (int i = 0; i < 250; i++)
+                    sum += *q.dequeue();
+            });
+        }
+        for (auto & thread: threads) thread.join();
+
+        TS_ASSERT_EQUALS(sum, 999L * 1000 / 2);
+        TS_ASSERT_EQUALS(q.size(), 0);
+        TS_ASSERT_EQUALS(q.waiting_consumers(), 0);
+    }
+
+};
@@ -0,0 +1,92 @@
+#ifndef RESERVOIR_STORAGE_H
+#define RESERVOIR_STORAGE_H
+
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <random>
+#include <utility>
+
+/*!
+ * reservoir_storage - work_queue storage policy that, once the queue is saturated, keeps a uniform random sample
+ * of the items enqueued since, instead of the latest ones.
+ *
+ * For telemetry, dropping the oldest item under overload leaves the consumers only the tail of the burst.  Here
+ * the queue reaching max_depth starts an overload period, which lasts until the queue next drains empty.  The
+ * items queued when it starts count as the first of the period's arrivals; the n-th arrival then replaces a
+ * uniformly chosen queued item with probability size / n and is discarded otherwise (Algorithm R), so the queue
+ * holds a uniform sample of everything that arrived in the period.
+ *
+ * Items are served in queue order, a replacement taking the place in it of the item it replaces.  The items sit
+ * in a std::deque, so a replacement is an assignment in place, with nothing shifted.
+ *
+ * Each discarded item is represented by the queued items: a popped item stands for itself plus an even share of
+ * the discards not yet accounted for, and work_queue's batch dequeue reports the total for its batch.  Items
+ * the queue discards count as dropped() as usual.
+ *
+ * use as work_queue<T, reservoir_storage<T> >.
+ */
+template <class T>
+class reservoir_storage
+{
+public:
+
+    explicit reservoir_storage(uint64_t seed = std::random_device()())
+        : items()
+        , rng(seed)
+        , n_seen(0)
+        , n_discarded(0)
+        , n_represented(0)
+    { }
+
+    bool empty() const { return items.empty(); }
+    size_t size() const { return items.size(); }
+
+    void push(std::unique_ptr<T> work_item) {
+        if (n_seen > 0) n_seen++;
+        items.push_back(std::move(work_item));
+    }
+
+    std::unique_ptr<T> pop() {
+        const uint64_t share = n_discarded / items.size();     // the last item of a period takes the remainder
+        n_discarded -= share;
+        n_represented += 1 + share;
+
+        std::unique_ptr<T> val = std::move(items.front());
+        items.pop_front();
+        if (items.empty()) n_seen = 0;      // drained: the overload period is over
+        return val;
+    }
+
+    // drops the oldest item; work_queue calls overflow() instead.
+    std::unique_ptr<T> drop() { return pop(); }
+
+    // called when the queue is saturated: either incoming or the queued item it replaces is discarded.
+    std::unique_ptr<T> overflow(std::unique_ptr<T> & incoming) {
+        if (n_seen == 0) n_seen = items.size();
+        n_seen++;
+        n_discarded++;
+
+        const uint64_t slot = std::uniform_int_distribution<uint64_t>(0, n_seen - 1)(rng);
+        if (slot < items.size()) std::swap(items[slot], incoming);
+        return std::move(incoming);
+    }
+
+    // the enqueued items the items popped since the last call stand for.
+    size_t represented() {
+        const size_t n = static_cast<size_t>(n_represented);
+        n_represented = 0;
+        return n;
+    }
+
+private:
+
+    std::deque<std::unique_ptr<T> > items;
+    std::mt19937_64 rng;
+
+    uint64_t n_seen;            // arrivals in the current overload period, 0 outside one
+    uint64_t n_discarded;       // discards not yet accounted to a popped item
+    uint64_t n_represented;
+};
+
+#endif // RESERVOIR_STORAGE_H
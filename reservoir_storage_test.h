@@ -0,0 +1,60 @@
+#include <cxxtest/TestSuite.h>
+#include <iostream>
+#include "reservoir_storage.h"
+#include "work_queue.h"
+
+
+class reservoir_storage_test : public CxxTest::TestSuite
+{
+public:
+
+    void testKeepsAUniformSample(void) {
+        std::atomic<bool> haltflag(false);
+        work_queue<int, reservoir_storage<int> > q(haltflag, 100, 10, reservoir_storage<int>(42));
+
+        const int n = 10000;
+        for (int i = 0; i < n; i++)
+            q.enqueue(std::make_unique<int>(i));
+        TS_ASSERT_EQUALS(q.size(), 100);
+        TS_ASSERT_EQUALS(q.dropped(), n - 100);
+
+        TS_TRACE("drop-oldest would keep only the last 100; the sample spans the whole burst");
+        std::vector<std::unique_ptr<int> > batch;
+        q.dequeue(batch, 100);
+        double sum = 0;
+        int early = 0;
+        for (const auto & item: batch) {
+            sum += *item;
+            if (*item < n / 2) early++;
+        }
+        TS_ASSERT_DELTA(sum / batch.size(), n / 2.0, 1000);
+        TS_ASSERT_LESS_THAN(25, early);
+        TS_ASSERT_LESS_THAN(early, 75);
+    }
+
+    void testBatchesReportWhatTheyRepresent(void) {
+        std::atomic<bool> haltflag(false);
+        work_queue<int, reservoir_storage<int> > q(haltflag, 100, 10, reservoir_storage<int>(7));
+
+        for (int i = 0; i < 1000; i++)
+            q.enqueue(std::make_unique<int>(i));
+
+        TS_TRACE("each of the 100 kept items stands for 10 arrivals");
+        std::vector<std::unique_ptr<int> > batch;
+        TS_ASSERT_EQUALS(q.dequeue(batch, 30), 300);
+        size_t represented = 300;
+        while (q.size() > 0)
+            represented += q.dequeue(batch, 30);
+        TS_ASSERT_EQUALS(represented, 1000);
+        TS_ASSERT_EQUALS(batch.size(), 100);
+
+        TS_TRACE("the drained queue ends the overload period: below max_depth each item stands for itself");
+        for (int i = 0; i < 50; i++)
+            q.enqueue(std::make_unique<int>(i));
+        batch.clear();
+        TS_ASSERT_EQUALS(q.dequeue(batch, 50), 50);
+        TS_ASSERT_EQUALS(*batch[0], 0);
+        TS_ASSERT_EQUALS(*batch[49], 49);
+    }
+
+};
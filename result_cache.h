@@ -0,0 +1,265 @@
+#ifndef RESULT_CACHE_H
+#define RESULT_CACHE_H
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+/*!
+ * result_cache - a bounded, sharded, concurrent cache of computed results, with in-flight deduplication.
+ *
+ * Keys are spread over shards, each with its own mutex, so lookups of different keys rarely contend.
+ * The shards split capacity between them, the first capacity % n_shards holding one result more than the
+ * rest, so the cache never holds more than capacity results; a capacity below n_shards makes fewer shards,
+ * so that every shard holds at least one.  Each shard evicts by CLOCK, an approximation of LRU:
+ * a hit sets the entry's reference bit, and the eviction hand clears set bits as it passes, taking the
+ * first entry found clear.
+ *
+ * get_or_compute runs the computation for a key at most once at a time: callers arriving while it runs wait
+ * for its result instead of computing it again.  If the computation throws, every waiter gets the exception
+ * and nothing is cached.
+ *
+ * R is copied out to each caller; for large results use a std::shared_ptr<const R>.
+ */
+template <class Key, class R, class Hash = std::hash<Key> >
+class result_cache
+{
+public:
+
+    struct stats {
+        uint64_t hits;          // served from the cache
+        uint64_t coalesced;     // waited on an identical computation in flight
+        uint64_t misses;        // computed
+        uint64_t evictions;
+        size_t entries;
+        double hit_rate;        // (hits + coalesced) / lookups
+        std::chrono::microseconds saved;    // service time the hits and coalesced lookups didn't spend
+    };
+
+    /*!
+     * \brief result_cache creates a cache of up to capacity results (0: deduplicate in-flight work only).
+     * \param n_shards the number of shards, at most capacity of them, so each can hold a result.
+     */
+    explicit result_cache(size_t capacity, size_t n_shards = 16)
+        : shards(std::max<size_t>(capacity ? std::min(n_shards, capacity) : n_shards, 1))
+        , hash()
+    {
+        for (size_t i = 0; i < shards.size(); i++)
+            shards[i].capacity = capacity / shards.size() + (i < capacity % shards.size() ? 1 : 0);
+    }
+
+    result_cache(const result_cache &) = delete;
+    result_cache & operator=(const result_cache &) = delete;
+
+    /*!
+     * \brief get_or_compute returns the result cached for key, or the result of the computation in flight for
+     *        it, or else calls compute() -- which must return an R -- and caches what it returns.
+     */
+    template <class Compute>
+    R get_or_compute(const Key & key, Compute compute)
+    {
+        shard & s = shard_for(key);
+
+        std::promise<computed> promise;
+        std::shared_future<computed> in_flight;
+        {   // locked context
+            std::unique_lock<std::mutex> l(s.m);
+
+            auto hit = s.index.find(key);
+            if (hit != s.index.end()) {
+                entry & e = s.entries[hit->second];
+                e.referenced = true;
+                s.n_hits++;
+                s.saved += e.cost;
+                return e.value;
+            }
+
+            auto pending = s.in_flight.find(key);
+            if (pending != s.in_flight.end()) {
+                in_flight = pending->second;
+                s.n_coalesced++;
+            } else {
+                s.in_flight.emplace(key, promise.get_future().share());
+                s.n_misses++;
+            }
+        }   // end locked context
+
+        if (in_flight.valid()) {
+            const computed & c = in_flight.get();
+            std::unique_lock<std::mutex> l(s.m);
+            s.saved += c.cost;
+            return c.value;
+        }
+
+        try {
+            const auto started = std::chrono::steady_clock::now();
+            R value = compute();
+            const duration cost = std::chrono::duration_cast<duration>(std::chrono::steady_clock::now() - started);
+            promise.set_value(computed{ value, cost });
+
+            std::unique_lock<std::mutex> l(s.m);
+            insert(s, key, value, cost);
+            s.in_flight.erase(key);
+            return value;
+        } catch (...) {
+            promise.set_exception(std::current_exception());
+            std::unique_lock<std::mutex> l(s.m);
+            s.in_flight.erase(key);
+            throw;
+        }
+    }
+
+    /*!
+     * \brief size returns the number of cached results.
+     */
+    size_t size() const {
+        size_t total = 0;
+        for (auto & s: shards) {
+            std::unique_lock<std::mutex> l(s.m);
+            total += s.index.size();
+        }
+        return total;
+    }
+
+    /*!
+     * \brief clear drops every cached result; computations in flight still deliver to their waiters.
+     */
+    void clear() {
+        for (auto & s: shards) {
+            std::unique_lock<std::mutex> l(s.m);
+            s.index.clear();
+            s.entries.clear();
+            s.hand = 0;
+        }
+    }
+
+    stats snapshot() const {
+        stats total{ 0, 0, 0, 0, 0, 0.0, std::chrono::microseconds(0) };
+        duration saved(0);
+        for (auto & s: shards) {
+            std::unique_lock<std::mutex> l(s.m);
+            total.hits += s.n_hits;
+            total.coalesced += s.n_coalesced;
+            total.misses += s.n_misses;
+            total.evictions += s.n_evictions;
+            total.entries += s.index.size();
+            saved += s.saved;
+        }
+        const uint64_t lookups = total.hits + total.coalesced + total.misses;
+        total.hit_rate = lookups ? double(total.hits + total.coalesced) / lookups : 0.0;
+        total.saved = std::chrono::duration_cast<std::chrono::microseconds>(saved);
+        return total;
+    }
+
+private:
+
+    typedef std::chrono::nanoseconds duration;
+
+    struct computed {
+        R value;
+        duration cost;
+    };
+
+    struct entry {
+        Key key;
+        R value;
+        duration cost;
+        bool referenced;
+    };
+
+    struct shard {
+        mutable std::mutex m;
+        std::unordered_map<Key, size_t, Hash> index;     // key to position in entries
+        std::vector<entry> entries;                      // the CLOCK ring, at most capacity long
+        size_t capacity = 0;
+        size_t hand = 0;
+        std::unordered_map<Key, std::shared_future<computed>, Hash> in_flight;
+
+        uint64_t n_hits = 0;
+        uint64_t n_coalesced = 0;
+        uint64_t n_misses = 0;
+        uint64_t n_evictions = 0;
+        duration saved = duration(0);
+    };
+
+    shard & shard_for(const Key & key) {
+        // the high bits of a multiplicative hash, so shard choice doesn't correlate with the shard's own buckets.
+        const uint64_t mixed = static_cast<uint64_t>(hash(key)) * 0x9e3779b97f4a7c15ULL;
+        return shards[(mixed >> 32) % shards.size()];
+    }
+
+    // called with s.m held.  New entries start unreferenced, so results never asked for again go first.
+    void insert(shard & s, const Key & key, const R & value, duration cost) {
+        if (s.capacity == 0) return;
+
+        if (s.entries.size() < s.capacity) {
+            s.index[key] = s.entries.size();
+            s.entries.push_back(entry{ key, value, cost, false });
+            return;
+        }
+
+        while (s.entries[s.hand].referenced) {
+            s.entries[s.hand].referenced = false;
+            s.hand = (s.hand + 1) % s.capacity;
+        }
+
+        entry & victim = s.entries[s.hand];
+        s.index.erase(victim.key);
+        s.n_evictions++;
+        victim = entry{ key, value, cost, false };
+        s.index[key] = s.hand;
+        s.hand = (s.hand + 1) % s.capacity;
+    }
+
+    std::vector<shard> shards;
+    Hash hash;
+};
+
+/*!
+ * memoizing_handler - a work_pool handler serving items from a result_cache: the item's key looks up its
+ * result, computing it only on a miss, and deliver receives the item together with the result.
+ *
+ * key_of is the user's hash of an item's content: items with equal keys must have equal results.
+ *
+ *     result_cache<uint64_t, response> cache(10000);
+ *     work_pool<request> pool(q, 8, memoizing_handler<request, response>(cache, key_of, compute, deliver));
+ */
+template <class T, class R, class Key = uint64_t, class Hash = std::hash<Key> >
+class memoizing_handler
+{
+public:
+
+    using key_function = std::function<Key(const T &)>;
+    using compute_function = std::function<R(const T &)>;
+    using deliver_function = std::function<void(std::unique_ptr<T>, const R &)>;
+
+    memoizing_handler(result_cache<Key, R, Hash> & cache, key_function key_of, compute_function compute,
+                      deliver_function deliver)
+        : cache(&cache)
+        , key_of(std::move(key_of))
+        , compute(std::move(compute))
+        , deliver(std::move(deliver))
+    { }
+
+    void operator()(std::unique_ptr<T> item) const {
+        const T & work = *item;
+        const R result = cache->get_or_compute(key_of(work), [&]{ return compute(work); });
+        deliver(std::move(item), result);
+    }
+
+private:
+
+    result_cache<Key, R, Hash> * cache;
+    key_function key_of;
+    compute_function compute;
+    deliver_function deliver;
+};
+
+#endif // RESULT_CACHE_H
@@ -0,0 +1,127 @@
+#include <cxxtest/TestSuite.h>
+#include <iostream>
+#include <stdexcept>
+#include <thread>
+#include "result_cache.h"
+#include "work_pool.h"
+
+
+class result_cache_test : public CxxTest::TestSuite
+{
+public:
+
+    void testHitsAndClockEviction(void) {
+        result_cache<int, int> cache(2, 1);
+        int computed = 0;
+        auto square = [&](int x){ return cache.get_or_compute(x, [&]{ computed++; return x * x; }); };
+
+        TS_ASSERT_EQUALS(square(2), 4);
+        TS_ASSERT_EQUALS(square(3), 9);
+        TS_ASSERT_EQUALS(square(2), 4);
+        TS_ASSERT_EQUALS(computed, 2);
+
+        TS_TRACE("2 was used again, so 3 is the one evicted to make room for 4");
+        TS_ASSERT_EQUALS(square(4), 16);
+        TS_ASSERT_EQUALS(square(2), 4);
+        TS_ASSERT_EQUALS(computed, 3);
+        TS_ASSERT_EQUALS(square(3), 9);
+        TS_ASSERT_EQUALS(computed, 4);
+
+        result_cache<int, int>::stats s = cache.snapshot();
+        TS_ASSERT_EQUALS(s.hits, 2);
+        TS_ASSERT_EQUALS(s.misses, 4);
+        TS_ASSERT_EQUALS(s.evictions, 2);
+        TS_ASSERT_EQUALS(s.entries, 2);
+        TS_ASSERT_EQUALS(cache.size(), 2);
+    }
+
+    void testShardsSplitTheCapacityExactly(void) {
+        result_cache<int, int> cache(10, 4);
+        for (int i = 0; i < 1000; i++)
+            cache.get_or_compute(i, [&]{ return i; });
+
+        TS_TRACE("10 over 4 shards: two hold 3 results and two hold 2, never 12 in all");
+        TS_ASSERT_EQUALS(cache.size(), 10);
+    }
+
+    void testCapacityBelowTheShardCountCachesEveryKey(void) {
+        result_cache<int, int> cache(4);
+        int computed = 0;
+        for (int i = 0; i < 16; i++)
+            for (int repeat = 0; repeat < 2; repeat++)
+                cache.get_or_compute(i, [&]{ computed++; return i; });
+
+        TS_TRACE("4 results over the default 16 shards: 4 shards of one, so whichever a key lands on keeps it");
+        TS_ASSERT_EQUALS(computed, 16);
+        TS_ASSERT_EQUALS(cache.snapshot().hits, 16);
+        TS_ASSERT_LESS_THAN_EQUALS(cache.size(), 4);
+    }
+
+    void testConcurrentIdenticalItemsComputeOnce(void) {
+        result_cache<int, int> cache(100);
+        std::atomic<int> computed(0);
+
+        std::vector<std::thread> callers;
+        std::atomic<int> correct(0);
+        for (int i = 0; i < 8; i++) {
+            callers.emplace_back([&]{
+                const int r = cache.get_or_compute(7, [&]{
+                    computed++;
+                    std::this_thread::sleep_for(50ms);
+                    return 49;
+                });
+                if (r == 49) correct++;
+            });
+        }
+        for (auto & caller: callers) caller.join();
+
+        TS_ASSERT_EQUALS(computed, 1);
+        TS_ASSERT_EQUALS(correct, 8);
+
+        result_cache<int, int>::stats s = cache.snapshot();
+        TS_ASSERT_EQUALS(s.misses, 1);
+        TS_ASSERT_EQUALS(s.hits + s.coalesced, 7);
+        TS_ASSERT_LESS_THAN_EQUALS(std::chrono::microseconds(7 * 50000), s.saved);
+        TS_ASSERT_DELTA(s.hit_rate, 7.0 / 8, 1e-9);
+    }
+
+    void testFailuresAreNotCached(void) {
+        result_cache<int, int> cache(10);
+
+        bool threw = false;
+        try {
+            cache.get_or_compute(1, []() -> int { throw std::runtime_error("downstream failed"); });
+        } catch (std::runtime_error &) {
+            threw = true;
+        }
+        TS_ASSERT(threw);
+        TS_ASSERT_EQUALS(cache.size(), 0);
+        TS_ASSERT_EQUALS(cache.get_or_compute(1, []{ return 5; }), 5);
+    }
+
+    void testPoolServesRepeatsFromCache(void) {
+        std::atomic<bool> haltflag(false);
+        work_queue<int> q(haltflag, SIZE_MAX, 10);
+        result_cache<uint64_t, int> cache(1000);
+
+        std::atomic<int> computed(0), delivered(0), sum(0);
+        {
+            work_pool<int> pool(q, 4, memoizing_handler<int, int>(cache,
+                [](const int & item){ return uint64_t(item % 10); },
+                [&](const int & item){ computed++; return (item % 10) * 2; },
+                [&](std::unique_ptr<int>, const int & result){ sum += result; delivered++; }));
+
+            for (int i = 0; i < 200; i++)
+                q.enqueue(std::make_unique<int>(i));
+
+            while (delivered < 200)
+                std::this_thread::sleep_for(1ms);
+            haltflag = true;
+        }
+
+        TS_ASSERT_EQUALS(computed, 10);
+        TS_ASSERT_EQUALS(sum, 20 * (0 + 2 + 4 + 6 + 8 + 10 + 12 + 14 + 16 + 18));
+        TS_ASSERT_EQUALS(cache.snapshot().misses, 10);
+    }
+
+};
@@ -0,0 +1,88 @@
+#ifndef SEJF_STORAGE_H
+#define SEJF_STORAGE_H
+
+#include <map>
+#include <memory>
+#include <utility>
+
+/*!
+ * cost_estimator - trait giving the expected service time of a work item, in units of the caller's choosing.
+ * The primary template calls T::expected_cost(); specialize it for types that carry their cost elsewhere, e.g.
+ *
+ *     template <> struct cost_estimator<request> {
+ *         double operator()(const request & r) const { return r.size; }
+ *     };
+ */
+template <class T>
+struct cost_estimator
+{
+    double operator()(const T & work_item) const { return work_item.expected_cost(); }
+};
+
+/*!
+ * sejf_storage - work_queue storage policy serving the shortest expected job first.
+ *
+ * Items are ordered by key = aging * (virtual time at arrival) + expected cost, where virtual time is the
+ * total expected cost of the items served so far.  With aging 0 this is plain shortest-job-first, which
+ * can starve large items under sustained load; with aging a > 0 an item of cost C is overtaken by later
+ * arrivals only until C / a worth of work has been served since it arrived.  Ties are served in arrival order.
+ *
+ * push, pop and drop are O(log n).  When the queue is saturated the item that would be served last is dropped.
+ *
+ * use as work_queue<T, sejf_storage<T> >.
+ */
+template <class T, class Estimator = cost_estimator<T> >
+class sejf_storage
+{
+public:
+
+    explicit sejf_storage(double aging = 1.0, Estimator estimator = Estimator())
+        : aging_rate(aging)
+        , estimate(std::move(estimator))
+        , virtual_time(0)
+        , items()
+    { }
+
+    bool empty() const { return items.empty(); }
+    size_t size() const { return items.size(); }
+
+    void push(std::unique_ptr<T> work_item) {
+        const double cost = estimate(*work_item);
+        items.emplace(aging_rate * virtual_time + cost, entry{ cost, std::move(work_item) });
+    }
+
+    std::unique_ptr<T> pop() {
+        auto first = items.begin();
+        virtual_time += first->second.cost;
+        std::unique_ptr<T> val = std::move(first->second.work_item);
+        items.erase(first);
+        return val;
+    }
+
+    // drops the item that would be served last.
+    std::unique_ptr<T> drop() {
+        auto last = std::prev(items.end());
+        std::unique_ptr<T> val = std::move(last->second.work_item);
+        items.erase(last);
+        return val;
+    }
+
+    double getAging() const { return aging_rate; }
+    void setAging(double value) { aging_rate = value; }
+
+private:
+
+    struct entry {
+        double cost;
+        std::unique_ptr<T> work_item;
+    };
+
+    double aging_rate;
+    Estimator estimate;
+
+    double virtual_time;
+
+    std::multimap<double, entry> items;
+};
+
+#endif // SEJF_STORAGE_H
@@ -0,0 +1,84 @@
+#include <cxxtest/TestSuite.h>
+#include <iostream>
+#include "work_queue.h"
+#include "sejf_storage.h"
+
+
+class sejf_storage_test : public CxxTest::TestSuite
+{
+public:
+
+    struct job {
+        int id;
+        double size;
+        double expected_cost() const { return size; }
+    };
+
+    std::unique_ptr<job> make_job(int id, double size) {
+        return std::unique_ptr<job>(new job{ id, size });
+    }
+
+    void testShortestFirst(void) {
+        sejf_storage<job> storage(0.0);
+
+        storage.push(make_job(1, 30));
+        storage.push(make_job(2, 10));
+        storage.push(make_job(3, 20));
+        storage.push(make_job(4, 10));
+
+        TS_ASSERT_EQUALS(storage.size(), 4);
+
+        TS_TRACE("equal costs are served in arrival order");
+        TS_ASSERT_EQUALS(storage.pop()->id, 2);
+        TS_ASSERT_EQUALS(storage.pop()->id, 4);
+        TS_ASSERT_EQUALS(storage.pop()->id, 3);
+        TS_ASSERT_EQUALS(storage.pop()->id, 1);
+        TS_ASSERT(storage.empty());
+    }
+
+    void testAgingPreventsStarvation(void) {
+        TS_TRACE("a stream of small jobs must not hold a large job back for more than its cost in served work");
+        sejf_storage<job> storage(1.0);
+
+        storage.push(make_job(0, 100));
+
+        int served_before_large = 0;
+        for (int i = 1; i < 1000; i++) {
+            storage.push(make_job(i, 1));
+            if (storage.pop()->id == 0) break;
+            served_before_large++;
+        }
+
+        TS_ASSERT(served_before_large > 0);
+        TS_ASSERT_LESS_THAN_EQUALS(served_before_large, 100);
+    }
+
+    void testPureSjfStarves(void) {
+        sejf_storage<job> storage(0.0);
+
+        storage.push(make_job(0, 100));
+        for (int i = 1; i < 1000; i++) {
+            storage.push(make_job(i, 1));
+            TS_ASSERT_DIFFERS(storage.pop()->id, 0);
+        }
+    }
+
+    void testDropRemovesLastToBeServed(void) {
+        std::atomic<bool> haltflag(false);
+        work_queue<job, sejf_storage<job> > q(haltflag, 3, 100, sejf_storage<job>(0.0));
+
+        q.enqueue(make_job(1, 5));
+        q.enqueue(make_job(2, 50));
+        q.enqueue(make_job(3, 1));
+        q.enqueue(make_job(4, 2));
+
+        TS_ASSERT_EQUALS(q.size(), 3);
+        TS_ASSERT_EQUALS(q.dropped(), 1);
+
+        TS_ASSERT_EQUALS(q.dequeue()->id, 3);
+        TS_ASSERT_EQUALS(q.dequeue()->id, 4);
+        TS_ASSERT_EQUALS(q.dequeue()->id, 1);
+        TS_ASSERT_EQUALS(q.size(), 0);
+    }
+
+};
@@ -0,0 +1,106 @@
+#ifndef SHARD_SCATTER_H
+#define SHARD_SCATTER_H
+
+#include <algorithm>
+#include <memory>
+#include <vector>
+
+#include "work_queue.h"
+
+/*!
+ * shard_scatter - enqueues a batch of work items across many shard queues, taking each shard's lock once.
+ *
+ * Enqueueing a batch item by item costs one lock and one notification per item.  scatter() instead groups
+ * the batch by destination shard with a counting sort: a first pass computes and counts the destinations, and
+ * a second moves each item into its shard's buffer, reserved to exactly its count.  Then each touched shard gets
+ * one bulk enqueue, so one lock and one notification per shard.
+ *
+ * The buffers are kept between calls, so once warmed up a scatter allocates nothing.  So a shard_scatter
+ * belongs to one producer thread; the shard queues themselves may be shared by any number of them.
+ *
+ * Queue is the shard type.  Its bulk enqueue must leave the items it refuses in the vector and return the
+ * number of queued items it dropped to make room, as work_queue's does.
+ */
+template <class T, class Queue = work_queue<T> >
+class shard_scatter
+{
+public:
+
+    /*!
+     * shard_counts - the outcome of one scatter() for one shard.
+     */
+    struct shard_counts {
+        size_t accepted;    // items of the batch the shard queued
+        size_t dropped;     // queued items the shard dropped to make room for them (older items, under fifo)
+        size_t refused;     // items the shard didn't take (halting, or over its latency budget), back in the batch
+    };
+
+    /*!
+     * \brief shard_scatter scatters to the given shards, which must outlive it.
+     */
+    explicit shard_scatter(std::vector<Queue *> shard_queues)
+        : shards(std::move(shard_queues))
+        , destinations()
+        , counts(shards.size())
+        , buffers(shards.size())
+        , outcome(shards.size())
+    { }
+
+    /*!
+     * \brief scatter enqueues the non-empty items of batch, each to shard partition(item) % shard_count().
+     *        batch is left holding only the items a shard refused, grouped by shard.
+     * \return the counts per shard, indexed like the shards; valid until the next scatter.
+     */
+    template <class Partition>
+    const std::vector<shard_counts> & scatter(std::vector<std::unique_ptr<T> > & batch, Partition partition)
+    {
+        const size_t n_shards = shards.size();
+        std::fill(counts.begin(), counts.end(), 0);
+        std::fill(outcome.begin(), outcome.end(), shard_counts{ 0, 0, 0 });
+
+        // count: where each item goes, and how many go to each shard.
+        destinations.resize(batch.size());
+        for (size_t i = 0; i < batch.size(); i++) {
+            if (!batch[i]) continue;
+            destinations[i] = static_cast<size_t>(partition(*batch[i])) % n_shards;
+            counts[destinations[i]]++;
+        }
+
+        // distribute into buffers of exactly the right size.
+        for (size_t s = 0; s < n_shards; s++) {
+            buffers[s].clear();
+            buffers[s].reserve(counts[s]);
+        }
+        for (size_t i = 0; i < batch.size(); i++)
+            if (batch[i]) buffers[destinations[i]].push_back(std::move(batch[i]));
+
+        // one bulk enqueue per touched shard; what a shard refuses goes back to the batch.
+        batch.clear();
+        for (size_t s = 0; s < n_shards; s++) {
+            if (counts[s] == 0) continue;
+
+            outcome[s].dropped = shards[s]->enqueue(buffers[s]);
+            for (auto & work_item: buffers[s]) {
+                if (!work_item) continue;
+                outcome[s].refused++;
+                batch.push_back(std::move(work_item));
+            }
+            outcome[s].accepted = counts[s] - outcome[s].refused;
+            buffers[s].clear();
+        }
+        return outcome;
+    }
+
+    size_t shard_count() const { return shards.size(); }
+
+private:
+
+    std::vector<Queue *> shards;
+
+    std::vector<size_t> destinations;   // shard of each batch item, for the pass after counting
+    std::vector<size_t> counts;
+    std::vector<std::vector<std::unique_ptr<T> > > buffers;
+    std::vector<shard_counts> outcome;
+};
+
+#endif // SHARD_SCATTER_H
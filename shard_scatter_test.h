@@ -0,0 +1,60 @@
+#include <cxxtest/TestSuite.h>
+#include <iostream>
+#include "shard_scatter.h"
+
+
+class shard_scatter_test : public CxxTest::TestSuite
+{
+public:
+
+    void testItemsReachTheirShards(void) {
+        std::atomic<bool> haltflag(false);
+        work_queue<int> a(haltflag, SIZE_MAX, 10), b(haltflag, SIZE_MAX, 10), c(haltflag, SIZE_MAX, 10);
+        shard_scatter<int> scatter({ &a, &b, &c });
+
+        std::vector<std::unique_ptr<int> > batch;
+        for (int i = 0; i < 10; i++)
+            batch.push_back(std::make_unique<int>(i));
+        batch.push_back(std::unique_ptr<int>());
+
+        TS_TRACE("shard 2 is never touched; items keep their order within a shard");
+        const auto & counts = scatter.scatter(batch, [](int i){ return i % 2; });
+        TS_ASSERT(batch.empty());
+        TS_ASSERT_EQUALS(counts[0].accepted, 5);
+        TS_ASSERT_EQUALS(counts[1].accepted, 5);
+        TS_ASSERT_EQUALS(counts[2].accepted, 0);
+        TS_ASSERT_EQUALS(c.size(), 0);
+        for (int i = 0; i < 10; i += 2) {
+            TS_ASSERT_EQUALS(*a.dequeue(), i);
+            TS_ASSERT_EQUALS(*b.dequeue(), i + 1);
+        }
+    }
+
+    void testPerShardDroppedAndRefused(void) {
+        std::atomic<bool> haltflag(false), other_halt(false);
+        work_queue<int> bounded(haltflag, 2, 10), halting(other_halt, SIZE_MAX, 10);
+        shard_scatter<int> scatter({ &bounded, &halting });
+
+        bounded.enqueue(std::make_unique<int>(-1));
+        other_halt = true;
+
+        std::vector<std::unique_ptr<int> > batch;
+        for (int i = 0; i < 6; i++)
+            batch.push_back(std::make_unique<int>(i));
+        const auto & counts = scatter.scatter(batch, [](int i){ return i < 3 ? 0 : 1; });
+
+        TS_TRACE("the bounded shard took 3 items, dropping its oldest 2 to fit them");
+        TS_ASSERT_EQUALS(counts[0].accepted, 3);
+        TS_ASSERT_EQUALS(counts[0].dropped, 2);
+        TS_ASSERT_EQUALS(counts[0].refused, 0);
+        TS_ASSERT_EQUALS(bounded.size(), 2);
+        TS_ASSERT_EQUALS(*bounded.dequeue(), 1);
+
+        TS_TRACE("the halting shard refused its items, which are handed back");
+        TS_ASSERT_EQUALS(counts[1].accepted, 0);
+        TS_ASSERT_EQUALS(counts[1].refused, 3);
+        TS_ASSERT_EQUALS(batch.size(), 3);
+        TS_ASSERT_EQUALS(*batch[0], 3);
+    }
+
+};
@@ -0,0 +1,279 @@
+#ifndef SHM_STORAGE_H
+#define SHM_STORAGE_H
+
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <system_error>
+#include <type_traits>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/*!
+ * shm_storage - a work_queue storage policy keeping the queued items in a memfd, so that a running queue's
+ * backlog can be handed to another process without copying or serializing it (hot restart).
+ *
+ * The memfd holds a header followed by a ring of capacity slots; items are copied in on push and out into a
+ * fresh std::unique_ptr on pop, so T must be trivially copyable.  Dropping follows fifo_storage (oldest first).
+ * work_queue clamps its max_depth to capacity(), so a saturated queue drops its oldest item as usual.
+ * As popped items are copies, work_queue can't key per-source accounting by them: it refuses to turn it on.
+ *
+ * The file is sealed against resizing, and adopt() checks the header -- magic, version, item size and
+ * alignment, capacity against the file size, and the ring indices -- before trusting any of it.
+ *
+ * Handing over:
+ *   old process:  stop producing; set the halt flag and let in-service items finish; shm_handoff::send_fd the
+ *                 storage's fd() over a Unix socket; exit.
+ *   new process:  shm_handoff::receive_fd; shm_storage<T>::adopt the fd; construct its work_queue over it and
+ *                 carry on consuming.
+ * Only one process may use the ring at a time: the queue's mutex is not shared between processes.
+ */
+template <class T>
+class shm_storage
+{
+    static_assert(std::is_trivially_copyable<T>::value, "shm_storage copies items as raw bytes");
+
+public:
+
+    static constexpr bool copies_items = true;
+
+    /*!
+     * \brief create makes a new, empty ring of capacity items in an anonymous memfd.
+     * \throw std::system_error when the memfd can't be created, sized, sealed or mapped.
+     */
+    static shm_storage create(size_t capacity, const char * name = "work_queue") {
+        const int fd = ::memfd_create(name, MFD_CLOEXEC | MFD_ALLOW_SEALING);
+        if (fd < 0) throw std::system_error(errno, std::generic_category(), "memfd_create");
+
+        const size_t bytes = region_size(capacity);
+        if (::ftruncate(fd, bytes) != 0 || ::fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL) != 0) {
+            const int error = errno;
+            ::close(fd);
+            throw std::system_error(error, std::generic_category(), "memfd setup");
+        }
+
+        shm_storage storage(fd, bytes);
+        header & h = *storage.head;
+        h.magic = magic;
+        h.version = version;
+        h.item_size = sizeof(T);
+        h.item_align = alignof(T);
+        h.capacity = capacity;
+        h.head = 0;
+        h.tail = 0;
+        return storage;
+    }
+
+    /*!
+     * \brief adopt maps a ring created by create(), typically received from another process, taking ownership of fd.
+     * \throw std::runtime_error when the header doesn't describe a valid ring of T; std::system_error on mapping errors.
+     */
+    static shm_storage adopt(int fd) {
+        struct stat st;
+        if (::fstat(fd, &st) != 0) {
+            const int error = errno;
+            ::close(fd);
+            throw std::system_error(error, std::generic_category(), "fstat");
+        }
+        if (static_cast<size_t>(st.st_size) < sizeof(header)) {
+            ::close(fd);
+            throw std::runtime_error("shm_storage: file too small for a header");
+        }
+
+        shm_storage storage(fd, st.st_size);
+        const header & h = *storage.head;
+        if (h.magic != magic || h.version != version)
+            throw std::runtime_error("shm_storage: not a work_queue ring");
+        if (h.item_size != sizeof(T) || h.item_align != alignof(T))
+            throw std::runtime_error("shm_storage: ring holds a different item type");
+        if (h.capacity == 0 || region_size(h.capacity) != storage.bytes)
+            throw std::runtime_error("shm_storage: capacity doesn't match the file size");
+        if (h.tail < h.head || h.tail - h.head > h.capacity)
+            throw std::runtime_error("shm_storage: corrupt ring indices");
+        return storage;
+    }
+
+    shm_storage(shm_storage && other) noexcept
+        : fd_(other.fd_), bytes(other.bytes), head(other.head), slots(other.slots)
+    {
+        other.fd_ = -1;
+        other.head = nullptr;
+    }
+
+    shm_storage & operator=(shm_storage && other) noexcept {
+        if (this != &other) {
+            release();
+            fd_ = other.fd_;
+            bytes = other.bytes;
+            head = other.head;
+            slots = other.slots;
+            other.fd_ = -1;
+            other.head = nullptr;
+        }
+        return *this;
+    }
+
+    shm_storage(const shm_storage &) = delete;
+    shm_storage & operator=(const shm_storage &) = delete;
+
+    ~shm_storage() { release(); }
+
+    /*!
+     * \brief fd returns the memfd to pass to the next process; it stays owned by this storage.
+     */
+    int fd() const { return fd_; }
+
+    size_t capacity() const { return head->capacity; }
+
+    bool empty() const { return head->tail == head->head; }
+    size_t size() const { return head->tail - head->head; }
+
+    // work_queue's bound keeps the ring from filling; used on its own, a full ring overwrites its oldest item.
+    void push(std::unique_ptr<T> work_item) {
+        if (size() >= capacity()) head->head++;
+        std::memcpy(slot(head->tail), work_item.get(), sizeof(T));
+        head->tail++;
+    }
+
+    std::unique_ptr<T> pop() {
+        std::unique_ptr<T> val(new T);
+        std::memcpy(val.get(), slot(head->head), sizeof(T));
+        head->head++;
+        return val;
+    }
+
+    // drops the oldest item.
+    std::unique_ptr<T> drop() { return pop(); }
+
+private:
+
+    struct header {
+        uint32_t magic;
+        uint32_t version;
+        uint64_t item_size;
+        uint64_t item_align;
+        uint64_t capacity;
+        uint64_t head;      // index of the oldest item; indices only grow, slot = index % capacity
+        uint64_t tail;      // index of the next push
+    };
+
+    static constexpr uint32_t magic = 0x57515348;   // "WQSH"
+    static constexpr uint32_t version = 1;
+
+    static size_t slots_offset() {
+        const size_t align = alignof(T) > alignof(header) ? alignof(T) : alignof(header);
+        return (sizeof(header) + align - 1) / align * align;
+    }
+
+    static size_t region_size(size_t capacity) { return slots_offset() + capacity * sizeof(T); }
+
+    shm_storage(int fd, size_t size) : fd_(fd), bytes(size), head(nullptr), slots(nullptr) {
+        void * base = ::mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (base == MAP_FAILED) {
+            const int error = errno;
+            ::close(fd);
+            fd_ = -1;
+            throw std::system_error(error, std::generic_category(), "mmap");
+        }
+        head = static_cast<header *>(base);
+        slots = static_cast<char *>(base) + slots_offset();
+    }
+
+    void * slot(uint64_t index) const { return slots + (index % head->capacity) * sizeof(T); }
+
+    void release() {
+        if (head) ::munmap(head, bytes);
+        if (fd_ >= 0) ::close(fd_);
+        head = nullptr;
+        fd_ = -1;
+    }
+
+    int fd_;
+    size_t bytes;
+    header * head;
+    char * slots;
+};
+
+/*!
+ * shm_handoff - passing an open file descriptor to another process over a connected Unix socket (SCM_RIGHTS).
+ */
+namespace shm_handoff {
+
+    /*!
+     * \brief send_fd sends a duplicate of fd; the caller keeps its own.  Returns false on failure (see errno).
+     */
+    inline bool send_fd(int socket, int fd) {
+        char byte = 'q';
+        iovec io{ &byte, 1 };
+
+        union {
+            cmsghdr align;
+            char buffer[CMSG_SPACE(sizeof(int))];
+        } control;
+        std::memset(&control, 0, sizeof(control));
+
+        msghdr msg;
+        std::memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = &io;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control.buffer;
+        msg.msg_controllen = sizeof(control.buffer);
+
+        cmsghdr * c = CMSG_FIRSTHDR(&msg);
+        c->cmsg_level = SOL_SOCKET;
+        c->cmsg_type = SCM_RIGHTS;
+        c->cmsg_len = CMSG_LEN(sizeof(int));
+        std::memcpy(CMSG_DATA(c), &fd, sizeof(int));
+
+        ssize_t sent;
+        do {
+            sent = ::sendmsg(socket, &msg, MSG_NOSIGNAL);
+        } while (sent < 0 && errno == EINTR);
+        return sent == 1;
+    }
+
+    /*!
+     * \brief receive_fd blocks for a descriptor sent by send_fd.
+     * \return the new descriptor, or -1 if the peer closed the socket or sent none.
+     */
+    inline int receive_fd(int socket) {
+        char byte;
+        iovec io{ &byte, 1 };
+
+        union {
+            cmsghdr align;
+            char buffer[CMSG_SPACE(sizeof(int))];
+        } control;
+
+        msghdr msg;
+        std::memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = &io;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control.buffer;
+        msg.msg_controllen = sizeof(control.buffer);
+
+        ssize_t got;
+        do {
+            got = ::recvmsg(socket, &msg, MSG_CMSG_CLOEXEC);
+        } while (got < 0 && errno == EINTR);
+        if (got != 1) return -1;
+
+        for (cmsghdr * c = CMSG_FIRSTHDR(&msg); c; c = CMSG_NXTHDR(&msg, c)) {
+            if (c->cmsg_level == SOL_SOCKET && c->cmsg_type == SCM_RIGHTS) {
+                int fd;
+                std::memcpy(&fd, CMSG_DATA(c), sizeof(int));
+                return fd;
+            }
+        }
+        return -1;
+    }
+
+} // namespace shm_handoff
+
+#endif // SHM_STORAGE_H
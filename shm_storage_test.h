@@ -0,0 +1,126 @@
+#include <cxxtest/TestSuite.h>
+#include <iostream>
+#include <cstdlib>
+#include <sys/wait.h>
+#include "work_queue.h"
+#include "shm_storage.h"
+
+
+class shm_storage_test : public CxxTest::TestSuite
+{
+public:
+
+    struct order {
+        uint64_t id;
+        double amount;
+    };
+
+    typedef work_queue<order, shm_storage<order> > shm_queue;
+
+    void testQueueOverSharedMemory(void) {
+        std::atomic<bool> haltflag(false);
+        shm_queue q(haltflag, 4, 10, shm_storage<order>::create(4));
+
+        for (uint64_t i = 1; i <= 6; i++)
+            q.enqueue(std::unique_ptr<order>(new order{ i, i * 1.5 }));
+
+        TS_TRACE("max_depth equals the ring's capacity, so the two oldest are dropped rather than overflowing");
+        TS_ASSERT_EQUALS(q.size(), 4);
+        TS_ASSERT_EQUALS(q.dropped(), 2);
+        std::unique_ptr<order> first = q.dequeue();
+        TS_ASSERT_EQUALS(first->id, 3);
+        TS_ASSERT_EQUALS(first->amount, 4.5);
+    }
+
+    void testDefaultBoundIsTheCapacity(void) {
+        std::atomic<bool> haltflag(false);
+        shm_queue q(haltflag, SIZE_MAX, 10, shm_storage<order>::create(3));
+
+        TS_TRACE("the queue's bound is clamped to the ring: saturation drops the oldest");
+        TS_ASSERT_EQUALS(q.getMax(), 3);
+        for (uint64_t i = 1; i <= 5; i++)
+            q.enqueue(std::unique_ptr<order>(new order{ i, 0 }));
+        TS_ASSERT_EQUALS(q.size(), 3);
+        TS_ASSERT_EQUALS(q.dropped(), 2);
+        TS_ASSERT_EQUALS(q.dequeue()->id, 3);
+
+        TS_TRACE("popped items are copies, so per-source accounting can't follow them");
+        TS_ASSERT(!q.setSourceAccounting(true));
+        TS_ASSERT(q.top_sources(1).empty());
+    }
+
+    void testHandOverToAnotherProcess(void) {
+        int sockets[2];
+        TS_ASSERT_EQUALS(::socketpair(AF_UNIX, SOCK_STREAM, 0, sockets), 0);
+
+        const pid_t successor = fork();
+        if (successor == 0) {
+            // the new process: adopt the ring and consume what the old one left, in order.
+            ::close(sockets[0]);
+            int status = 1;
+            try {
+                const int fd = shm_handoff::receive_fd(sockets[1]);
+                std::atomic<bool> halt(false);
+                shm_queue q(halt, 1000, 10, shm_storage<order>::adopt(fd));
+                status = (q.size() == 70) ? 0 : 2;
+                for (uint64_t expected = 31; expected <= 100 && status == 0; expected++)
+                    if (q.dequeue()->id != expected) status = 3;
+            } catch (...) {
+                status = 4;
+            }
+            _exit(status);
+        }
+        ::close(sockets[1]);
+
+        {
+            std::atomic<bool> haltflag(false);
+            shm_storage<order> storage = shm_storage<order>::create(1000);
+            const int fd = storage.fd();
+            shm_queue q(haltflag, 1000, 10, std::move(storage));
+
+            for (uint64_t i = 1; i <= 100; i++)
+                q.enqueue(std::unique_ptr<order>(new order{ i, 0.0 }));
+            for (uint64_t i = 1; i <= 30; i++)
+                TS_ASSERT_EQUALS(q.dequeue()->id, i);
+
+            TS_TRACE("the old process halts its queue and hands the ring over, then goes away");
+            haltflag = true;
+            TS_ASSERT(shm_handoff::send_fd(sockets[0], fd));
+        }
+        ::close(sockets[0]);
+
+        int status = -1;
+        TS_ASSERT_EQUALS(waitpid(successor, &status, 0), successor);
+        TS_ASSERT(WIFEXITED(status));
+        TS_ASSERT_EQUALS(WEXITSTATUS(status), 0);
+    }
+
+    void testAdoptValidatesHeader(void) {
+        shm_storage<order> storage = shm_storage<order>::create(8);
+
+        TS_TRACE("a ring of a different item type is refused");
+        bool refused = false;
+        try {
+            shm_storage<uint32_t>::adopt(::dup(storage.fd()));
+        } catch (std::runtime_error &) {
+            refused = true;
+        }
+        TS_ASSERT(refused);
+
+        TS_TRACE("so is a file that isn't a ring at all");
+        char tmpl[] = "/tmp/shm_storage_test.XXXXXX";
+        const int other = mkstemp(tmpl);
+        ::unlink(tmpl);
+        TS_ASSERT_EQUALS(::write(other, "not a work queue ring, just some bytes in a file", 48), 48);
+        refused = false;
+        try {
+            shm_storage<order>::adopt(other);
+        } catch (std::runtime_error &) {
+            refused = true;
+        }
+        TS_ASSERT(refused);
+
+        TS_ASSERT_EQUALS(shm_storage<order>::adopt(::dup(storage.fd())).capacity(), 8);
+    }
+
+};
@@ -0,0 +1,408 @@
+#ifndef SIM_SYNC_H
+#define SIM_SYNC_H
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+using namespace std::chrono_literals;
+
+/*!
+ * sim_scheduler - a deterministic, virtual-time scheduler for simulated threads.
+ *
+ * Each simulated thread runs on an OS thread of its own, but only one of them runs at a time: a thread runs
+ * until it blocks (on a sim_mutex or sim_condition_variable) or sleeps in virtual time, and the scheduler then
+ * resumes the runnable thread with the earliest virtual wake time, ties going to the thread that became runnable
+ * first.  Virtual time only advances when every thread is waiting, so the run depends on nothing but the
+ * simulated threads' code: a scenario replays identically, with none of the OS scheduler's noise.
+ *
+ * Code runs in zero virtual time except for sleep_for and timed waits; wakeup_latency models the cost of waking
+ * a blocked thread, which is charged from the notify to the moment the woken thread runs.
+ *
+ * A run in which every thread is blocked with no timeout pending is a deadlock: the blocked threads are unwound
+ * with an exception, and run() throws std::runtime_error.
+ */
+class sim_scheduler
+{
+public:
+
+    typedef std::chrono::nanoseconds duration;
+
+    explicit sim_scheduler(duration wakeup_latency = duration(0))
+        : wakeup_latency(wakeup_latency)
+        , virtual_now(0)
+        , next_seq(0)
+        , threads()
+        , baton()
+        , baton_cv()
+        , running(none)
+        , aborted(false)
+        , failure()
+    { }
+
+    sim_scheduler(const sim_scheduler &) = delete;
+    sim_scheduler & operator=(const sim_scheduler &) = delete;
+
+    ~sim_scheduler() {
+        for (auto & t: threads)
+            if (t->os.joinable()) t->os.join();
+    }
+
+    /*!
+     * \brief spawn adds a simulated thread, to be started by run().
+     */
+    void spawn(std::function<void()> body) {
+        std::unique_ptr<sim_thread> t(new sim_thread);
+        t->body = std::move(body);
+        t->seq = next_seq++;
+        threads.push_back(std::move(t));
+    }
+
+    /*!
+     * \brief run runs the spawned threads to completion in virtual time.
+     *        Rethrows the first exception a thread let escape; throws std::runtime_error on deadlock.
+     */
+    void run() {
+        for (size_t i = 0; i < threads.size(); i++)
+            threads[i]->os = std::thread(&sim_scheduler::thread_main, this, i);
+
+        for (;;) {
+            std::unique_lock<std::mutex> l(baton);
+            baton_cv.wait(l, [&]{ return running == none; });
+
+            size_t next = pick();
+            if (next == none) {
+                if (all_done()) break;
+                // every thread is blocked for good: unwind them one at a time.
+                aborted = true;
+                next = first_blocked();
+            }
+
+            sim_thread & t = *threads[next];
+            if (t.state == blocked && !aborted) {
+                t.woken = false;    // its deadline passed
+                t.state = runnable;
+            }
+            if (t.wake_at > virtual_now) virtual_now = t.wake_at;
+            running = next;
+            t.turn.notify_one();
+        }
+
+        for (auto & t: threads) t->os.join();
+        if (failure) std::rethrow_exception(failure);
+        if (aborted) throw std::runtime_error("sim_scheduler: deadlock, every thread blocked with no timeout");
+    }
+
+    /*!
+     * \brief now returns the virtual time elapsed since the start of the run.
+     */
+    duration now() const { return virtual_now; }
+
+    /*!
+     * \brief current returns the scheduler of the calling simulated thread, or nullptr outside one.
+     */
+    static sim_scheduler * current() { return tls().scheduler; }
+
+    /*!
+     * \brief sleep_for lets virtual time pass for the calling simulated thread, e.g. to model service time.
+     */
+    void sleep_for(duration d) {
+        sim_thread & t = *threads[self()];
+        t.state = runnable;
+        t.wake_at = virtual_now + d;
+        t.seq = next_seq++;
+        yield();
+    }
+
+    // the interface used by sim_mutex and sim_condition_variable.
+
+    size_t self() const { return tls().index; }
+
+    // parks the calling thread until wake(self()) or, when deadline isn't null, until then.
+    // Returns whether it was woken rather than timed out.
+    bool block(const duration * deadline) {
+        sim_thread & t = *threads[self()];
+        t.state = blocked;
+        t.woken = false;
+        t.has_deadline = deadline != nullptr;
+        t.wake_at = deadline ? *deadline : duration::max();
+        t.seq = next_seq++;
+        yield();
+        if (aborted) throw unwind{};
+        return t.woken;
+    }
+
+    void wake(size_t index) {
+        sim_thread & t = *threads[index];
+        if (t.state != blocked) return;
+        t.state = runnable;
+        t.woken = true;
+        t.wake_at = virtual_now + wakeup_latency;
+        t.seq = next_seq++;
+    }
+
+private:
+
+    enum thread_state { runnable, blocked, done };
+    static constexpr size_t none = SIZE_MAX;
+
+    struct sim_thread {
+        std::function<void()> body;
+        std::thread os;
+        thread_state state = runnable;
+        duration wake_at = duration(0);
+        bool has_deadline = false;
+        bool woken = false;
+        uint64_t seq = 0;
+        std::condition_variable turn;   // signalled when the baton passes to this thread
+    };
+
+    // thrown through a deadlocked thread's stack to end it.
+    struct unwind { };
+
+    struct thread_context {
+        sim_scheduler * scheduler = nullptr;
+        size_t index = none;
+    };
+    static thread_context & tls() {
+        static thread_local thread_context context;
+        return context;
+    }
+
+    void thread_main(size_t index) {
+        tls().scheduler = this;
+        tls().index = index;
+
+        wait_turn(index);
+        if (!aborted) {
+            try {
+                threads[index]->body();
+            } catch (unwind &) {
+            } catch (...) {
+                if (!failure) failure = std::current_exception();
+            }
+        }
+
+        std::unique_lock<std::mutex> l(baton);
+        threads[index]->state = done;
+        running = none;
+        baton_cv.notify_one();
+    }
+
+    void wait_turn(size_t index) {
+        std::unique_lock<std::mutex> l(baton);
+        threads[index]->turn.wait(l, [&]{ return running == index; });
+    }
+
+    void yield() {
+        const size_t index = self();
+        std::unique_lock<std::mutex> l(baton);
+        running = none;
+        baton_cv.notify_one();
+        threads[index]->turn.wait(l, [&]{ return running == index; });
+    }
+
+    // called with baton held: the earliest thread able to run, or none.
+    size_t pick() const {
+        size_t best = none;
+        for (size_t i = 0; i < threads.size(); i++) {
+            const sim_thread & t = *threads[i];
+            if (t.state == done || (t.state == blocked && !t.has_deadline)) continue;
+            if (best == none || t.wake_at < threads[best]->wake_at ||
+                (t.wake_at == threads[best]->wake_at && t.seq < threads[best]->seq))
+                best = i;
+        }
+        return best;
+    }
+
+    size_t first_blocked() const {
+        for (size_t i = 0; i < threads.size(); i++)
+            if (threads[i]->state == blocked) return i;
+        return none;
+    }
+
+    bool all_done() const {
+        for (auto & t: threads)
+            if (t->state != done) return false;
+        return true;
+    }
+
+    const duration wakeup_latency;
+
+    duration virtual_now;
+    uint64_t next_seq;
+    std::vector<std::unique_ptr<sim_thread> > threads;
+
+    // hands the single right to run between the scheduler and the simulated threads.
+    std::mutex baton;
+    std::condition_variable baton_cv;  // the scheduler's: signalled when the running thread yields
+    size_t running;
+
+    bool aborted;
+    std::exception_ptr failure;
+};
+
+/*!
+ * sim_mutex - a mutex for simulated threads: a thread finding it locked blocks in virtual time, and unlock hands
+ * it to the waiters in FIFO order.  Uncontended locking needs no scheduler, so it may be used outside a run.
+ */
+class sim_mutex
+{
+public:
+
+    sim_mutex() : locked(false), waiters() { }
+
+    sim_mutex(const sim_mutex &) = delete;
+    sim_mutex & operator=(const sim_mutex &) = delete;
+
+    void lock() {
+        while (locked) {
+            sim_scheduler * s = sim_scheduler::current();
+            if (!s) throw std::logic_error("sim_mutex: contended outside a simulated thread");
+            waiters.push_back(s->self());
+            s->block(nullptr);
+        }
+        locked = true;
+    }
+
+    bool try_lock() {
+        if (locked) return false;
+        locked = true;
+        return true;
+    }
+
+    void unlock() {
+        locked = false;
+        if (waiters.empty()) return;
+        const size_t next = waiters.front();
+        waiters.pop_front();
+        sim_scheduler::current()->wake(next);
+    }
+
+private:
+
+    bool locked;
+    std::deque<size_t> waiters;
+};
+
+/*!
+ * sim_condition_variable - a condition variable for simulated threads, waking its waiters in FIFO order.
+ *        Timed waits time out in virtual time.  Works with any lock over a sim_mutex.
+ */
+class sim_condition_variable
+{
+public:
+
+    sim_condition_variable() : waiters() { }
+
+    sim_condition_variable(const sim_condition_variable &) = delete;
+    sim_condition_variable & operator=(const sim_condition_variable &) = delete;
+
+    template <class Lock>
+    void wait(Lock & l) {
+        sim_scheduler * s = sim_scheduler::current();
+        waiters.push_back(s->self());
+        l.unlock();
+        s->block(nullptr);
+        l.lock();
+    }
+
+    template <class Lock, class Predicate>
+    void wait(Lock & l, Predicate ready) {
+        while (!ready()) wait(l);
+    }
+
+    template <class Lock, class Rep, class Period>
+    std::cv_status wait_for(Lock & l, const std::chrono::duration<Rep, Period> & timeout) {
+        sim_scheduler * s = sim_scheduler::current();
+        return wait_until(l, s->now() + std::chrono::duration_cast<sim_scheduler::duration>(timeout));
+    }
+
+    template <class Lock, class Rep, class Period, class Predicate>
+    bool wait_for(Lock & l, const std::chrono::duration<Rep, Period> & timeout, Predicate ready) {
+        sim_scheduler * s = sim_scheduler::current();
+        const sim_scheduler::duration deadline =
+            s->now() + std::chrono::duration_cast<sim_scheduler::duration>(timeout);
+        while (!ready()) {
+            if (wait_until(l, deadline) == std::cv_status::timeout) return ready();
+        }
+        return true;
+    }
+
+    void notify_one() {
+        if (waiters.empty()) return;
+        const size_t next = waiters.front();
+        waiters.pop_front();
+        sim_scheduler::current()->wake(next);
+    }
+
+    void notify_all() {
+        while (!waiters.empty()) notify_one();
+    }
+
+private:
+
+    // deadline is in the scheduler's virtual time.
+    template <class Lock>
+    std::cv_status wait_until(Lock & l, sim_scheduler::duration deadline) {
+        sim_scheduler * s = sim_scheduler::current();
+        const size_t me = s->self();
+        waiters.push_back(me);
+        l.unlock();
+        bool woken = false;
+        try {
+            woken = s->block(&deadline);
+        } catch (...) {
+            forget(me);
+            throw;
+        }
+        if (!woken) forget(me);
+        l.lock();
+        return woken ? std::cv_status::no_timeout : std::cv_status::timeout;
+    }
+
+    void forget(size_t index) {
+        for (auto it = waiters.begin(); it != waiters.end(); ++it) {
+            if (*it == index) { waiters.erase(it); return; }
+        }
+    }
+
+    std::deque<size_t> waiters;
+};
+
+/*!
+ * sim_clock - a clock reading the calling simulated thread's virtual time (the epoch outside a run).
+ */
+struct sim_clock
+{
+    typedef sim_scheduler::duration duration;
+    typedef duration::rep rep;
+    typedef duration::period period;
+    typedef std::chrono::time_point<sim_clock> time_point;
+    static constexpr bool is_steady = true;
+
+    static time_point now() {
+        sim_scheduler * s = sim_scheduler::current();
+        return time_point(s ? s->now() : duration(0));
+    }
+};
+
+/*!
+ * sim_sync - the synchronisation policy putting a work_queue under a sim_scheduler's control; see std_sync.
+ */
+struct sim_sync
+{
+    typedef sim_mutex mutex;
+    typedef sim_condition_variable condition_variable;
+    typedef sim_clock clock;
+};
+
+#endif // SIM_SYNC_H
@@ -0,0 +1,71 @@
+#include <cxxtest/TestSuite.h>
+#include <iostream>
+#include <string>
+#include "sim_sync.h"
+
+
+class sim_sync_test : public CxxTest::TestSuite
+{
+public:
+
+    void testVirtualTimeOrdersThreads(void) {
+        sim_scheduler s;
+        std::string order;
+
+        s.spawn([&]{ s.sleep_for(30us); order += 'a'; s.sleep_for(30us); order += 'c'; });
+        s.spawn([&]{ s.sleep_for(40us); order += 'b'; });
+        s.run();
+
+        TS_ASSERT_EQUALS(order, "abc");
+        TS_ASSERT_EQUALS(s.now(), std::chrono::nanoseconds(60us));
+    }
+
+    void testConditionVariableWakesAndTimesOut(void) {
+        sim_scheduler s(std::chrono::microseconds(2));
+        sim_mutex m;
+        sim_condition_variable cv;
+        bool ready = false;
+        sim_scheduler::duration woke_at(0), timed_out_at(0);
+
+        s.spawn([&]{
+            std::unique_lock<sim_mutex> l(m);
+            TS_ASSERT(cv.wait_for(l, 1ms, [&]{ return ready; }));
+            woke_at = s.now();
+            TS_ASSERT(!cv.wait_for(l, 1ms, [&]{ return false; }));
+            timed_out_at = s.now();
+        });
+        s.spawn([&]{
+            s.sleep_for(10us);
+            std::unique_lock<sim_mutex> l(m);
+            ready = true;
+            cv.notify_one();
+        });
+        s.run();
+
+        TS_TRACE("the waiter runs one wakeup latency after the notify");
+        TS_ASSERT_EQUALS(woke_at, std::chrono::nanoseconds(12us));
+        TS_ASSERT_EQUALS(timed_out_at, woke_at + std::chrono::nanoseconds(1ms));
+    }
+
+    void testMutexBlocksInVirtualTime(void) {
+        sim_scheduler s;
+        sim_mutex m;
+        sim_scheduler::duration second_got_it(0);
+
+        s.spawn([&]{ std::unique_lock<sim_mutex> l(m); s.sleep_for(50us); });
+        s.spawn([&]{ s.sleep_for(1us); std::unique_lock<sim_mutex> l(m); second_got_it = s.now(); });
+        s.run();
+
+        TS_ASSERT_EQUALS(second_got_it, std::chrono::nanoseconds(50us));
+    }
+
+    void testDeadlockIsReported(void) {
+        sim_scheduler s;
+        sim_mutex m;
+        sim_condition_variable cv;
+
+        s.spawn([&]{ std::unique_lock<sim_mutex> l(m); cv.wait(l); });
+        TS_ASSERT_THROWS(s.run(), std::runtime_error);
+    }
+
+};
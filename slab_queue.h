@@ -0,0 +1,396 @@
+#ifndef SLAB_QUEUE_H
+#define SLAB_QUEUE_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "depth_gauge.h"
+
+using namespace std::chrono_literals;
+
+template <class T> class slab;
+
+/*!
+ * slab_deleter - returns an item to the slab it was made in; the deleter of slab_ptr.
+ */
+template <class T>
+struct slab_deleter {
+    slab<T> * owner = nullptr;
+    void operator()(T * work_item) const { owner->destroy(work_item); }
+};
+
+/*!
+ * slab_ptr - an owning handle to an item living in a slab: a std::unique_ptr whose deleter gives the slot back.
+ */
+template <class T>
+using slab_ptr = std::unique_ptr<T, slab_deleter<T> >;
+
+/*!
+ * slab - a preallocated array of item slots, addressed by 32-bit handles.
+ *
+ * A handle packs a slot index (the low index_bits) with the slot's generation, which is bumped every time the
+ * slot is freed; so a handle kept past its item's lifetime no longer matches, and get() refuses it.
+ *
+ * Free slots form a lock-free stack whose top is a single 64-bit word: the first free slot's index, and a
+ * 32-bit count of the pops so far as the ABA tag, as in work_stack.  A slot popped and pushed back while another
+ * thread's pop is pending returns under a new count, so that pop's compare-and-swap fails; the count would have
+ * to wrap 2^32 pops in that window to fool it.  The generations only tell stale handles apart.
+ *
+ * Items are constructed in place by make() and destroyed when their slab_ptr goes.  The slab must outlive
+ * every slab_ptr made from it; it does not destroy items still live when it goes.
+ */
+template <class T>
+class slab
+{
+public:
+
+    typedef uint32_t handle;
+
+    enum : uint32_t {
+        index_bits = 22,
+        generation_bits = 32 - index_bits,
+        index_mask = (1u << index_bits) - 1,
+        nil = index_mask,                       // the index of no slot
+    };
+
+    /*!
+     * \brief slab preallocates capacity slots.
+     * \throw std::length_error if capacity is beyond what index_bits can address.
+     */
+    explicit slab(size_t capacity)
+        : n_slots(capacity)
+        , cells(new cell[capacity])
+        , links(new std::atomic<uint32_t>[capacity])
+        , generations(new std::atomic<uint32_t>[capacity])
+        , free_top(pack(nil, 0))
+        , n_live(0)
+    {
+        if (capacity >= nil) throw std::length_error("slab: capacity beyond the handle's index bits");
+        // slot 0 on top, so slots are handed out in address order while the slab is fresh.
+        for (size_t i = capacity; i-- > 0; ) {
+            generations[i].store(0, std::memory_order_relaxed);
+            links[i].store(index_of(free_top.load(std::memory_order_relaxed)), std::memory_order_relaxed);
+            free_top.store(pack(static_cast<uint32_t>(i), 0), std::memory_order_relaxed);
+        }
+    }
+
+    slab(const slab &) = delete;
+    slab & operator=(const slab &) = delete;
+
+    /*!
+     * \brief make constructs an item in a free slot.
+     * \return the item, or an empty slab_ptr when every slot is in use.
+     */
+    template <class... Args>
+    slab_ptr<T> make(Args &&... args) {
+        const uint32_t index = allocate();
+        if (index == nil) return slab_ptr<T>(nullptr, slab_deleter<T>{ this });
+        try {
+            T * work_item = new (&cells[index]) T(std::forward<Args>(args)...);
+            return slab_ptr<T>(work_item, slab_deleter<T>{ this });
+        } catch (...) {
+            release(index);
+            throw;
+        }
+    }
+
+    /*!
+     * \brief detach gives up ownership of an item for its handle, to be stored in 4 bytes; adopt undoes it.
+     */
+    handle detach(slab_ptr<T> work_item) {
+        return handle_of(work_item.release());
+    }
+
+    /*!
+     * \brief adopt takes back ownership of the item a detached handle refers to.
+     * \return the item, or an empty slab_ptr if the handle is stale (its slot freed since).
+     */
+    slab_ptr<T> adopt(handle h) {
+        return slab_ptr<T>(get(h), slab_deleter<T>{ this });
+    }
+
+    /*!
+     * \brief get returns the item a handle refers to, without taking ownership; nullptr if the handle is stale.
+     */
+    T * get(handle h) const {
+        const uint32_t index = h & index_mask;
+        if (index >= n_slots || generations[index].load(std::memory_order_relaxed) != (h >> index_bits))
+            return nullptr;
+        return reinterpret_cast<T *>(&cells[index]);
+    }
+
+    /*!
+     * \brief handle_of returns the handle of a live item made by this slab.
+     */
+    handle handle_of(const T * work_item) const {
+        const uint32_t index = static_cast<uint32_t>(reinterpret_cast<const cell *>(work_item) - cells.get());
+        return index | (generations[index].load(std::memory_order_relaxed) << index_bits);
+    }
+
+    /*!
+     * \brief destroy ends a live item's lifetime and frees its slot; slab_deleter calls it.
+     */
+    void destroy(T * work_item) {
+        if (!work_item) return;
+        const uint32_t index = static_cast<uint32_t>(reinterpret_cast<cell *>(work_item) - cells.get());
+        work_item->~T();
+        release(index);
+    }
+
+    size_t capacity() const { return n_slots; }
+
+    /*!
+     * \brief live returns the number of slots in use.
+     */
+    size_t live() const { return n_live.load(std::memory_order_relaxed); }
+
+private:
+
+    typedef typename std::aligned_storage<sizeof(T), alignof(T)>::type cell;
+
+    enum : uint32_t { generation_mask = (1u << generation_bits) - 1 };
+
+    static uint64_t pack(uint32_t index, uint32_t pops) { return (uint64_t(pops) << 32) | index; }
+    static uint32_t index_of(uint64_t word) { return static_cast<uint32_t>(word); }
+    static uint32_t pops_of(uint64_t word) { return static_cast<uint32_t>(word >> 32); }
+
+    uint32_t allocate() {
+        uint64_t top = free_top.load(std::memory_order_acquire);
+        for (;;) {
+            const uint32_t index = index_of(top);
+            if (index == nil) return nil;
+            // may read a link rewritten since top was loaded; the pop count in top then fails the swap.
+            const uint32_t next = links[index].load(std::memory_order_relaxed);
+            if (free_top.compare_exchange_weak(top, pack(next, pops_of(top) + 1),
+                                               std::memory_order_acquire, std::memory_order_acquire)) {
+                n_live.fetch_add(1, std::memory_order_relaxed);
+                return index;
+            }
+        }
+    }
+
+    void release(uint32_t index) {
+        const uint32_t generation = (generations[index].load(std::memory_order_relaxed) + 1) & generation_mask;
+        generations[index].store(generation, std::memory_order_relaxed);
+
+        uint64_t top = free_top.load(std::memory_order_relaxed);
+        do {
+            links[index].store(index_of(top), std::memory_order_relaxed);
+        } while (!free_top.compare_exchange_weak(top, pack(index, pops_of(top)),
+                                                 std::memory_order_release, std::memory_order_relaxed));
+        n_live.fetch_sub(1, std::memory_order_relaxed);
+    }
+
+    const size_t n_slots;
+    std::unique_ptr<cell[]> cells;
+    std::unique_ptr<std::atomic<uint32_t>[]> links;         // next free slot's index, for free slots
+    std::unique_ptr<std::atomic<uint32_t>[]> generations;
+    std::atomic<uint64_t> free_top;                         // first free slot's index, and the pops so far
+    std::atomic<size_t> n_live;
+};
+
+/*!
+ * slab_queue - a work queue of items living in a slab, queued as 32-bit handles.
+ *
+ * Where work_queue's storage holds an 8-byte std::unique_ptr per item, this holds a 4-byte slab handle in a
+ * ring, and the items themselves sit side by side in the slab rather than wherever the heap put them.
+ * Producers make items with the slab's make() -- lock-free, outside the queue's lock -- and consumers get
+ * slab_ptrs back, which free the slot when they go.
+ *
+ * An enqueue of a plain std::unique_ptr moves the item into a free slot; if the slab is exhausted the item
+ * is dropped.  Otherwise ordering, the bound (at most the slab's capacity), dropping the oldest item when
+ * full -- every item, with max_depth 0 -- and halting all follow work_queue.
+ */
+template <class T>
+class slab_queue
+{
+public:
+
+    /*!
+     * \brief slab_queue creates a queue of items made in items, which must outlive the queue and every
+     *        item dequeued from it; halt_flag, max_depth and wait_interval_ms are as for work_queue.
+     */
+    slab_queue(std::atomic<bool> & halt_flag, slab<T> & items, size_t max_depth = SIZE_MAX,
+               int wait_interval_ms = 100)
+        : shutting_down(halt_flag)
+        , wait_interval(wait_interval_ms)
+        , store(items)
+        , max(std::min(max_depth, items.capacity()))
+        , ring(std::max<size_t>(max, 1))
+        , head(0)
+        , n_queued(0)
+        , depth()
+        , n_dropped(0)
+        , n_handled(0)
+        , m()
+        , cv()
+    { }
+
+    slab_queue(const slab_queue &) = delete;
+    slab_queue & operator=(const slab_queue &) = delete;
+
+    ~slab_queue() {
+        while (n_queued > 0)
+            store.adopt(pop_handle());      // destroys the item, freeing its slot
+    }
+
+    /*!
+     * \brief enqueue adds a work item made by the queue's slab.  Enqueues while shutting down, empty slab_ptrs,
+     *        and items made by another slab -- whose slots this queue would free into the wrong one -- are ignored.
+     */
+    void enqueue(slab_ptr<T> work_item)
+    {
+        if (shutting_down || !work_item || !made_here(work_item)) return;
+
+        const typename slab<T>::handle h = store.detach(std::move(work_item));
+        {   // locked context
+            std::unique_lock<std::mutex> l(m);
+            push_handle(h);
+        }   // end locked context
+
+        cv.notify_one();
+    }
+
+    /*!
+     * \brief enqueue moves a heap-allocated work item into the slab and adds it; it is dropped if the slab
+     *        has no free slot.
+     */
+    void enqueue(std::unique_ptr<T> work_item)
+    {
+        if (shutting_down || !work_item) return;
+
+        slab_ptr<T> in_slab = store.make(std::move(*work_item));
+        if (!in_slab) {
+            n_dropped++;
+            return;
+        }
+        enqueue(std::move(in_slab));
+    }
+
+    /*!
+     * \brief enqueue adds all the non-empty elements of bulk under a single lock; items made by another slab
+     *        are left in bulk.
+     */
+    void enqueue(std::vector<slab_ptr<T> > & bulk)
+    {
+        if (shutting_down) return;
+
+        bool pushed = false;
+        {   // locked context
+            std::unique_lock<std::mutex> l(m);
+            for (auto & work_item: bulk) {
+                if (!work_item || !made_here(work_item)) continue;
+                push_handle(store.detach(std::move(work_item)));
+                pushed = true;
+            }
+        }   // end locked context
+
+        if (pushed) cv.notify_one();
+    }
+
+    /*!
+     * \brief dequeue removes and returns the oldest work item, waiting until there is one.
+     * \return the work item, or an empty slab_ptr when shutting down.
+     */
+    slab_ptr<T> dequeue()
+    {
+        typename slab<T>::handle h;
+        {   // locked context
+            std::unique_lock<std::mutex> l(m);
+            while (n_queued == 0) {
+                if (shutting_down) return slab_ptr<T>(nullptr, slab_deleter<T>{ &store });
+                cv.wait_for(l, wait_interval * 1ms);
+            }
+            if (shutting_down) return slab_ptr<T>(nullptr, slab_deleter<T>{ &store });
+            h = pop_handle();
+            n_handled++;
+        }   // end locked context
+
+        return store.adopt(h);
+    }
+
+    /*!
+     * \brief size returns the number of queued work items (0 if shutting down).
+     */
+    size_t size() const {
+        if (shutting_down) return 0;
+        std::unique_lock<std::mutex> l(m);
+        return n_queued;
+    }
+
+    /*!
+     * \brief approx_size, empty and is_halting need no lock; see work_queue.
+     */
+    size_t approx_size() const { return shutting_down.load(std::memory_order_relaxed) ? 0 : depth.load(); }
+    bool empty() const { return approx_size() == 0; }
+    bool is_halting() const { return shutting_down.load(std::memory_order_relaxed); }
+
+    /*!
+     * \brief dropped returns the number of work items dropped so far because the queue or the slab was
+     *        full, and resets the counter to zero.
+     */
+    int dropped() { return static_cast<int>(n_dropped.exchange(0)); }
+
+    /*!
+     * \brief handled returns the number of work items dequeued so far, and resets the counter to zero.
+     */
+    int handled() { return static_cast<int>(n_handled.exchange(0)); }
+
+private:
+
+    bool made_here(const slab_ptr<T> & work_item) const { return work_item.get_deleter().owner == &store; }
+
+    // called with m held.  With max 0 the item itself is dropped.
+    void push_handle(typename slab<T>::handle h) {
+        if (n_queued >= max) {
+            n_dropped++;
+            if (n_queued == 0) {
+                store.adopt(h);
+                return;
+            }
+            store.adopt(pop_handle());     // the oldest item, freed as its slab_ptr goes
+        }
+        ring[(head + n_queued) % ring.size()] = h;
+        n_queued++;
+        depth.publish(n_queued);
+    }
+
+    // called with m held and n_queued > 0.
+    typename slab<T>::handle pop_handle() {
+        const typename slab<T>::handle h = ring[head];
+        head = (head + 1) % ring.size();
+        n_queued--;
+        depth.publish(n_queued);
+        return h;
+    }
+
+    std::atomic<bool> & shutting_down;
+
+    const int wait_interval; // units 1msec
+
+    slab<T> & store;
+
+    const size_t max;
+    std::vector<typename slab<T>::handle> ring;
+    size_t head;
+    size_t n_queued;
+    depth_gauge depth;
+
+    std::atomic<uint64_t> n_dropped;
+    std::atomic<uint64_t> n_handled;
+
+    mutable std::mutex m;
+    std::condition_variable cv;
+};
+
+#endif // SLAB_QUEUE_H
@@ -0,0 +1,142 @@
+#include <cxxtest/TestSuite.h>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+#include "slab_queue.h"
+
+
+class slab_queue_test : public CxxTest::TestSuite
+{
+public:
+
+    struct order {
+        int id;
+        std::string customer;
+        order(int id, std::string customer) : id(id), customer(std::move(customer)) { }
+    };
+
+    void testHandlesAreCompactAndGenerational(void) {
+        slab<order> items(4);
+        TS_ASSERT_EQUALS(sizeof(slab<order>::handle), 4);
+
+        slab_ptr<order> first = items.make(1, "acme");
+        TS_ASSERT_EQUALS(items.live(), 1);
+        const slab<order>::handle h = items.handle_of(first.get());
+        TS_ASSERT_EQUALS(items.get(h), first.get());
+
+        TS_TRACE("a freed slot bumps its generation, so the old handle no longer resolves");
+        first.reset();
+        TS_ASSERT_EQUALS(items.live(), 0);
+        TS_ASSERT_EQUALS(items.get(h), nullptr);
+
+        slab_ptr<order> second = items.make(2, "globex");
+        TS_ASSERT_EQUALS(items.handle_of(second.get()) & slab<order>::index_mask, h & slab<order>::index_mask);
+        TS_ASSERT_DIFFERS(items.handle_of(second.get()), h);
+
+        TS_TRACE("a slab_ptr is a std::unique_ptr; detach and adopt round-trip it through a handle");
+        std::unique_ptr<order, slab_deleter<order> > owned = std::move(second);
+        const slab<order>::handle detached = items.detach(std::move(owned));
+        TS_ASSERT_EQUALS(items.live(), 1);
+        slab_ptr<order> back = items.adopt(detached);
+        TS_ASSERT_EQUALS(back->customer, "globex");
+    }
+
+    void testExhaustedSlab(void) {
+        slab<order> items(2);
+        slab_ptr<order> a = items.make(1, "a");
+        slab_ptr<order> b = items.make(2, "b");
+        TS_ASSERT(!items.make(3, "c"));
+
+        std::atomic<bool> haltflag(false);
+        slab_queue<order> q(haltflag, items, SIZE_MAX, 10);
+        q.enqueue(std::unique_ptr<order>(new order(4, "d")));
+        TS_ASSERT_EQUALS(q.size(), 0);
+        TS_ASSERT_EQUALS(q.dropped(), 1);
+    }
+
+    void testFifoAndDropOldest(void) {
+        slab<order> items(16);
+        std::atomic<bool> haltflag(false);
+        {
+            slab_queue<order> q(haltflag, items, 3, 10);
+
+            q.enqueue(items.make(0, "a"));
+            q.enqueue(std::unique_ptr<order>(new order(1, "b")));
+            std::vector<slab_ptr<order> > bulk;
+            bulk.push_back(items.make(2, "c"));
+            bulk.push_back(slab_ptr<order>());
+            bulk.push_back(items.make(3, "d"));
+            q.enqueue(bulk);
+
+            TS_TRACE("the oldest item was dropped, and its slot freed with it");
+            TS_ASSERT_EQUALS(q.size(), 3);
+            TS_ASSERT_EQUALS(q.dropped(), 1);
+            TS_ASSERT_EQUALS(items.live(), 3);
+
+            slab_ptr<order> o = q.dequeue();
+            TS_ASSERT_EQUALS(o->id, 1);
+            TS_ASSERT_EQUALS(o->customer, "b");
+            o.reset();
+            TS_ASSERT_EQUALS(q.dequeue()->id, 2);
+            TS_ASSERT_EQUALS(q.handled(), 2);
+            TS_ASSERT_EQUALS(items.live(), 1);
+        }
+        TS_TRACE("the queue frees what it still holds when it goes");
+        TS_ASSERT_EQUALS(items.live(), 0);
+    }
+
+    void testZeroDepthAndForeignItems(void) {
+        slab<order> items(4), elsewhere(4);
+        std::atomic<bool> haltflag(false);
+        slab_queue<order> q(haltflag, items, 0, 10);
+
+        TS_TRACE("max_depth 0, as for work_queue: every item is dropped, its slot freed");
+        q.enqueue(items.make(0, "a"));
+        q.enqueue(std::unique_ptr<order>(new order(1, "b")));
+        TS_ASSERT_EQUALS(q.size(), 0);
+        TS_ASSERT_EQUALS(q.dropped(), 2);
+        TS_ASSERT_EQUALS(items.live(), 0);
+
+        TS_TRACE("an item made by another slab is refused, and stays with the caller in a bulk enqueue");
+        std::vector<slab_ptr<order> > bulk;
+        bulk.push_back(elsewhere.make(2, "c"));
+        q.enqueue(bulk);
+        TS_ASSERT(bulk[0]);
+        TS_ASSERT_EQUALS(elsewhere.live(), 1);
+        q.enqueue(std::move(bulk[0]));
+        TS_ASSERT_EQUALS(elsewhere.live(), 0);
+        TS_ASSERT_EQUALS(items.live(), 0);
+        TS_ASSERT_EQUALS(q.dropped(), 0);
+    }
+
+    void testConcurrentMakeAndFree(void) {
+        slab<order> items(64);
+        std::atomic<bool> haltflag(false);
+        slab_queue<order> q(haltflag, items, SIZE_MAX, 10);
+
+        const int n_threads = 4, per_thread = 20000;
+        std::atomic<long> sum(0);
+        std::vector<std::thread> threads;
+        for (int t = 0; t < n_threads; t++) {
+            threads.emplace_back([&, t]{
+                long mine = 0;
+                for (int i = 0; i < per_thread; i++) {
+                    slab_ptr<order> o;
+                    while (!(o = items.make(t * per_thread + i, "")))
+                        std::this_thread::yield();
+                    q.enqueue(std::move(o));
+                    mine += q.dequeue()->id;
+                }
+                sum += mine;
+            });
+        }
+        for (auto & thread: threads) thread.join();
+
+        const long n = long(n_threads) * per_thread;
+        TS_ASSERT_EQUALS(sum, n * (n - 1) / 2);
+        TS_ASSERT_EQUALS(items.live(), 0);
+        TS_ASSERT(q.empty());
+    }
+
+};
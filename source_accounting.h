@@ -0,0 +1,162 @@
+#ifndef SOURCE_ACCOUNTING_H
+#define SOURCE_ACCOUNTING_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+/*!
+ * source_tag identifies the producer of a work item: a user-supplied tag, or by default a hash of the
+ * enqueueing thread's id (see this_thread_source).
+ */
+typedef uint64_t source_tag;
+
+inline source_tag this_thread_source()
+{
+    return std::hash<std::thread::id>()(std::this_thread::get_id());
+}
+
+/*!
+ * source_counts - per-source totals as reported by source_accounting.
+ */
+struct source_counts {
+    source_tag source;
+    uint64_t enqueued;
+    uint64_t dropped;   // items of this source discarded because the queue was saturated
+    uint64_t dequeued;
+
+    uint64_t queued() const { return enqueued - dropped - dequeued; }
+};
+
+/*!
+ * source_accounting - counts enqueued, dropped and dequeued work items per source.
+ *
+ * Every thread updates its own block of counters, which only it writes, so updates never contend;
+ * the blocks are merged when the counts are read.  Blocks outlive their threads, so the counts of
+ * producers that have exited are kept.  Reads are meant to be rare (diagnostics, incident attribution).
+ */
+class source_accounting
+{
+public:
+
+    enum rank_by { by_enqueued, by_dropped, by_queued };
+
+    source_accounting()
+        : id(next_id()++)
+        , m()
+        , blocks()
+    { }
+
+    source_accounting(const source_accounting &) = delete;
+    source_accounting & operator=(const source_accounting &) = delete;
+
+    void enqueued(source_tag source) { local_block().add(source, &counters::enqueued); }
+    void dropped(source_tag source) { local_block().add(source, &counters::dropped); }
+    void dequeued(source_tag source) { local_block().add(source, &counters::dequeued); }
+
+    /*!
+     * \brief snapshot merges all threads' counters.
+     * \return one entry per source seen, in no particular order.
+     */
+    std::vector<source_counts> snapshot() const {
+        std::unordered_map<source_tag, counters> merged;
+        {   // locked context
+            std::unique_lock<std::mutex> l(m);
+            for (const auto & b: blocks) {
+                std::unique_lock<std::mutex> bl(b->m);
+                for (const auto & entry: b->per_source) {
+                    counters & into = merged[entry.first];
+                    into.enqueued += entry.second.enqueued;
+                    into.dropped += entry.second.dropped;
+                    into.dequeued += entry.second.dequeued;
+                }
+            }
+        }   // end locked context
+
+        std::vector<source_counts> result;
+        result.reserve(merged.size());
+        for (const auto & entry: merged)
+            result.push_back(source_counts{ entry.first, entry.second.enqueued, entry.second.dropped,
+                                            entry.second.dequeued });
+        return result;
+    }
+
+    /*!
+     * \brief top returns the n sources with the highest count of the given kind, highest first.
+     */
+    std::vector<source_counts> top(size_t n, rank_by rank = by_dropped) const {
+        std::vector<source_counts> all = snapshot();
+
+        auto key = [rank](const source_counts & c) {
+            switch (rank) {
+            case by_enqueued: return c.enqueued;
+            case by_queued:   return c.queued();
+            default:          return c.dropped;
+            }
+        };
+        std::sort(all.begin(), all.end(), [&](const source_counts & a, const source_counts & b) {
+            return key(a) != key(b) ? key(a) > key(b) : a.enqueued > b.enqueued;
+        });
+
+        if (all.size() > n) all.resize(n);
+        return all;
+    }
+
+private:
+
+    struct counters {
+        uint64_t enqueued = 0;
+        uint64_t dropped = 0;
+        uint64_t dequeued = 0;
+    };
+
+    // one per thread; the mutex is only ever contended by a concurrent snapshot.
+    struct block {
+        std::mutex m;
+        std::unordered_map<source_tag, counters> per_source;
+
+        void add(source_tag source, uint64_t counters::*field) {
+            std::unique_lock<std::mutex> l(m);
+            per_source[source].*field += 1;
+        }
+    };
+
+    static std::atomic<uint64_t> & next_id() {
+        static std::atomic<uint64_t> ids(0);
+        return ids;
+    }
+
+    // instances are looked up by id rather than address, so that a new instance at a recycled address never
+    // finds a block of a destroyed one.
+    block & local_block() {
+        thread_local std::unordered_map<uint64_t, std::weak_ptr<block> > mine;
+
+        std::weak_ptr<block> & cached = mine[id];
+        if (std::shared_ptr<block> b = cached.lock()) return *b;
+
+        // first use from this thread: forget blocks of destroyed instances, then register a new one.
+        for (auto it = mine.begin(); it != mine.end(); )
+            it = (it->first != id && it->second.expired()) ? mine.erase(it) : std::next(it);
+
+        std::shared_ptr<block> b = std::make_shared<block>();
+        {   // locked context
+            std::unique_lock<std::mutex> l(m);
+            blocks.push_back(b);
+        }   // end locked context
+        cached = b;
+        return *b;
+    }
+
+    const uint64_t id;
+
+    mutable std::mutex m;
+    std::vector<std::shared_ptr<block> > blocks;
+};
+
+#endif // SOURCE_ACCOUNTING_H
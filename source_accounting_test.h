@@ -0,0 +1,87 @@
+#include <cxxtest/TestSuite.h>
+#include <iostream>
+#include <thread>
+#include "work_queue.h"
+
+
+class source_accounting_test : public CxxTest::TestSuite
+{
+public:
+
+    void testCountsMergedAcrossThreads(void) {
+        source_accounting sources;
+
+        std::vector<std::thread> threads;
+        for (int t = 0; t < 4; t++) {
+            threads.emplace_back([&sources]{
+                for (int i = 0; i < 1000; i++) {
+                    sources.enqueued(7);
+                    if (i % 10 == 0) sources.dropped(7);
+                }
+                sources.enqueued(this_thread_source());
+            });
+        }
+        for (auto & thread: threads) thread.join();
+
+        std::vector<source_counts> all = sources.snapshot();
+        TS_ASSERT_EQUALS(all.size(), 5);
+
+        std::vector<source_counts> top = sources.top(1);
+        TS_ASSERT_EQUALS(top.size(), 1);
+        TS_ASSERT_EQUALS(top[0].source, 7);
+        TS_ASSERT_EQUALS(top[0].enqueued, 4000);
+        TS_ASSERT_EQUALS(top[0].dropped, 400);
+        TS_ASSERT_EQUALS(top[0].queued(), 3600);
+    }
+
+    void testQueueAttributesDropsToFlooder(void) {
+        std::atomic<bool> haltflag(false);
+        work_queue<int> q(haltflag, 10);
+
+        TS_TRACE("accounting is off by default");
+        q.enqueue(std::make_unique<int>(0), 1);
+        TS_ASSERT(q.top_sources(5).empty());
+        q.dequeue();
+
+        q.setSourceAccounting(true);
+
+        q.enqueue(std::make_unique<int>(1), 1);
+        q.enqueue(std::make_unique<int>(2), 1);
+
+        std::vector<std::unique_ptr<int> > flood;
+        for (int i = 0; i < 30; i++)
+            flood.push_back(std::make_unique<int>(100 + i));
+        q.enqueue(flood, 2);
+
+        TS_ASSERT_EQUALS(q.size(), 10);
+        TS_ASSERT_EQUALS(q.dropped(), 22);
+
+        std::vector<source_counts> top = q.top_sources(2);
+        TS_ASSERT_EQUALS(top.size(), 2);
+        TS_ASSERT_EQUALS(top[0].source, 2);
+        TS_ASSERT_EQUALS(top[0].dropped, 20);
+        TS_ASSERT_EQUALS(top[0].queued(), 10);
+        TS_ASSERT_EQUALS(top[1].source, 1);
+        TS_ASSERT_EQUALS(top[1].dropped, 2);
+        TS_ASSERT_EQUALS(top[1].queued(), 0);
+
+        q.dequeue();
+        top = q.top_sources(1, source_accounting::by_queued);
+        TS_ASSERT_EQUALS(top[0].source, 2);
+        TS_ASSERT_EQUALS(top[0].dequeued, 1);
+        TS_ASSERT_EQUALS(top[0].queued(), 9);
+    }
+
+    void testUntaggedEnqueueUsesThread(void) {
+        std::atomic<bool> haltflag(false);
+        work_queue<int> q(haltflag);
+        q.setSourceAccounting(true);
+
+        q.enqueue(std::make_unique<int>(1));
+
+        std::vector<source_counts> top = q.top_sources(1, source_accounting::by_enqueued);
+        TS_ASSERT_EQUALS(top.size(), 1);
+        TS_ASSERT_EQUALS(top[0].source, this_thread_source());
+    }
+
+};
@@ -0,0 +1,129 @@
+#ifndef WAIT_ESTIMATOR_H
+#define WAIT_ESTIMATOR_H
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+
+/*!
+ * wait_estimator - smoothed estimates of a queue's arrival rate, service time and consumer count, and from them
+ * a prediction of how long a newly enqueued item will wait before service starts.
+ *
+ * The queue reports events to it with its lock held: arrivals, and every change in the number of items in
+ * service (a dequeue starts service, finished() ends it).  Service time comes from Little's law applied between
+ * completions: the area under the in-service count (item-seconds of service) divided by the completions in the
+ * interval, which needs no per-item timestamps and is unbiased whether consumers are busy or idle.
+ *
+ * Every estimate is an exponentially weighted moving average; the first sample initializes it.
+ * Clock is std::chrono::steady_clock, or the Sync policy's clock under simulation.
+ */
+template <class Clock = std::chrono::steady_clock>
+class wait_estimator
+{
+public:
+
+    typedef typename Clock::time_point time_point;
+    typedef std::chrono::duration<double> seconds;
+
+    explicit wait_estimator(double smoothing = 0.05)
+        : smoothing(smoothing)
+        , arrival_gap(0)
+        , service_time(0)
+        , consumers(0)
+        , n_arrival_samples(0)
+        , n_service_samples(0)
+        , n_consumer_samples(0)
+        , arrival_seen(false)
+        , last_arrival()
+        , last_change()
+        , in_service_area(0)
+        , changes_seen(false)
+    { }
+
+    /*!
+     * \brief arrived records n items offered at once (bulk arrivals spread the gap over the n).
+     */
+    void arrived(time_point now, size_t n = 1) {
+        if (n == 0) return;
+        if (arrival_seen) {
+            const double gap = seconds(now - last_arrival).count() / n;
+            average(arrival_gap, gap, n_arrival_samples);
+        }
+        arrival_seen = true;
+        last_arrival = now;
+    }
+
+    /*!
+     * \brief started records a dequeue: in_service is the count before it, present the consumers in the queue
+     *        (in service or waiting) at the time.
+     */
+    void started(time_point now, size_t in_service, size_t present) {
+        integrate(now, in_service);
+        average(consumers, double(present), n_consumer_samples);
+    }
+
+    /*!
+     * \brief completed records a finished() call; in_service is the count before it.
+     */
+    void completed(time_point now, size_t in_service) {
+        integrate(now, in_service);
+        average(service_time, in_service_area, n_service_samples);
+        in_service_area = 0;
+    }
+
+    /*!
+     * \brief predict_wait returns how long an item enqueued behind ahead items waits for a consumer, when idle
+     *        consumers are waiting and up to limit may serve at once.  Zero until a service time is known.
+     */
+    seconds predict_wait(size_t ahead, size_t idle, size_t limit) const {
+        if (n_service_samples == 0 || ahead < idle) return seconds(0);
+        const double serving = std::max(1.0, std::min(consumers, double(limit)));
+        return seconds((ahead - idle + 1) * service_time / serving);
+    }
+
+    // arrivals per second; 0 before two arrivals.
+    double arrival_rate() const { return arrival_gap > 0 ? 1.0 / arrival_gap : 0.0; }
+
+    // completions per second of one consumer; 0 before the first completion.
+    double service_rate() const { return service_time > 0 ? 1.0 / service_time : 0.0; }
+
+    double getConsumers() const { return consumers; }
+    seconds getServiceTime() const { return seconds(service_time); }
+
+    // offered load per consumer: above 1 the queue grows without bound.
+    double utilization() const {
+        return consumers > 0 ? arrival_rate() * service_time / consumers : 0.0;
+    }
+
+private:
+
+    void average(double & estimate, double sample, size_t & n_samples) {
+        estimate = n_samples++ == 0 ? sample : estimate + smoothing * (sample - estimate);
+    }
+
+    // accumulates item-seconds in service since the last change of the in-service count.
+    void integrate(time_point now, size_t in_service) {
+        if (changes_seen) in_service_area += in_service * seconds(now - last_change).count();
+        changes_seen = true;
+        last_change = now;
+    }
+
+    const double smoothing;
+
+    double arrival_gap;     // seconds
+    double service_time;    // seconds
+    double consumers;
+
+    size_t n_arrival_samples;
+    size_t n_service_samples;
+    size_t n_consumer_samples;
+
+    bool arrival_seen;
+    time_point last_arrival;
+
+    time_point last_change;
+    double in_service_area;     // item-seconds since the last completion
+    bool changes_seen;
+};
+
+#endif // WAIT_ESTIMATOR_H
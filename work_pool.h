@@ -0,0 +1,308 @@
+#ifndef WORK_POOL_H
+#define WORK_POOL_H
+
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <thread>
+#include <vector>
+#include <mutex>
+#include <chrono>
+
+#include "work_queue.h"
+
+/*!
+ * aimd_params - tuning of an aimd_limiter.
+ */
+struct aimd_params {
+    size_t initial_limit = 4;
+    size_t min_limit = 1;
+    size_t max_limit = 256;
+    double backoff = 0.9;       // multiplicative decrease factor
+    double tolerance = 2.0;     // latency / baseline ratio considered congested
+    double smoothing = 0.1;     // ewma weight of a new latency sample
+    size_t window = 1000;       // samples after which the baseline is re-learned
+};
+
+/*!
+ * aimd_limiter - an additive-increase/multiplicative-decrease concurrency limit driven by observed latency.
+ *
+ * Each completed item reports its service latency.  While latency stays within tolerance of the baseline
+ * (the smallest latency seen over the recent window) the limit grows by one per limit's worth of completions;
+ * a sample above baseline * tolerance shrinks the limit by the backoff factor.
+ */
+class aimd_limiter
+{
+public:
+
+    using params = aimd_params;
+
+    struct stats {
+        size_t limit;
+        double latency_ewma_us;
+        double latency_baseline_us;
+        size_t n_increases;
+        size_t n_decreases;
+    };
+
+    explicit aimd_limiter(const params & p = params())
+        : cfg(clamped(p))
+        , limit(std::min(std::max(p.initial_limit, p.min_limit), p.max_limit))
+        , latency_ewma(0)
+        , baseline(0)
+        , window_min(0)
+        , n_samples(0)
+        , n_since_increase(0)
+        , n_since_decrease(0)
+        , n_increases(0)
+        , n_decreases(0)
+        , m()
+    { }
+
+    /*!
+     * \brief update feeds one observed service latency into the limiter.
+     * \return the (possibly adjusted) limit.
+     */
+    size_t update(std::chrono::microseconds latency) {
+        std::unique_lock<std::mutex> l(m);
+
+        const double sample = static_cast<double>(latency.count());
+
+        if (n_samples == 0) {
+            latency_ewma = baseline = window_min = sample;
+        } else {
+            latency_ewma += cfg.smoothing * (sample - latency_ewma);
+            window_min = std::min(window_min, sample);
+            baseline = std::min(baseline, sample);
+        }
+
+        // re-learn the baseline once per window so it can follow a permanently slower downstream.
+        if (++n_samples % cfg.window == 0) {
+            baseline = window_min;
+            window_min = sample;
+        }
+
+        // at most one decrease per limit's worth of completions: the samples still in flight when the limit
+        // dropped saw the old congestion and must not shrink it again.
+        n_since_decrease++;
+        if (sample > baseline * cfg.tolerance) {
+            if (n_since_decrease >= limit && limit > cfg.min_limit) {
+                const size_t reduced = static_cast<size_t>(limit * cfg.backoff);
+                limit = std::max(cfg.min_limit, std::min(reduced, limit - 1));
+                n_decreases++;
+                n_since_decrease = 0;
+            }
+            n_since_increase = 0;
+        } else if (++n_since_increase >= limit) {
+            if (limit < cfg.max_limit) {
+                limit++;
+                n_increases++;
+            }
+            n_since_increase = 0;
+        }
+        return limit;
+    }
+
+    size_t getLimit() const {
+        std::unique_lock<std::mutex> l(m);
+        return limit;
+    }
+
+    stats snapshot() const {
+        std::unique_lock<std::mutex> l(m);
+        return stats{ limit, latency_ewma, baseline, n_increases, n_decreases };
+    }
+
+private:
+
+    // a window of at least one sample: update() re-learns the baseline every window samples.
+    static params clamped(params p) {
+        p.window = std::max<size_t>(p.window, 1);
+        return p;
+    }
+
+    const params cfg;
+
+    size_t limit;
+
+    double latency_ewma;    // units 1usec
+    double baseline;
+    double window_min;
+
+    size_t n_samples;
+    size_t n_since_increase;
+    size_t n_since_decrease;
+    size_t n_increases;
+    size_t n_decreases;
+
+    mutable std::mutex m;
+};
+
+/*!
+ * work_pool - a fixed set of consumer threads draining a work_queue<T> into a handler.
+ * Queue is the work_queue instantiation drained, e.g. one with a non-default storage policy.
+ *
+ * The workers exit when the queue's halt flag is set.  Optionally an aimd_limiter adjusts the queue's
+ * concurrency limit from the handler's observed latency, so that surplus workers stay parked in dequeue()
+ * when the downstream the handler calls slows down.
+ *
+ * Work the handler submits (see submit) goes to its worker's run-next slot, as in Go's scheduler: the worker
+ * serves it straight after the current item, while the data the two share is still in its caches, rather than
+ * at the back of the queue on another thread.  Only the latest item submitted waits in the slot; it displaces
+ * the one before to the queue.  A worker serves at most the run-next limit of slot items in a row before it
+ * moves its slot item to the queue and takes from there, so that a pair of items submitting each other can't
+ * starve the queue.
+ */
+template <class T, class Queue = work_queue<T> >
+class work_pool
+{
+public:
+
+    using handler_type = std::function<void(std::unique_ptr<T>)>;
+
+    struct stats {
+        size_t n_workers;
+        size_t in_service;
+        bool limited;
+        aimd_limiter::stats limiter;
+        uint64_t run_next;          // items served from a run-next slot
+        uint64_t run_next_yielded;  // slot items moved to the queue on reaching the run-next limit
+    };
+
+    /*!
+     * \brief work_pool starts n_workers threads consuming from queue without a concurrency limit.
+     */
+    work_pool(Queue & queue, size_t n_workers, handler_type handler)
+        : q(queue)
+        , handle(std::move(handler))
+        , limiter()
+        , run_next_limit(8)
+        , n_run_next(0)
+        , n_run_next_yielded(0)
+        , workers()
+    {
+        start(n_workers);
+    }
+
+    /*!
+     * \brief work_pool starts n_workers threads consuming from queue, with the number of items in service
+     *        at once governed by an aimd_limiter configured by limits.
+     */
+    work_pool(Queue & queue, size_t n_workers, handler_type handler, const aimd_limiter::params & limits)
+        : q(queue)
+        , handle(std::move(handler))
+        , limiter(new aimd_limiter(limits))
+        , run_next_limit(8)
+        , n_run_next(0)
+        , n_run_next_yielded(0)
+        , workers()
+    {
+        q.setConcurrencyLimit(limiter->getLimit());
+        start(n_workers);
+    }
+
+    ~work_pool() { join(); }
+
+    /*!
+     * \brief join waits for all workers to exit; they do so once the queue's halt flag is set.
+     */
+    void join() {
+        for (auto & worker: workers)
+            if (worker.joinable()) worker.join();
+    }
+
+    /*!
+     * \brief submit queues work_item.  Called from the handler on one of this pool's workers, it puts work_item
+     *        in the worker's run-next slot instead, and the item the slot held, if any, goes to the queue.
+     */
+    void submit(std::unique_ptr<T> work_item) {
+        worker * self = current_worker();
+        if (!self || self->pool != this || run_next_limit == 0) {
+            q.enqueue(std::move(work_item));
+            return;
+        }
+        if (self->next) q.enqueue(std::move(self->next));
+        self->next = std::move(work_item);
+    }
+
+    size_t getRunNextLimit() const {
+        return run_next_limit;
+    }
+    /*!
+     * \brief setRunNextLimit sets how many run-next slot items a worker may serve in a row before it takes from
+     *        the queue again; default 8.  0 turns the slots off: submit() then always enqueues.
+     */
+    void setRunNextLimit(size_t value) {
+        run_next_limit = value;
+    }
+
+    stats snapshot() const {
+        stats s{ workers.size(), q.in_service(), static_cast<bool>(limiter), aimd_limiter::stats{},
+                 n_run_next, n_run_next_yielded };
+        if (limiter) s.limiter = limiter->snapshot();
+        return s;
+    }
+
+private:
+
+    void start(size_t n_workers) {
+        for (size_t i = 0; i < n_workers; i++)
+            workers.emplace_back([this]{ run(); });
+    }
+
+    struct worker {
+        const work_pool * pool;
+        std::unique_ptr<T> next;    // the run-next slot
+    };
+
+    static worker * & current_worker() {
+        thread_local worker * current = nullptr;
+        return current;
+    }
+
+    void run() {
+        worker self{ this, std::unique_ptr<T>() };
+        current_worker() = &self;
+
+        while (std::unique_ptr<T> item = q.dequeue()) {
+            // slot items never pass through the queue: a chain of them runs in the in-service place of the item
+            // that started it, so the concurrency limit holds, and the queue hears finished() once, at the end.
+            size_t n_in_a_row = 0;
+            for (;;) {
+                serve(std::move(item));
+                if (!self.next || q.is_halting()) break;
+                if (n_in_a_row++ >= run_next_limit) {
+                    q.enqueue(std::move(self.next));
+                    n_run_next_yielded++;
+                    break;
+                }
+                item = std::move(self.next);
+                n_run_next++;
+            }
+            q.finished();
+        }
+
+        self.next.reset();      // halting: the queue drops what it holds, too
+        current_worker() = nullptr;
+    }
+
+    void serve(std::unique_ptr<T> item) {
+        const auto started = std::chrono::steady_clock::now();
+        handle(std::move(item));
+        if (limiter) {
+            const auto latency = std::chrono::duration_cast<std::chrono::microseconds>(
+                        std::chrono::steady_clock::now() - started);
+            q.setConcurrencyLimit(limiter->update(latency));
+        }
+    }
+
+    Queue & q;
+    handler_type handle;
+    std::unique_ptr<aimd_limiter> limiter;
+    std::atomic<size_t> run_next_limit;
+    std::atomic<uint64_t> n_run_next;
+    std::atomic<uint64_t> n_run_next_yielded;
+    std::vector<std::thread> workers;
+};
+
+#endif // WORK_POOL_H
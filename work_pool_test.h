@@ -0,0 +1,175 @@
+#include <cxxtest/TestSuite.h>
+#include <iostream>
+#include <algorithm>
+#include <thread>
+#include "work_pool.h"
+
+
+class work_pool_test : public CxxTest::TestSuite
+{
+public:
+
+    void testPoolDrainsQueue(void) {
+        std::atomic<bool> haltflag(false);
+        std::atomic<int> sum(0);
+
+        work_queue<int> q(haltflag, SIZE_MAX, 10);
+
+        {
+            work_pool<int> pool(q, 4, [&](std::unique_ptr<int> item){ sum += *item; });
+
+            for (int i = 1; i <= 100; i++)
+                q.enqueue(std::make_unique<int>(i));
+
+            while (q.size() > 0 || q.in_service() > 0)
+                std::this_thread::sleep_for(1ms);
+
+            haltflag = true;
+        }
+
+        TS_ASSERT_EQUALS(sum, 5050);
+    }
+
+    void testLimiterBacksOffWhenDownstreamSlows(void) {
+        TS_TRACE("The handler's latency grows with the number of concurrent callers; the limit should drop.");
+
+        std::atomic<bool> haltflag(false);
+        std::atomic<int> concurrent(0);
+
+        work_queue<int> q(haltflag, SIZE_MAX, 10);
+
+        aimd_limiter::params limits;
+        limits.initial_limit = 8;
+        limits.tolerance = 1.5;
+
+        work_pool<int> pool(q, 8, [&](std::unique_ptr<int>) {
+            const int now = ++concurrent;
+            std::this_thread::sleep_for(std::chrono::microseconds(200 * now * now));
+            --concurrent;
+        }, limits);
+
+        for (int i = 0; i < 400; i++)
+            q.enqueue(std::make_unique<int>(i));
+
+        while (q.size() > 0)
+            std::this_thread::sleep_for(1ms);
+
+        haltflag = true;
+        pool.join();
+
+        work_pool<int>::stats s = pool.snapshot();
+        TS_ASSERT(s.limited);
+        TS_ASSERT(s.limiter.n_decreases > 0);
+        TS_ASSERT_LESS_THAN(s.limiter.limit, 8);
+        TS_ASSERT(s.limiter.latency_baseline_us > 0);
+    }
+
+    struct hop {
+        int chain;
+        int n;
+    };
+
+    void testSubmittedWorkRunsNextOnTheSameWorker(void) {
+        std::atomic<bool> haltflag(false);
+        work_queue<hop> q(haltflag, SIZE_MAX, 10);
+
+        std::mutex m;
+        std::vector<std::thread::id> ran_on[2];
+        std::atomic<int> done(0);
+        work_pool<hop> pool(q, 2, [&](std::unique_ptr<hop> h) {
+            {
+                std::unique_lock<std::mutex> l(m);
+                ran_on[h->chain].push_back(std::this_thread::get_id());
+            }
+            if (h->n < 5) pool.submit(std::unique_ptr<hop>(new hop{ h->chain, h->n + 1 }));
+            else done++;
+        });
+
+        q.enqueue(std::unique_ptr<hop>(new hop{ 0, 0 }));
+        q.enqueue(std::unique_ptr<hop>(new hop{ 1, 0 }));
+        while (done < 2)
+            std::this_thread::sleep_for(1ms);
+        haltflag = true;
+        pool.join();
+
+        TS_TRACE("every hop of a chain ran on the worker that started it");
+        for (const auto & chain: ran_on) {
+            TS_ASSERT_EQUALS(chain.size(), 6);
+            for (const auto & id: chain)
+                TS_ASSERT_EQUALS(id, chain.front());
+        }
+        TS_ASSERT_EQUALS(pool.snapshot().run_next, 10);
+    }
+
+    void testRunNextDisplacesAndYields(void) {
+        std::atomic<bool> haltflag(false);
+        work_queue<hop> q(haltflag, SIZE_MAX, 10);
+
+        std::mutex m;
+        std::vector<int> served;
+        auto n_served = [&]{ std::unique_lock<std::mutex> l(m); return served.size(); };
+        std::atomic<bool> outside_served(false);
+        work_pool<hop> pool(q, 1, [&](std::unique_ptr<hop> h) {
+            {
+                std::unique_lock<std::mutex> l(m);
+                served.push_back(h->chain);
+            }
+            if (h->chain == 0) {
+                TS_TRACE("the later submission takes the slot; the earlier one goes to the queue");
+                pool.submit(std::unique_ptr<hop>(new hop{ 1, 0 }));
+                pool.submit(std::unique_ptr<hop>(new hop{ 2, 0 }));
+            } else if (h->chain == 3 && !outside_served) {
+                pool.submit(std::unique_ptr<hop>(new hop{ 3, h->n + 1 }));     // an endless chain
+            } else if (h->chain == 4) {
+                outside_served = true;
+            }
+        });
+        pool.setRunNextLimit(4);
+
+        q.enqueue(std::unique_ptr<hop>(new hop{ 0, 0 }));
+        while (n_served() < 3)
+            std::this_thread::sleep_for(1ms);
+        TS_ASSERT_EQUALS(served, std::vector<int>({ 0, 2, 1 }));
+
+        TS_TRACE("the endless chain yields to the queue every 4 slot items");
+        std::vector<std::unique_ptr<hop> > both;
+        both.emplace_back(new hop{ 3, 0 });
+        both.emplace_back(new hop{ 4, 0 });
+        q.enqueue(both);
+        while (!outside_served)
+            std::this_thread::sleep_for(1ms);
+        haltflag = true;
+        pool.join();
+
+        TS_TRACE("the chain's first item and 4 slot items ran before the outside item");
+        const auto outside = std::find(served.begin(), served.end(), 4);
+        TS_ASSERT_EQUALS(std::count(served.begin(), outside, 3), 5);
+        TS_ASSERT_EQUALS(pool.snapshot().run_next_yielded, 1);
+    }
+
+    void testLimiterGrowsWhileLatencyIsFlat(void) {
+        aimd_limiter::params limits;
+        limits.initial_limit = 2;
+        limits.max_limit = 5;
+        aimd_limiter limiter(limits);
+
+        for (int i = 0; i < 100; i++)
+            limiter.update(std::chrono::microseconds(100));
+
+        TS_ASSERT_EQUALS(limiter.getLimit(), 5);
+        TS_ASSERT_EQUALS(limiter.snapshot().n_decreases, 0);
+    }
+
+    void testLimiterTakesAZeroWindow(void) {
+        aimd_limiter::params limits;
+        limits.window = 0;
+        aimd_limiter limiter(limits);
+
+        TS_TRACE("a zero window is taken as one: the baseline is re-learned from the last two samples");
+        limiter.update(std::chrono::microseconds(100));
+        limiter.update(std::chrono::microseconds(300));
+        limiter.update(std::chrono::microseconds(300));
+        TS_ASSERT_EQUALS(limiter.snapshot().latency_baseline_us, 300);
+    }
+
+};
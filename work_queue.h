@@ -3,21 +3,115 @@
 
 #include <algorithm>
 #include <queue>
+#include <memory>
+#include <vector>
+#include <chrono>
 #include <mutex>
 #include <condition_variable>
 #include <atomic>
+#include <cstdint>
+#include <list>
+#include <unordered_map>
+
+#ifdef __linux__
+#include <sched.h>
+#endif
+
+#include "depth_gauge.h"
+#include "wait_estimator.h"
+#include "source_accounting.h"
 
 using namespace std::chrono_literals;
 
+/*!
+ * fifo_storage - the default storage policy of work_queue: first in, first out.
+ *
+ * A storage policy holds the queued items and decides which one a dequeue serves (pop) and which one
+ * is discarded when the queue is saturated (drop, which hands the discarded item back).
+ * work_queue only calls it with its mutex held.
+ *
+ * Four members are optional.  overflow(incoming), if present, is called instead of drop() on saturation, and may
+ * discard incoming itself; represented(), if present, is how many enqueued items the items popped since its
+ * last call stand for (see reservoir_storage); capacity(), if present, bounds the queue's max_depth; and a
+ * true static copies_items says pop() returns copies rather than the pointers pushed (see shm_storage).
+ */
+template <class T>
+class fifo_storage
+{
+public:
+
+    bool empty() const { return items.empty(); }
+    size_t size() const { return items.size(); }
+
+    void push(std::unique_ptr<T> work_item) { items.push(std::move(work_item)); }
+
+    std::unique_ptr<T> pop() {
+        std::unique_ptr<T> val = std::move(items.front());
+        items.pop();
+        return val;
+    }
+
+    // drops the oldest item.
+    std::unique_ptr<T> drop() { return pop(); }
+
+private:
+
+    std::queue<std::unique_ptr<T> > items;
+};
+
+/*!
+ * std_sync - the default synchronisation policy of work_queue: the standard library's mutex and condition variable.
+ *
+ * A synchronisation policy names the mutex and condition_variable types the queue locks and waits with, and
+ * the clock it measures time by.
+ * Swapping in sim_sync (see sim_sync.h) runs the queue under a deterministic virtual-time scheduler.
+ */
+struct std_sync
+{
+    typedef std::mutex mutex;
+    typedef std::condition_variable condition_variable;
+    typedef std::chrono::steady_clock clock;
+};
+
+/*!
+ * wake_order - which waiting consumer work_queue wakes for new work (see setWakeOrder).
+ *
+ * any:             whichever the condition variable picks -- in practice, work spreads over all the consumers.
+ * fifo:            the consumer that has waited longest.
+ * lifo:            the consumer that started waiting most recently: the last one active, so the one with the
+ *                  warmest caches.  Under light load the same few consumers keep serving and the rest stay
+ *                  parked, long enough to sleep deeply or to be reclaimed by an autoscaler.
+ * preferred_cores: as lifo, but preferring consumers that started waiting on one of the preferred cores.
+ */
+enum class wake_order { any, fifo, lifo, preferred_cores };
+
 /*!
  * work_queue - a templated class to manage a work queue between producer and consumer threads.
  * the work items are the template parameter T.
+ * Storage is the policy deciding the order in which work items are served and which one is dropped
+ * when the queue is saturated; see fifo_storage.
+ * Sync is the policy supplying the mutex and condition variable; see std_sync.
  */
-template <class T>
+template <class T, class Storage = fifo_storage<T>, class Sync = std_sync>
 class work_queue
 {
+    typedef std::unique_lock<typename Sync::mutex> lock_type;
+    typedef typename Sync::clock clock;
+
 public:
 
+    /*!
+     * stats - the load estimates behind admission control (see setLatencyBudget); all 0 while estimation is off.
+     */
+    struct stats {
+        double arrival_rate;        // items offered per second
+        double service_rate;        // items per second per consumer
+        double consumers;           // consumers in service or waiting
+        double utilization;         // offered load per consumer
+        std::chrono::microseconds predicted_wait;   // for an item enqueued now
+        std::chrono::microseconds latency_budget;
+    };
+
     /*!
      * \brief work_queue creates an instance of a work queue with given capacity,
      *        wait interval on dequeue and atomic boolean halt flag.
@@ -33,17 +127,39 @@ public:
      *        The condition on which the dequeue method returns is (work available || halting).
      * \param flush_on_halt defaults to false; when the halt_flag is set, should the queue flush remaining work or
      *        allow it to be processed?
+     * \param storage the storage policy instance, for policies that take configuration.
      */
-    work_queue(std::atomic<bool> & halt_flag, size_t max_depth = SIZE_MAX, int wait_interval_ms = 100)
+    work_queue(std::atomic<bool> & halt_flag, size_t max_depth = SIZE_MAX, int wait_interval_ms = 100,
+               Storage storage = Storage())
         : shutting_down(halt_flag)
         , wait_interval(wait_interval_ms)
         , n_dropped(0)
         , n_handled(0)
+        , n_rejected(0)
+        , n_in_service(0)
+        , n_waiting(0)
         , max(max_depth)
+        , concurrency_limit(SIZE_MAX)
         , m()
         , cv()
-        , unguarded_queue()
-    { }
+        , timer_cv()
+        , unguarded_queue(std::move(storage))
+        , depth()
+        , sources()
+        , origins()
+        , estimator()
+        , latency_budget(0)
+        , latency_slack(0)
+        , slack_batch(SIZE_MAX)
+        , n_unnotified(0)
+        , unnotified_since()
+        , timer_busy(false)
+        , order(wake_order::any)
+        , preferred_cores()
+        , waiters()
+    {
+        max = std::min(max, capacity_of(unguarded_queue, 0));
+    }
 
     ~work_queue() {  }
 
@@ -55,20 +171,35 @@ public:
      */
     void enqueue(std::unique_ptr<T> work_item)
     {
-        {   // locked context
-            std::unique_lock<std::mutex> l(m);
+        enqueue_from(work_item, nullptr, nullptr);
+    }
 
-            // don't enqueue when shutting down, or when passed an "empty" unique_ptr.
-            if (shutting_down || !work_item) return;
+    /*!
+     * \brief enqueue as above, attributing the work item to the given source when source accounting is enabled
+     *        (see setSourceAccounting).  Untagged enqueues are attributed to the calling thread.
+     */
+    void enqueue(std::unique_ptr<T> work_item, source_tag source)
+    {
+        enqueue_from(work_item, &source, nullptr);
+    }
 
-            if (unguarded_queue.size() >= max) {
-                n_dropped++;
-                unguarded_queue.pop();
-            }
-            unguarded_queue.push(std::move(work_item));
-        }   // end locked context
+    /*!
+     * \brief try_enqueue adds the work item unless the queue is shutting down or admission control predicts it
+     *        would wait longer than the queue's latency budget for a consumer (see setLatencyBudget).
+     * \return true if the item was enqueued; otherwise false, and work_item still holds it.
+     */
+    bool try_enqueue(std::unique_ptr<T> & work_item)
+    {
+        return enqueue_from(work_item, nullptr, nullptr);
+    }
 
-        cv.notify_one();
+    /*!
+     * \brief try_enqueue as above, judging admission against this item's own latency budget.
+     *        A zero budget admits the item whatever the prediction.
+     */
+    bool try_enqueue(std::unique_ptr<T> & work_item, std::chrono::microseconds budget)
+    {
+        return enqueue_from(work_item, nullptr, &budget);
     }
 
     /*!
@@ -77,37 +208,21 @@ public:
      *                moved and the caller retains ownership). Empty std::unique_ptrs in bulk are ignored-- i.e.
      *                not pushed.
      *                This supports bulk enqueueing without toggling the lock for each entry.
+     *                Items refused admission under a latency budget are also left in bulk.
      * \param bulk a std::vector of std::unique_ptr<T> objects
+     * \return the number of items dropped to make room for bulk (also counted by dropped()).
      */
-    void enqueue(std::vector<std::unique_ptr<T> > & bulk)
+    size_t enqueue(std::vector<std::unique_ptr<T> > & bulk)
     {
-        {   // locked context:
-            std::unique_lock<std::mutex> l(m);
-
-            if (shutting_down) return;
-
-            // only count non-empty unique_ptrs, since only those are pushed.
-            size_t bulk_size = 0;
-            for (auto & work_item: bulk)
-                if (work_item) bulk_size++;
-
-            // nothing to do:
-            if (bulk_size == 0) return;
-
-            const int plus_bulk = (unguarded_queue.size() + bulk_size);
-            if (plus_bulk > max) {
-                for (int i = 0; i < plus_bulk - max; i++) {
-                    n_dropped++;
-                    unguarded_queue.pop();
-                }
-            }
-
-            for (auto & work_item: bulk) {
-                unguarded_queue.push(std::move(work_item));
-            }
-        }   // end locked context
+        return enqueue_from(bulk, nullptr);
+    }
 
-        cv.notify_one();
+    /*!
+     * \brief enqueue as above, attributing all of bulk to the given source when source accounting is enabled.
+     */
+    size_t enqueue(std::vector<std::unique_ptr<T> > & bulk, source_tag source)
+    {
+        return enqueue_from(bulk, &source);
     }
 
     /*!
@@ -116,23 +231,81 @@ public:
      *
      * Returns the null value of T in the case of shutdown.  See also parameter wait_interval, default 100ms.
      * The atomic variable represented locally as shutting_down is set by the caller to initiate an orderly shutdown.
+     *
+     * When a concurrency limit is set (see setConcurrencyLimit), a consumer stays parked here while the limit's
+     * worth of items are in service, even if work is queued; each dequeued item counts as in service until the
+     * consumer calls finished().
+     *
+     * Under a latency slack (see setLatencySlack) a waiting consumer may be woken for an item up to the slack
+     * after it was enqueued.
      */
     std::unique_ptr<T> dequeue() {
-        std::unique_lock<std::mutex> l(m);
-        auto waiting = unguarded_queue.empty() && !shutting_down;
-
-        while (waiting) {
-            waiting = !cv.wait_for(l, wait_interval*1ms, [&]{ return (shutting_down || !unguarded_queue.empty()); });
+        lock_type l(m);
+        const bool fired = wait_for_work(l);
+
+        std::unique_ptr<T> val;
+        if (!shutting_down && !unguarded_queue.empty()) {
+            val = take();
+            represented_by(unguarded_queue, 1, 0);  // settled unreported, so a later batch reports only its own
+            depth.publish(unguarded_queue.size());
+            n_unnotified = std::min(n_unnotified, unguarded_queue.size());
         }
 
-        if (shutting_down) {
-            return std::unique_ptr<T>{};
-        } else if (!unguarded_queue.empty()) {
-            n_handled++;
-            std::unique_ptr<T> val = std::move(unguarded_queue.front());
-            unguarded_queue.pop();
-            return val;
+        leave(l, fired);
+        return val;
+    }
+
+    /*!
+     * \brief dequeue as above, but takes up to max_items queued items at once, appending them to batch: one
+     *        lock round trip for consumers that serve items together.  Each item counts as in service until its
+     *        own finished(), so a concurrency limit caps the batch at the free slots.
+     * \return the number of enqueued items the batch stands for: the items taken, plus their share of the items
+     *         a sampling storage policy (see reservoir_storage) discarded in their stead.  0 if shutting down.
+     */
+    size_t dequeue(std::vector<std::unique_ptr<T> > & batch, size_t max_items) {
+        lock_type l(m);
+        const bool fired = wait_for_work(l);
+
+        size_t taken = 0;
+        while (!shutting_down && taken < max_items && may_dequeue()) {
+            batch.push_back(take());
+            taken++;
         }
+        const size_t represented = taken > 0 ? represented_by(unguarded_queue, taken, 0) : 0;
+        depth.publish(unguarded_queue.size());
+        n_unnotified = std::min(n_unnotified, unguarded_queue.size());
+
+        leave(l, fired);
+        return represented;
+    }
+
+    /*!
+     * \brief finished tells the queue that a consumer is done with an item it dequeued, releasing its slot
+     *        under the concurrency limit.  Consumers need only call this when a concurrency limit or load
+     *        estimation is in use: it is how the queue measures service time.
+     */
+    void finished() {
+        wakeup wake{ 0, false };
+        {   // locked context
+            lock_type l(m);
+            if (n_in_service > 0) {
+                if (estimator) estimator->completed(clock::now(), n_in_service);
+                // only a slot freed at the limit can have held back a parked consumer.
+                if (n_in_service == concurrency_limit && !unguarded_queue.empty()) wake.consumers = 1;
+                n_in_service--;
+            }
+            signal_ordered(wake);
+        }   // end locked context
+
+        notify(wake);
+    }
+
+    /*!
+     * \brief in_service returns the number of dequeued items not yet reported finished().
+     */
+    size_t in_service() const {
+        lock_type l(m);
+        return n_in_service;
     }
 
     /*!
@@ -140,13 +313,33 @@ public:
      * \return the count of items in the queue (or 0 if shutting down)
      */
     size_t size() const {
-        std::unique_lock<std::mutex> l(m);
+        lock_type l(m);
 
         if (shutting_down) return 0;
 
         return unguarded_queue.size();
     }
 
+    /*!
+     * \brief approx_size returns the number of queued work items (or 0 if shutting down) without taking the
+     *        lock: two relaxed loads, so it's cheap enough for load balancers and autoscalers to poll.
+     *        The count may lag size() by the enqueues and dequeues in progress; see depth_gauge.
+     */
+    size_t approx_size() const {
+        if (is_halting()) return 0;
+        return depth.load();
+    }
+
+    /*!
+     * \brief empty returns whether approx_size() is 0; as stale as approx_size().
+     */
+    bool empty() const { return approx_size() == 0; }
+
+    /*!
+     * \brief is_halting returns the halt flag, by a relaxed load: it may trail a concurrent store to the flag.
+     */
+    bool is_halting() const { return shutting_down.load(std::memory_order_relaxed); }
+
     /*!
      * \brief dropped returns the number of work items dropped so far because the queue was saturated.
      *        resets the counter of dropped items to zero.
@@ -154,12 +347,24 @@ public:
      * \return number items dropped since last call
      */
     int dropped () {
-        std::unique_lock<std::mutex> l(m);
+        lock_type l(m);
 
         int so_far = n_dropped;
         n_dropped = 0;
         return so_far;
     }
+    /*!
+     * \brief rejected returns the number of work items refused admission under a latency budget so far,
+     *        and resets the counter to zero.  try_enqueue refusals are counted too.
+     */
+    int rejected () {
+        lock_type l(m);
+
+        int so_far = n_rejected;
+        n_rejected = 0;
+        return so_far;
+    }
+
     /*!
      * \brief handled returns the number of work items handled (dequeued) so far.
      *        resets the counter of handled items to zero.
@@ -167,7 +372,7 @@ public:
      * \return number of work items handled since last call
      */
     int handled () {
-        std::unique_lock<std::mutex> l(m);
+        lock_type l(m);
 
         int so_far = n_handled;
         n_handled = 0;
@@ -175,38 +380,562 @@ public:
     }
 
     size_t getMax() const {
-        std::unique_lock<std::mutex> l(m);
+        lock_type l(m);
         return max;
     }
     void setMax(const size_t &value) {
-        std::unique_lock<std::mutex> l(m);
-        max = value;
+        lock_type l(m);
+        max = std::min(value, capacity_of(unguarded_queue, 0));
     }
 
     int getWaitInterval() const {
-        std::unique_lock<std::mutex> l(m);
+        lock_type l(m);
         return wait_interval;
     }
     void setWaitInterval(int value) {
-        std::unique_lock<std::mutex> l(m);
+        lock_type l(m);
         wait_interval = value;
     }
 
+    size_t getConcurrencyLimit() const {
+        lock_type l(m);
+        return concurrency_limit;
+    }
+    /*!
+     * \brief setConcurrencyLimit caps how many dequeued items may be in service at once.
+     *        Defaults to SIZE_MAX, i.e. no limit.  A limit of 0 is treated as 1.
+     */
+    void setConcurrencyLimit(size_t value) {
+        bool raised;
+        {   // locked context
+            lock_type l(m);
+            value = std::max<size_t>(value, 1);
+            raised = value > concurrency_limit;
+            concurrency_limit = value;
+            if (raised) signal_all();
+        }   // end locked context
+
+        // a raised limit may release several parked consumers.
+        if (raised) cv.notify_all();
+    }
+
+    /*!
+     * \brief setSourceAccounting turns per-source accounting of enqueued, dropped and dequeued items on or off.
+     *        Off by default; turning it off discards the counts.
+     * \return whether accounting is on: it can't be with a storage policy that copies items (see shm_storage),
+     *         as the queue tracks each item's source by its address.
+     */
+    bool setSourceAccounting(bool enabled) {
+        lock_type l(m);
+        if (enabled && copies_items<Storage>(0)) return false;
+        if (enabled && !sources) {
+            sources.reset(new source_accounting);
+        } else if (!enabled) {
+            sources.reset();
+            origins.clear();
+        }
+        return enabled;
+    }
+
+    /*!
+     * \brief top_sources returns the n sources ranking highest by the given count, highest first; empty
+     *        when source accounting is off.  Intended for diagnostics, e.g. finding who flooded the queue.
+     */
+    std::vector<source_counts> top_sources(size_t n,
+                                           source_accounting::rank_by rank = source_accounting::by_dropped) const {
+        lock_type l(m);
+        if (!sources) return std::vector<source_counts>{};
+        return sources->top(n, rank);
+    }
+
+    /*!
+     * \brief setLoadEstimation turns on or off the estimates of arrival rate, service rate and consumers that
+     *        drive admission control.  Off by default; turning it off discards them, and the latency budget.
+     *        Service times are only measured when consumers call finished().
+     */
+    void setLoadEstimation(bool enabled) {
+        lock_type l(m);
+        if (enabled && !estimator) {
+            estimator.reset(new wait_estimator<clock>);
+        } else if (!enabled) {
+            estimator.reset();
+            latency_budget = std::chrono::microseconds(0);
+        }
+    }
+
+    std::chrono::microseconds getLatencyBudget() const {
+        lock_type l(m);
+        return latency_budget;
+    }
+    /*!
+     * \brief setLatencyBudget sets how long a new item may be predicted to wait for a consumer and still be
+     *        admitted: by Little's law, the items ahead of it over the rate the consumers drain them.  Items
+     *        predicted to wait longer are refused (counted by rejected(); try_enqueue hands them back).
+     *        A positive budget turns load estimation on; zero, the default, admits everything.
+     *        Until a service time has been measured every item is admitted.
+     */
+    void setLatencyBudget(std::chrono::microseconds budget) {
+        lock_type l(m);
+        latency_budget = budget;
+        if (budget > std::chrono::microseconds(0) && !estimator) estimator.reset(new wait_estimator<clock>);
+    }
+
+    std::chrono::microseconds getLatencySlack() const {
+        lock_type l(m);
+        return latency_slack;
+    }
+    /*!
+     * \brief setLatencySlack lets enqueued items wait up to slack before a consumer is woken for them, so that
+     *        consumers wake once per batch rather than once per item.  Consumers are woken when the oldest held
+     *        item's slack runs out, or as soon as batch items are held.  A consumer arriving in dequeue takes
+     *        held items at once: only wakeups are deferred, so consumers that are kept busy see no difference.
+     *        One waiting consumer keeps the deadline, sleeping until it: there is a single timer per queue, not
+     *        one per item.  Zero, the default, wakes a consumer for every enqueue.
+     */
+    void setLatencySlack(std::chrono::microseconds slack, size_t batch = 64) {
+        {   // locked context
+            lock_type l(m);
+            latency_slack = slack;
+            slack_batch = std::max<size_t>(batch, 1);
+            n_unnotified = 0;
+            signal_all();
+        }   // end locked context
+
+        cv.notify_all();
+        timer_cv.notify_all();
+    }
+
+    wake_order getWakeOrder() const {
+        lock_type l(m);
+        return order;
+    }
+    /*!
+     * \brief setWakeOrder chooses which waiting consumer is woken for new work; see wake_order.  The default,
+     *        wake_order::any, leaves the choice to the condition variable.  The others keep a list of waiting
+     *        consumers, each on a condition variable of its own; a consumer keeps its place in the list until
+     *        it leaves dequeue, so waking up to check the halt flag doesn't make it the most recent.
+     */
+    void setWakeOrder(wake_order value) {
+        {   // locked context
+            lock_type l(m);
+            order = value;
+            signal_all();   // parked consumers re-wait the new way
+        }   // end locked context
+
+        cv.notify_all();
+    }
+
+    /*!
+     * \brief setPreferredCores sets the cores wake_order::preferred_cores favours, by the ids sched_getcpu()
+     *        reports.  Where the core can't be known (outside Linux), no consumer is preferred.
+     */
+    void setPreferredCores(const std::vector<int> & cores) {
+        lock_type l(m);
+        preferred_cores = cores;
+    }
+
+    /*!
+     * \brief snapshot returns the current load estimates and the prediction for an item enqueued now.
+     */
+    stats snapshot() const {
+        lock_type l(m);
+        if (!estimator) return stats{ 0, 0, 0, 0, std::chrono::microseconds(0), latency_budget };
+        return stats{ estimator->arrival_rate(), estimator->service_rate(), estimator->getConsumers(),
+                      estimator->utilization(),
+                      std::chrono::duration_cast<std::chrono::microseconds>(predicted_wait()), latency_budget };
+    }
+
 private:
 
+    // budget null means the queue's latency budget.  Returns whether the item was enqueued.
+    bool enqueue_from(std::unique_ptr<T> & work_item, const source_tag * source,
+                      const std::chrono::microseconds * budget)
+    {
+        wakeup wake;
+        {   // locked context
+            lock_type l(m);
+
+            // don't enqueue when shutting down, or when passed an "empty" unique_ptr.
+            if (shutting_down || !work_item) return false;
+
+            if (estimator) estimator->arrived(clock::now());
+            if (!admit(budget ? *budget : latency_budget)) {
+                n_rejected++;
+                return false;
+            }
+
+            push_bounded(std::move(work_item), source);
+            depth.publish(unguarded_queue.size());
+            wake = arrived(1);
+            signal_ordered(wake);
+        }   // end locked context
+
+        notify(wake);
+        return true;
+    }
+
+    // returns the number of items dropped to make room.
+    size_t enqueue_from(std::vector<std::unique_ptr<T> > & bulk, const source_tag * source)
+    {
+        wakeup wake;
+        int dropped_before;
+        int dropped_after;
+        {   // locked context:
+            lock_type l(m);
+
+            if (shutting_down) return 0;
+
+            // only count non-empty unique_ptrs, since only those are pushed.
+            size_t bulk_size = 0;
+            for (auto & work_item: bulk)
+                if (work_item) bulk_size++;
+
+            // nothing to do:
+            if (bulk_size == 0) return 0;
+
+            dropped_before = n_dropped;
+
+            if (estimator) estimator->arrived(clock::now(), bulk_size);
+            size_t pushed = 0;
+            for (auto & work_item: bulk) {
+                if (!work_item) continue;
+                if (!admit(latency_budget)) {
+                    n_rejected++;
+                    continue;
+                }
+                push_bounded(std::move(work_item), source);
+                pushed++;
+            }
+            depth.publish(unguarded_queue.size());
+            wake = arrived(pushed);
+            signal_ordered(wake);
+            dropped_after = n_dropped;
+        }   // end locked context
+
+        notify(wake);
+        return static_cast<size_t>(dropped_after - dropped_before);
+    }
+
+    // called with m held.  Drops per the storage policy to make room; with max 0 the item itself is dropped.
+    void push_bounded(std::unique_ptr<T> work_item, const source_tag * source) {
+        if (sources) {
+            const source_tag tag = source ? *source : this_thread_source();
+            sources->enqueued(tag);
+            origins[work_item.get()] = tag;
+        }
+
+        if (unguarded_queue.size() >= max) {
+            n_dropped++;
+            std::unique_ptr<T> victim = unguarded_queue.empty() ? std::move(work_item)
+                                                                : make_room(unguarded_queue, work_item, 0);
+            account_removal(victim.get(), true);
+            if (!work_item) return;
+        }
+        unguarded_queue.push(std::move(work_item));
+    }
+
+    // called with m held.  Items queued before accounting was enabled have no recorded source and aren't counted.
+    void account_removal(const T * work_item, bool was_dropped) {
+        if (!sources) return;
+
+        auto it = origins.find(work_item);
+        if (it == origins.end()) return;
+
+        if (was_dropped)
+            sources->dropped(it->second);
+        else
+            sources->dequeued(it->second);
+        origins.erase(it);
+    }
+
+    // called with m held.  Whether an item enqueued now is predicted to start service within budget.
+    bool admit(std::chrono::microseconds budget) const {
+        if (budget <= std::chrono::microseconds(0) || !estimator) return true;
+        return predicted_wait() <= budget;
+    }
+
+    // called with m held.  Waiting consumers only count as idle while the concurrency limit has room for them.
+    typename wait_estimator<clock>::seconds predicted_wait() const {
+        const size_t free_slots = concurrency_limit - std::min(n_in_service, concurrency_limit);
+        return estimator->predict_wait(unguarded_queue.size(), std::min(n_waiting, free_slots), concurrency_limit);
+    }
+
+    // called with m held: waits until this consumer may take an item or the queue is shutting down.  Returns
+    // whether it kept the latency slack's deadline and saw it pass, releasing the held items.
+    bool wait_for_work(lock_type & l) {
+        auto waiting = !may_dequeue() && !shutting_down;
+        bool timer = false;     // this consumer keeps the latency slack's deadline
+        bool fired = false;     // ... and it passed, releasing the held items
+
+        // under an ordered wake order the consumer parks on its own condition variable, keeping its place in
+        // the order across wait intervals.
+        waiter self;
+        auto parked = waiters.end();
+        auto ready = [&]{ return (shutting_down || may_take() || timer_wanted()); };
+
+        n_waiting++;
+        while (waiting) {
+            if (!timer && timer_wanted()) {
+                timer_busy = timer = true;
+                unpark(parked);
+            }
+
+            if (timer) {
+                fired = wait_as_timer(l) || fired;
+                if (n_unnotified == 0) timer_busy = timer = false;   // released, or taken by arriving consumers
+            } else if (order == wake_order::any) {
+                unpark(parked);
+                cv.wait_for(l, wait_interval*1ms, ready);
+            } else {
+                if (parked == waiters.end()) {
+                    self.cpu = current_cpu();
+                    parked = waiters.insert(waiters.end(), &self);
+                }
+                self.signalled = false;
+                self.cv.wait_for(l, wait_interval*1ms, [&]{ return self.signalled || ready(); });
+            }
+            waiting = !(shutting_down || may_take());
+        }
+        n_waiting--;
+        unpark(parked);
+
+        if (timer) timer_busy = false;
+        return fired;
+    }
+
+    // called with m held, the queue not empty.
+    std::unique_ptr<T> take() {
+        if (estimator) estimator->started(clock::now(), n_in_service, n_in_service + n_waiting + 1);
+        n_handled++;
+        n_in_service++;
+        std::unique_ptr<T> val = unguarded_queue.pop();
+        account_removal(val.get(), false);
+        return val;
+    }
+
+    // called with m held, after taking: wakes whoever the leaving consumer owes a wakeup, and unlocks.
+    void leave(lock_type & l, bool fired) {
+        // a timer whose deadline passed wakes the others for the rest of the items it released.  Items still
+        // held back with no timer -- it is leaving, or this consumer was woken to be it but found other work --
+        // need a waiting consumer to keep their deadline.
+        wakeup wake{ 0, false };
+        if (fired && !shutting_down)
+            wake.consumers = std::min(unguarded_queue.size(), n_waiting);
+        if (timer_wanted() && n_waiting > 0)
+            wake.consumers = std::max<size_t>(wake.consumers, 1);
+
+        signal_ordered(wake);
+        l.unlock();
+        notify(wake);
+    }
+
+    // called with m held, the queue full.  A storage policy with an overflow() member chooses what to discard
+    // itself -- a queued item or work_item -- and places work_item if it keeps it; otherwise the queue drops
+    // the item the policy's drop() gives up, and pushes work_item after.
+    template <class S>
+    static auto make_room(S & storage, std::unique_ptr<T> & work_item, int) -> decltype(storage.overflow(work_item)) {
+        return storage.overflow(work_item);
+    }
+    template <class S>
+    static std::unique_ptr<T> make_room(S & storage, std::unique_ptr<T> &, long) {
+        return storage.drop();
+    }
+
+    // a storage policy with a capacity() member holds at most that many items: the queue's bound is clamped to it.
+    template <class S>
+    static auto capacity_of(const S & storage, int) -> decltype(size_t(storage.capacity())) {
+        return storage.capacity();
+    }
+    template <class S>
+    static size_t capacity_of(const S &, long) {
+        return SIZE_MAX;
+    }
+
+    // a storage policy whose copies_items is true hands back copies, not the pointers it was given.
+    template <class S>
+    static constexpr auto copies_items(int) -> decltype(bool(S::copies_items)) {
+        return S::copies_items;
+    }
+    template <class S>
+    static constexpr bool copies_items(long) {
+        return false;
+    }
+
+    // called with m held, after popping n items.  A storage policy with a represented() member reports how many
+    // enqueued items those stand for; otherwise each stands for itself.
+    template <class S>
+    static auto represented_by(S & storage, size_t, int) -> decltype(storage.represented()) {
+        return storage.represented();
+    }
+    template <class S>
+    static size_t represented_by(S &, size_t n, long) {
+        return n;
+    }
+
+    // called with m held.
+    bool may_dequeue() const {
+        return !unguarded_queue.empty() && n_in_service < concurrency_limit;
+    }
+
+    // the consumers to wake after an enqueue or a release: on cv, and whether the timer on timer_cv.
+    struct wakeup {
+        size_t consumers;
+        bool timer;
+    };
+
+    // called with m held.  A waiting consumer may take an item once it is no longer held back by the slack.
+    bool may_take() const {
+        return may_dequeue() && unguarded_queue.size() > n_unnotified;
+    }
+
+    // called with m held.  Items are held back but no consumer is keeping their deadline.
+    bool timer_wanted() const {
+        return n_unnotified > 0 && !timer_busy;
+    }
+
+    // called with m held, after pushing n items: without a slack, wake one consumer; with one, hold the items
+    // back until the batch fills, waking a consumer only to keep the deadline of the first of them.
+    wakeup arrived(size_t n) {
+        if (n == 0) return wakeup{ 0, false };
+        if (latency_slack <= std::chrono::microseconds(0)) return wakeup{ 1, false };
+
+        const bool first = n_unnotified == 0;
+        if (first) unnotified_since = clock::now();
+        n_unnotified = std::min(n_unnotified + n, unguarded_queue.size());
+
+        if (n_unnotified >= slack_batch) return release();
+        if (!first || n_waiting == 0) return wakeup{ 0, false };
+        // a timer still asleep on an earlier deadline picks up the new one; otherwise a consumer on cv becomes it.
+        return timer_busy ? wakeup{ 0, true } : wakeup{ 1, false };
+    }
+
+    // called with m held.  Stops holding items back, waking as many waiting consumers as there are items.
+    wakeup release() {
+        n_unnotified = 0;
+        const size_t n = std::min(unguarded_queue.size(), n_waiting);
+        if (n == 0) return wakeup{ 0, false };
+        return timer_busy ? wakeup{ n - 1, true } : wakeup{ n, false };
+    }
+
+    // called with m held and items held back, by the consumer keeping their deadline: sleeps until it.
+    // Returns whether the deadline passed, releasing the items.
+    bool wait_as_timer(lock_type & l) {
+        const auto now = clock::now();
+        if (now < unnotified_since + latency_slack) {
+            timer_cv.wait_for(l, unnotified_since + latency_slack - now);
+            if (n_unnotified == 0 || clock::now() < unnotified_since + latency_slack) return false;
+        }
+        n_unnotified = 0;
+        return true;
+    }
+
+    // called without m held.
+    void notify(const wakeup & wake) {
+        if (wake.timer) timer_cv.notify_one();
+        for (size_t i = 0; i < wake.consumers; i++) cv.notify_one();
+    }
+
+    // a consumer parked under an ordered wake order.
+    struct waiter {
+        typename Sync::condition_variable cv;
+        bool signalled = false;
+        int cpu = -1;           // the core it started waiting on, or -1 if unknown
+    };
+
+    // called with m held.  Under an ordered wake order, wakes the consumers chosen by it now -- a parked
+    // consumer may leave, destroying its condition variable, once m is released -- leaving notify() only the timer.
+    void signal_ordered(wakeup & wake) {
+        if (order == wake_order::any) return;
+        while (wake.consumers > 0 && signal_one())
+            wake.consumers--;
+        wake.consumers = 0;     // the rest have no parked consumer to wake
+    }
+
+    // called with m held.  Wakes the parked consumer first in the wake order that isn't already woken.
+    bool signal_one() {
+        waiter * chosen = nullptr;
+        if (order == wake_order::fifo) {
+            for (waiter * w: waiters)
+                if (!w->signalled) { chosen = w; break; }
+        } else {
+            for (auto it = waiters.rbegin(); it != waiters.rend(); ++it) {
+                waiter * w = *it;
+                if (w->signalled) continue;
+                if (order != wake_order::preferred_cores || is_preferred(w->cpu)) { chosen = w; break; }
+                if (!chosen) chosen = w;    // the most recent, should no preferred consumer be parked
+            }
+        }
+        if (!chosen) return false;
+
+        chosen->signalled = true;
+        chosen->cv.notify_one();
+        return true;
+    }
+
+    // called with m held.
+    void signal_all() {
+        for (waiter * w: waiters) {
+            w->signalled = true;
+            w->cv.notify_one();
+        }
+    }
+
+    // called with m held.
+    void unpark(typename std::list<waiter *>::iterator & parked) {
+        if (parked == waiters.end()) return;
+        waiters.erase(parked);
+        parked = waiters.end();
+    }
+
+    // called with m held.
+    bool is_preferred(int cpu) const {
+        return cpu >= 0 && std::find(preferred_cores.begin(), preferred_cores.end(), cpu) != preferred_cores.end();
+    }
+
+    static int current_cpu() {
+#ifdef __linux__
+        return sched_getcpu();
+#else
+        return -1;
+#endif
+    }
+
     std::atomic<bool> & shutting_down;
 
     int wait_interval; // units 1msec
 
     int n_dropped;
     int n_handled;
+    int n_rejected;
+
+    size_t n_in_service;
+    size_t n_waiting;       // consumers inside dequeue
 
     size_t max;
+    size_t concurrency_limit;
+
+    mutable typename Sync::mutex m;
+    typename Sync::condition_variable cv;
+    typename Sync::condition_variable timer_cv;    // the consumer keeping the latency slack's deadline waits here
+
+    Storage unguarded_queue;
+    depth_gauge depth;      // unguarded_queue.size(), for lock-free readers
+
+    std::unique_ptr<source_accounting> sources;
+    std::unordered_map<const T *, source_tag> origins;  // source of each queued item, while accounting
+
+    std::unique_ptr<wait_estimator<clock> > estimator;
+    std::chrono::microseconds latency_budget;
 
-    mutable std::mutex m;
-    std::condition_variable cv;
+    std::chrono::microseconds latency_slack;
+    size_t slack_batch;
+    size_t n_unnotified;                        // newest queued items no consumer has been woken for
+    typename clock::time_point unnotified_since;
+    bool timer_busy;                            // a waiting consumer is keeping the slack deadline
 
-    std::queue<std::unique_ptr<T> > unguarded_queue;
+    wake_order order;
+    std::vector<int> preferred_cores;
+    std::list<waiter *> waiters;                // parked consumers, in the order they started waiting
 
 };
 
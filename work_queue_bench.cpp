@@ -0,0 +1,1050 @@
+/*!
+ * work_queue_bench - benchmarks and simulations for work_queue and its storage policies.
+ *
+ * build: g++ -std=c++14 -O2 -pthread work_queue_bench.cpp -o work_queue_bench
+ * run:   ./work_queue_bench [--perf] [scenario ...]     (no scenario runs every scenario)
+ *
+ * --perf opens per-thread hardware counters (see perf_counters.h) in the threaded scenarios and reports
+ * them per operation; counters the kernel refuses are shown as n/a.
+ */
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <list>
+#include <random>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "work_queue.h"
+#include "sejf_storage.h"
+#include "biased_queue.h"
+#include "work_stack.h"
+#include "multi_queue.h"
+#include "affinity_queue.h"
+#include "async_logger.h"
+#include "batch_stage.h"
+#include "work_pool.h"
+#include "adaptive_queue.h"
+#include "perf_counters.h"
+#include "work_queue_sim.h"
+
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+namespace {
+
+bool with_perf = false;
+
+struct sojourn_summary {
+    double mean;
+    double p50;
+    double p99;
+    double max;
+};
+
+sojourn_summary summarize(std::vector<double> & samples)
+{
+    std::sort(samples.begin(), samples.end());
+    double total = 0;
+    for (double sample: samples) total += sample;
+
+    const size_t n = samples.size();
+    return sojourn_summary{ total / n, samples[n / 2], samples[std::min(n - 1, n * 99 / 100)], samples.back() };
+}
+
+// ---------------------------------------------------------------------------------------------------------
+// scheduling simulation: a single server in virtual time, fed Poisson arrivals with bimodal job sizes.
+
+struct sim_job {
+    double arrival;
+    double size;        // actual service time
+    double estimate;    // what the cost estimator believes
+    double expected_cost() const { return estimate; }
+};
+
+std::vector<sim_job> make_arrivals(size_t n_jobs, double load, unsigned seed)
+{
+    std::mt19937_64 rng(seed);
+    std::bernoulli_distribution large(0.1);
+    std::lognormal_distribution<double> estimate_error(0.0, 0.25);
+
+    const double mean_size = 0.9 * 1.0 + 0.1 * 50.0;
+    std::exponential_distribution<double> interarrival(load / mean_size);
+
+    std::vector<sim_job> jobs;
+    jobs.reserve(n_jobs);
+    double now = 0;
+    for (size_t i = 0; i < n_jobs; i++) {
+        now += interarrival(rng);
+        const double size = large(rng) ? 50.0 : 1.0;
+        jobs.push_back(sim_job{ now, size, size * estimate_error(rng) });
+    }
+    return jobs;
+}
+
+template <class Storage>
+sojourn_summary simulate(const std::vector<sim_job> & jobs, Storage storage)
+{
+    std::vector<double> sojourn;
+    sojourn.reserve(jobs.size());
+
+    double now = 0;
+    size_t next = 0;
+    while (sojourn.size() < jobs.size()) {
+        if (storage.empty() && next < jobs.size())
+            now = std::max(now, jobs[next].arrival);
+        while (next < jobs.size() && jobs[next].arrival <= now)
+            storage.push(std::unique_ptr<sim_job>(new sim_job(jobs[next++])));
+
+        std::unique_ptr<sim_job> job = storage.pop();
+        now += job->size;
+        sojourn.push_back(now - job->arrival);
+    }
+    return summarize(sojourn);
+}
+
+void print_sojourn(const char * label, const sojourn_summary & s)
+{
+    std::printf("  %-22s mean %9.2f  p50 %9.2f  p99 %9.2f  max %10.2f\n", label, s.mean, s.p50, s.p99, s.max);
+}
+
+void bench_sejf_sojourn()
+{
+    std::printf("sejf_sojourn: single server, 90%% jobs of size 1 / 10%% of size 50, estimates +-25%%\n");
+
+    for (double load: { 0.7, 0.9, 0.97 }) {
+        const std::vector<sim_job> jobs = make_arrivals(200000, load, 42);
+
+        std::printf(" load %.2f\n", load);
+        print_sojourn("fifo", simulate(jobs, fifo_storage<sim_job>()));
+        print_sojourn("sejf aging 0", simulate(jobs, sejf_storage<sim_job>(0.0)));
+        print_sojourn("sejf aging 0.1", simulate(jobs, sejf_storage<sim_job>(0.1)));
+        print_sojourn("sejf aging 1", simulate(jobs, sejf_storage<sim_job>(1.0)));
+    }
+}
+
+// ---------------------------------------------------------------------------------------------------------
+// threaded enqueue/dequeue throughput, optionally with per-thread hardware counters.
+
+struct payload {
+    uint64_t value;
+};
+
+struct run_result {
+    double seconds;
+    uint64_t ops;       // enqueues + dequeues
+    perf_counters::sample counters;
+};
+
+/*!
+ * runs n_producers threads each enqueueing per_producer items (in batches of bulk when bulk > 1) against
+ * n_consumers threads dequeueing until every item has been seen.  The queue is unbounded, so nothing drops.
+ */
+run_result run_enq_deq(int n_producers, int n_consumers, uint64_t per_producer, size_t bulk)
+{
+    std::atomic<bool> halt(false);
+    work_queue<payload> q(halt, SIZE_MAX, 1);
+
+    const uint64_t total = per_producer * n_producers;
+    std::atomic<uint64_t> consumed(0);
+    std::atomic<int> ready(0);
+    std::atomic<bool> go(false);
+
+    std::mutex counters_mutex;
+    perf_counters::sample counters;
+
+    auto counted = [&](std::function<void()> body) {
+        std::unique_ptr<perf_counters> pc(with_perf ? new perf_counters : nullptr);
+        ready++;
+        while (!go) std::this_thread::yield();
+        if (pc) pc->start();
+        body();
+        if (pc) {
+            perf_counters::sample s = pc->stop();
+            std::unique_lock<std::mutex> l(counters_mutex);
+            counters += s;
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (int p = 0; p < n_producers; p++) {
+        threads.emplace_back(counted, [&]{
+            std::vector<std::unique_ptr<payload> > batch;
+            for (uint64_t i = 0; i < per_producer; i++) {
+                if (bulk <= 1) {
+                    q.enqueue(std::unique_ptr<payload>(new payload{ i }));
+                    continue;
+                }
+                batch.emplace_back(new payload{ i });
+                if (batch.size() == bulk || i + 1 == per_producer) {
+                    q.enqueue(batch);
+                    batch.clear();
+                }
+            }
+        });
+    }
+    for (int c = 0; c < n_consumers; c++) {
+        threads.emplace_back(counted, [&]{
+            while (std::unique_ptr<payload> item = q.dequeue()) {
+                q.finished();
+                if (++consumed == total) halt = true;
+            }
+        });
+    }
+
+    while (ready < n_producers + n_consumers) std::this_thread::yield();
+    const auto started = std::chrono::steady_clock::now();
+    go = true;
+
+    for (auto & thread: threads) thread.join();
+    const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - started;
+
+    return run_result{ elapsed.count(), 2 * total, counters };
+}
+
+void print_run(const char * label, const run_result & r)
+{
+    std::printf("  %-22s %8.2f Mops/s", label, r.ops / r.seconds / 1e6);
+    if (with_perf) {
+        for (int e = 0; e < perf_counters::n_events; e++) {
+            if (r.counters.valid[e])
+                std::printf("  %s/op %8.3f", perf_counters::name(e), double(r.counters.value[e]) / r.ops);
+            else
+                std::printf("  %s/op      n/a", perf_counters::name(e));
+        }
+    }
+    std::printf("\n");
+}
+
+void bench_enq_deq()
+{
+    if (with_perf && !perf_counters().available())
+        std::printf("(perf_event_open unavailable here -- only context switches are counted)\n");
+
+    std::printf("enq_deq: 1M items per run, unbounded queue\n");
+    print_run("1 producer 1 consumer", run_enq_deq(1, 1, 1000000, 1));
+    print_run("4 producers 4 consumers", run_enq_deq(4, 4, 250000, 1));
+    print_run("4p 4c bulk 64", run_enq_deq(4, 4, 250000, 64));
+    print_run("1 producer 8 consumers", run_enq_deq(1, 8, 1000000, 1));
+}
+
+// ---------------------------------------------------------------------------------------------------------
+// single-thread cost of an owner cycling items through its own queue: pop one, push it back.
+
+template <class Pop, class Push>
+double ns_per_cycle(uint64_t cycles, Pop pop, Push push)
+{
+    const auto started = std::chrono::steady_clock::now();
+    for (uint64_t i = 0; i < cycles; i++)
+        push(pop());
+    const std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - started;
+    return elapsed.count() / cycles;
+}
+
+void bench_owner_only()
+{
+    const uint64_t cycles = 10000000;
+    const int depth = 16;
+    std::atomic<bool> halt(false);
+
+    std::printf("owner_only: one thread, %d items cycling, pop + push per cycle\n", depth);
+
+    std::deque<std::unique_ptr<payload> > plain;
+    for (int i = 0; i < depth; i++) plain.emplace_back(new payload{ uint64_t(i) });
+    std::printf("  %-22s %8.2f ns/cycle\n", "std::deque", ns_per_cycle(cycles,
+        [&]{ std::unique_ptr<payload> p = std::move(plain.front()); plain.pop_front(); return p; },
+        [&](std::unique_ptr<payload> p){ plain.push_back(std::move(p)); }));
+
+    biased_queue<payload> biased(halt);
+    for (int i = 0; i < depth; i++) biased.enqueue(std::unique_ptr<payload>(new payload{ uint64_t(i) }));
+    std::printf("  %-22s %8.2f ns/cycle\n", "biased_queue", ns_per_cycle(cycles,
+        [&]{ return biased.dequeue(); },
+        [&](std::unique_ptr<payload> p){ biased.enqueue(std::move(p)); }));
+
+    work_queue<payload> locked(halt);
+    for (int i = 0; i < depth; i++) locked.enqueue(std::unique_ptr<payload>(new payload{ uint64_t(i) }));
+    std::printf("  %-22s %8.2f ns/cycle\n", "work_queue", ns_per_cycle(cycles,
+        [&]{ std::unique_ptr<payload> p = locked.dequeue(); locked.finished(); return p; },
+        [&](std::unique_ptr<payload> p){ locked.enqueue(std::move(p)); }));
+}
+
+// ---------------------------------------------------------------------------------------------------------
+// LIFO scaling: threads each pushing then popping, work_stack against a mutex-guarded std::vector.
+
+class locked_vector_stack
+{
+public:
+    void enqueue(std::unique_ptr<payload> p) {
+        std::unique_lock<std::mutex> l(m);
+        items.push_back(std::move(p));
+    }
+    std::unique_ptr<payload> dequeue() {
+        std::unique_lock<std::mutex> l(m);
+        if (items.empty()) return std::unique_ptr<payload>{};
+        std::unique_ptr<payload> p = std::move(items.back());
+        items.pop_back();
+        return p;
+    }
+private:
+    std::mutex m;
+    std::vector<std::unique_ptr<payload> > items;
+};
+
+// each thread keeps `held` items of its own in flight, so pops never find the stack empty.
+template <class Stack>
+double mops_push_pop(Stack & stack, int n_threads, uint64_t per_thread)
+{
+    std::vector<std::thread> threads;
+    const auto started = std::chrono::steady_clock::now();
+    for (int t = 0; t < n_threads; t++) {
+        threads.emplace_back([&]{
+            std::unique_ptr<payload> held(new payload{ 0 });
+            for (uint64_t i = 0; i < per_thread; i++) {
+                stack.enqueue(std::move(held));
+                while (!(held = stack.dequeue())) { }
+            }
+        });
+    }
+    for (auto & thread: threads) thread.join();
+    const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - started;
+    return 2.0 * n_threads * per_thread / elapsed.count() / 1e6;
+}
+
+void bench_lifo_scaling()
+{
+    const uint64_t per_thread = 1000000;
+    std::printf("lifo_scaling: threads alternating push and pop, Mops/s (higher is better)\n");
+
+    for (int n_threads: { 1, 2, 4, 8, 16 }) {
+        std::atomic<bool> halt(false);
+        work_stack<payload> lock_free(halt);
+        locked_vector_stack locked;
+
+        const double stack_mops = mops_push_pop(lock_free, n_threads, per_thread);
+        const double vector_mops = mops_push_pop(locked, n_threads, per_thread);
+        std::printf("  %2d threads   work_stack %7.2f   mutex+vector %7.2f   eliminated %5.1f%%\n", n_threads,
+                    stack_mops, vector_mops, 100.0 * lock_free.eliminated() / (n_threads * per_thread));
+    }
+}
+
+// ---------------------------------------------------------------------------------------------------------
+// priority scaling: multi_queue against a single mutex-guarded heap, for throughput and for rank error --
+// how many queued items were better than the one a dequeue returned (0 for an exact priority queue).
+
+struct ranked {
+    uint64_t key;
+    double priority() const { return double(key); }
+};
+
+class locked_heap
+{
+public:
+    void enqueue(std::unique_ptr<ranked> p) {
+        std::unique_lock<std::mutex> l(m);
+        items.push_back(std::move(p));
+        std::push_heap(items.begin(), items.end(), later);
+    }
+    std::unique_ptr<ranked> dequeue() {
+        std::unique_lock<std::mutex> l(m);
+        if (items.empty()) return std::unique_ptr<ranked>{};
+        std::pop_heap(items.begin(), items.end(), later);
+        std::unique_ptr<ranked> p = std::move(items.back());
+        items.pop_back();
+        return p;
+    }
+private:
+    static bool later(const std::unique_ptr<ranked> & a, const std::unique_ptr<ranked> & b) { return a->key > b->key; }
+    std::mutex m;
+    std::vector<std::unique_ptr<ranked> > items;
+};
+
+// each thread keeps one item in flight, re-enqueued with a fresh random key, over a prefilled queue.
+template <class Queue>
+double mops_priority(Queue & q, int n_threads, uint64_t per_thread)
+{
+    std::vector<std::thread> threads;
+    const auto started = std::chrono::steady_clock::now();
+    for (int t = 0; t < n_threads; t++) {
+        threads.emplace_back([&, t]{
+            std::mt19937_64 random(t);
+            std::unique_ptr<ranked> held(new ranked{ 0 });
+            for (uint64_t i = 0; i < per_thread; i++) {
+                held->key = random() >> 16;
+                q.enqueue(std::move(held));
+                while (!(held = q.dequeue())) { }
+            }
+        });
+    }
+    for (auto & thread: threads) thread.join();
+    const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - started;
+    return 2.0 * n_threads * per_thread / elapsed.count() / 1e6;
+}
+
+struct rank_error {
+    double mean;
+    uint64_t max;
+};
+
+// drains n distinct keys from a queue sized for n_threads, counting for every dequeue the keys still queued
+// below it (with a Fenwick tree).  A single consumer drains, so this is the error of the two-choice sampling
+// itself; concurrent consumers add at most the few items other threads have in hand.  Draining with several
+// threads and ordering them by a ticket would mostly measure preemption between pop and ticket instead.
+rank_error measure_rank_error(int n_threads, size_t c, uint64_t n)
+{
+    std::atomic<bool> halt(false);
+    multi_queue<ranked> q(halt, SIZE_MAX, 10, n_threads, c);
+
+    std::vector<uint64_t> keys(n);
+    for (uint64_t i = 0; i < n; i++) keys[i] = i;
+    std::shuffle(keys.begin(), keys.end(), std::mt19937_64(1));
+    for (uint64_t key: keys) q.enqueue(std::unique_ptr<ranked>(new ranked{ key }));
+
+    std::vector<uint64_t> removed(n + 1, 0);     // Fenwick tree over keys already dequeued
+    uint64_t total = 0, worst = 0;
+    for (uint64_t i = 0; i < n; i++) {
+        const uint64_t key = q.dequeue()->key;
+        uint64_t removed_below = 0;
+        for (uint64_t k = key; k > 0; k -= k & (~k + 1)) removed_below += removed[k];
+        const uint64_t error = key - removed_below;
+        total += error;
+        worst = std::max(worst, error);
+        for (uint64_t k = key + 1; k <= n; k += k & (~k + 1)) removed[k]++;
+    }
+    return rank_error{ double(total) / n, worst };
+}
+
+void bench_priority_scaling()
+{
+    const uint64_t per_thread = 500000, prefill = 100000;
+    std::printf("priority_scaling: threads alternating enqueue and dequeue-min over %llu items, Mops/s\n",
+                static_cast<unsigned long long>(prefill));
+
+    for (int n_threads: { 1, 2, 4, 8, 16 }) {
+        std::atomic<bool> halt(false);
+        multi_queue<ranked> relaxed(halt, SIZE_MAX, 10, n_threads);
+        locked_heap exact;
+        std::mt19937_64 random(0);
+        for (uint64_t i = 0; i < prefill; i++) {
+            const uint64_t key = random() >> 16;
+            relaxed.enqueue(std::unique_ptr<ranked>(new ranked{ key }));
+            exact.enqueue(std::unique_ptr<ranked>(new ranked{ key }));
+        }
+
+        const double relaxed_mops = mops_priority(relaxed, n_threads, per_thread);
+        const double exact_mops = mops_priority(exact, n_threads, per_thread);
+        std::printf("  %2d threads   multi_queue %7.2f   mutex+heap %7.2f\n", n_threads, relaxed_mops, exact_mops);
+    }
+
+    std::printf("priority_scaling: rank error draining 1000000 distinct keys, one consumer (0 = exact order)\n");
+    for (int n_threads: { 1, 4, 16 }) {
+        for (size_t c: { 2, 4 }) {
+            const rank_error e = measure_rank_error(n_threads, c, 1000000);
+            std::printf("  %2d threads, c=%zu (%3zu heaps)   mean %8.2f   max %6llu\n", n_threads, c,
+                        n_threads * c, e.mean, static_cast<unsigned long long>(e.max));
+        }
+    }
+}
+
+// ---------------------------------------------------------------------------------------------------------
+// affinity locality: consumers each caching the state of the customers they served last, fed by a shared
+// work_queue against an affinity_queue; reports each consumer's cache hit rate and share of local items.
+
+struct customer_order {
+    uint64_t customer;
+    uint64_t affinity_key() const { return customer; }
+};
+
+// an LRU set of customer ids, standing in for a consumer's cached per-customer state.
+class lru_keys
+{
+public:
+    explicit lru_keys(size_t capacity) : capacity(capacity) { }
+
+    // returns whether key was cached, and makes it the most recent.
+    bool touch(uint64_t key) {
+        auto at = where.find(key);
+        if (at != where.end()) {
+            order.splice(order.begin(), order, at->second);
+            return true;
+        }
+        order.push_front(key);
+        where[key] = order.begin();
+        if (order.size() > capacity) {
+            where.erase(order.back());
+            order.pop_back();
+        }
+        return false;
+    }
+
+private:
+    size_t capacity;
+    std::list<uint64_t> order;
+    std::unordered_map<uint64_t, std::list<uint64_t>::iterator> where;
+};
+
+// runs n_consumers threads, each dequeuing with dequeue(consumer index) and counting its cache hits.
+template <class Dequeue, class Enqueue>
+std::vector<double> hit_rates(size_t n_consumers, size_t n_items, uint64_t n_customers, size_t cache_size,
+                              std::atomic<bool> & halt, Dequeue dequeue, Enqueue enqueue)
+{
+    std::vector<uint64_t> hits(n_consumers, 0), served(n_consumers, 0);
+    std::atomic<size_t> done(0);
+    std::vector<std::thread> consumers;
+    for (size_t c = 0; c < n_consumers; c++) {
+        consumers.emplace_back([&, c]{
+            lru_keys cache(cache_size);
+            while (std::unique_ptr<customer_order> o = dequeue(c)) {
+                if (cache.touch(o->customer)) hits[c]++;
+                served[c]++;
+                done++;
+            }
+        });
+    }
+
+    std::mt19937_64 random(3);
+    for (size_t i = 0; i < n_items; i++)
+        enqueue(std::unique_ptr<customer_order>(new customer_order{ random() % n_customers }));
+    while (done < n_items)
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    halt = true;
+    for (auto & consumer: consumers) consumer.join();
+
+    std::vector<double> rates;
+    for (size_t c = 0; c < n_consumers; c++)
+        rates.push_back(served[c] ? double(hits[c]) / served[c] : 0.0);
+    return rates;
+}
+
+void bench_affinity_locality()
+{
+    const size_t n_consumers = 4, n_items = 400000, cache_size = 256;
+    const uint64_t n_customers = 1000;
+    std::printf("affinity_locality: %zu consumers, %llu customers, %zu cached per consumer, cache hit rate\n",
+                n_consumers, static_cast<unsigned long long>(n_customers), cache_size);
+
+    {
+        std::atomic<bool> halt(false);
+        work_queue<customer_order> shared(halt, SIZE_MAX, 10);
+        const std::vector<double> rates = hit_rates(n_consumers, n_items, n_customers, cache_size, halt,
+            [&](size_t){ std::unique_ptr<customer_order> o = shared.dequeue(); shared.finished(); return o; },
+            [&](std::unique_ptr<customer_order> o){ shared.enqueue(std::move(o)); });
+        std::printf("  %-22s", "work_queue");
+        for (double rate: rates) std::printf("  %5.1f%%", 100 * rate);
+        std::printf("\n");
+    }
+
+    for (size_t threshold: { 8, 64, 1024 }) {
+        std::atomic<bool> halt(false);
+        affinity_queue<customer_order> affine(halt, n_consumers, threshold, SIZE_MAX, 10);
+        const std::vector<double> rates = hit_rates(n_consumers, n_items, n_customers, cache_size, halt,
+            [&](size_t c){ return affine.dequeue(c); },
+            [&](std::unique_ptr<customer_order> o){ affine.enqueue(std::move(o)); });
+        const std::string label = "affinity, steal > " + std::to_string(threshold);
+        std::printf("  %-22s", label.c_str());
+        for (double rate: rates) std::printf("  %5.1f%%", 100 * rate);
+        std::printf("   local");
+        for (const auto & l: affine.snapshot()) std::printf(" %5.1f%%", 100 * l.local_fraction);
+        std::printf("\n");
+    }
+}
+
+// ---------------------------------------------------------------------------------------------------------
+// slack wakeups: a producer emitting small bursts to idle consumers, with and without a latency slack;
+// reports the process's context switches per item (getrusage) and the items' queueing latency.
+
+struct stamped {
+    std::chrono::steady_clock::time_point enqueued;
+};
+
+uint64_t context_switches()
+{
+    rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return static_cast<uint64_t>(usage.ru_nvcsw + usage.ru_nivcsw);
+}
+
+void bench_slack_wakeups()
+{
+    const int n_consumers = 4, n_bursts = 4000, burst = 5;
+    const auto burst_gap = std::chrono::microseconds(500);
+    std::printf("slack_wakeups: %d consumers, bursts of %d items every %lldus\n", n_consumers, burst,
+                static_cast<long long>(burst_gap.count()));
+
+    const std::pair<int, size_t> settings[] = { { 0, 0 }, { 1000, 64 }, { 5000, 64 }, { 5000, 1000000 } };
+    for (const auto & setting: settings) {
+        std::atomic<bool> halt(false);
+        work_queue<stamped> q(halt, SIZE_MAX, 10);
+        if (setting.first > 0) q.setLatencySlack(std::chrono::microseconds(setting.first), setting.second);
+
+        std::vector<std::vector<double> > latencies(n_consumers);
+        std::atomic<int> served(0);
+        std::vector<std::thread> consumers;
+        for (int c = 0; c < n_consumers; c++) {
+            consumers.emplace_back([&, c]{
+                while (std::unique_ptr<stamped> item = q.dequeue()) {
+                    const std::chrono::duration<double, std::micro> waited =
+                        std::chrono::steady_clock::now() - item->enqueued;
+                    latencies[c].push_back(waited.count());
+                    q.finished();
+                    served++;
+                }
+            });
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+
+        const uint64_t switches_before = context_switches();
+        auto next = std::chrono::steady_clock::now();
+        for (int b = 0; b < n_bursts; b++) {
+            std::this_thread::sleep_until(next);
+            next += burst_gap;
+            for (int i = 0; i < burst; i++)
+                q.enqueue(std::unique_ptr<stamped>(new stamped{ std::chrono::steady_clock::now() }));
+        }
+        while (served < n_bursts * burst)
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        const uint64_t switches = context_switches() - switches_before;
+        halt = true;
+        for (auto & consumer: consumers) consumer.join();
+
+        std::vector<double> all;
+        for (auto & mine: latencies) all.insert(all.end(), mine.begin(), mine.end());
+        const sojourn_summary summary = summarize(all);
+        const std::string label = setting.first == 0 ? std::string("no slack")
+            : "slack " + std::to_string(setting.first) + "us" +
+              (setting.second < 1000000 ? ", batch " + std::to_string(setting.second) : std::string(""));
+        std::printf("  %-22s %6.2f switches/item   latency mean %8.1f  p50 %8.1f  p99 %8.1f us\n", label.c_str(),
+                    double(switches) / all.size(), summary.mean, summary.p50, summary.p99);
+    }
+}
+
+// ---------------------------------------------------------------------------------------------------------
+// wake order: a light load spread over many consumers, reporting each consumer's utilization -- the share of
+// the run it spent serving items -- under each wake_order.
+
+void bench_wake_order()
+{
+    const int n_consumers = 8, n_items = 5000;
+    const auto gap = std::chrono::microseconds(200), service = std::chrono::microseconds(20);
+    std::printf("wake_order: %d consumers, an item every %lldus taking %lldus, utilization per consumer\n",
+                n_consumers, static_cast<long long>(gap.count()), static_cast<long long>(service.count()));
+
+    const std::pair<const char *, wake_order> orders[] = {
+        { "any", wake_order::any }, { "fifo", wake_order::fifo }, { "lifo", wake_order::lifo } };
+    for (const auto & order: orders) {
+        std::atomic<bool> halt(false);
+        work_queue<payload> q(halt, SIZE_MAX, 10);
+        q.setWakeOrder(order.second);
+
+        std::vector<std::chrono::steady_clock::duration> busy(n_consumers);
+        std::atomic<int> served(0), last(-1), repeats(0);   // repeats: items served by the previous item's consumer
+        std::vector<std::thread> consumers;
+        for (int c = 0; c < n_consumers; c++) {
+            consumers.emplace_back([&, c]{
+                while (std::unique_ptr<payload> item = q.dequeue()) {
+                    if (last.exchange(c) == c) repeats++;
+                    const auto started = std::chrono::steady_clock::now();
+                    while (std::chrono::steady_clock::now() - started < service) { }
+                    busy[c] += std::chrono::steady_clock::now() - started;
+                    served++;
+                }
+            });
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+
+        const auto started = std::chrono::steady_clock::now();
+        auto next = started;
+        for (int i = 0; i < n_items; i++) {
+            std::this_thread::sleep_until(next);
+            next += gap;
+            q.enqueue(std::unique_ptr<payload>(new payload{ uint64_t(i) }));
+        }
+        while (served < n_items)
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        const auto elapsed = std::chrono::steady_clock::now() - started;
+        halt = true;
+        for (auto & consumer: consumers) consumer.join();
+
+        std::printf("  %-6s", order.first);
+        int idle = 0;
+        for (const auto & b: busy) {
+            const double utilization = 100.0 * b.count() / elapsed.count();
+            std::printf(" %5.1f%%", utilization);
+            if (utilization < 0.5) idle++;
+        }
+        std::printf("   (%d under 0.5%%, %4.1f%% served by the previous item's consumer)\n", idle,
+                    100.0 * repeats / n_items);
+    }
+}
+
+// ---------------------------------------------------------------------------------------------------------
+// logging: the cost a log call puts on the calling thread, writing to /dev/null, for synchronous logging
+// (fprintf under a lock), enqueueing a formatted std::string to a consumer, and async_logger.
+
+struct log_cost {
+    double wall_ns;     // per call, as the logging thread saw it
+    double cpu_ns;      // per call, the logging thread's own CPU time: what the call costs, less any preemption
+};
+
+double thread_cpu_ns()
+{
+    timespec now;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+    return now.tv_sec * 1e9 + now.tv_nsec;
+}
+
+template <class Log>
+log_cost log_call_cost(int n_threads, int per_thread, Log log)
+{
+    std::vector<log_cost> totals(n_threads);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < n_threads; t++) {
+        threads.emplace_back([&, t]{
+            log(-1);    // warm up: async_logger allocates the thread's batches on its first call
+            const auto started = std::chrono::steady_clock::now();
+            const double cpu_started = thread_cpu_ns();
+            for (int i = 0; i < per_thread; i++)
+                log(i);
+            totals[t].cpu_ns = thread_cpu_ns() - cpu_started;
+            totals[t].wall_ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - started).count();
+        });
+    }
+    for (auto & thread: threads) thread.join();
+
+    log_cost cost{ 0, 0 };
+    for (const log_cost & total: totals) {
+        cost.wall_ns += total.wall_ns / (double(n_threads) * per_thread);
+        cost.cpu_ns += total.cpu_ns / (double(n_threads) * per_thread);
+    }
+    return cost;
+}
+
+void print_log_cost(const char * label, const log_cost & cost, double dropped = 0)
+{
+    std::printf("    %-32s wall %8.1f  cpu %8.1f ns/call   (%.1f%% dropped)\n", label, cost.wall_ns, cost.cpu_ns,
+                100.0 * dropped);
+}
+
+void bench_async_log()
+{
+    const int per_thread = 200000;
+    const char * customer = "acme";
+    std::printf("async_log: cost of a log call on the logging thread, \"order %%d for %%s: %%.2f\" to /dev/null\n");
+
+    for (int n_threads: { 1, 4 }) {
+        std::printf("  %d thread%s\n", n_threads, n_threads == 1 ? "" : "s");
+
+        FILE * null_file = std::fopen("/dev/null", "w");
+        std::mutex file_m;
+        print_log_cost("fprintf under a lock", log_call_cost(n_threads, per_thread, [&](int i){
+            std::lock_guard<std::mutex> l(file_m);
+            std::fprintf(null_file, "order %d for %s: %.2f\n", i, customer, i * 0.5);
+        }));
+        std::fclose(null_file);
+
+        const int null_fd = ::open("/dev/null", O_WRONLY);
+        {
+            std::atomic<bool> halt(false);
+            work_queue<std::string> q(halt, SIZE_MAX, 10);
+            std::thread writer([&]{
+                while (std::unique_ptr<std::string> line = q.dequeue())
+                    if (::write(null_fd, line->data(), line->size()) < 0) break;
+            });
+            print_log_cost("formatted std::string enqueued", log_call_cost(n_threads, per_thread, [&](int i){
+                char line[128];
+                const int n = std::snprintf(line, sizeof(line), "order %d for %s: %.2f\n", i, customer, i * 0.5);
+                q.enqueue(std::unique_ptr<std::string>(new std::string(line, n)));
+            }));
+            while (!q.empty()) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            halt = true;
+            writer.join();
+        }
+
+        // the burst: batches enough for every call, so the calls never wait for the consumer -- the capture
+        // cost alone.  block and drop: the default four batches per thread, so the calls keep pace with it.
+        const std::pair<const char *, log_overflow> settings[] = {
+            { "async_logger, burst", log_overflow::block },
+            { "async_logger, block", log_overflow::block },
+            { "async_logger, drop", log_overflow::drop } };
+        for (const auto & setting: settings) {
+            async_logger::params p;
+            p.overflow = setting.second;
+            if (setting.first == settings[0].first)
+                p.batches_per_thread = per_thread / p.records_per_batch + 1;
+            async_logger logger(async_logger::fd_sink(null_fd), p);
+            const log_cost cost = log_call_cost(n_threads, per_thread, [&](int i){
+                logger.log("order %d for %s: %.2f", i, customer, i * 0.5);
+            });
+            logger.flush();
+            const int dropped = logger.dropped();
+            print_log_cost(setting.first, cost, dropped / (double(n_threads) * per_thread));
+        }
+        ::close(null_fd);
+    }
+}
+
+// ---------------------------------------------------------------------------------------------------------
+// batching: items for 1000 destinations, where a send costs a fixed overhead plus a little per item, sent one
+// by one by the consumers of a work_queue, or in batches gathered by a batch_stage.
+
+struct routed {
+    int dest;
+    int destination() const { return dest; }
+};
+
+void spin_for(std::chrono::nanoseconds d)
+{
+    const auto started = std::chrono::steady_clock::now();
+    while (std::chrono::steady_clock::now() - started < d) { }
+}
+
+void bench_batch_stage()
+{
+    const int n_destinations = 1000, n_items = 100000, n_consumers = 4;
+    const std::chrono::nanoseconds send_overhead = std::chrono::microseconds(4), per_item(200);
+    std::printf("batch_stage: %d items over %d destinations, %d consumers, a send costing %lldus + %lldns per item\n",
+                n_items, n_destinations, n_consumers, static_cast<long long>(send_overhead.count() / 1000),
+                static_cast<long long>(per_item.count()));
+
+    std::mt19937 rng(7);
+    std::uniform_int_distribution<int> pick(0, n_destinations - 1);
+    std::vector<int> destinations(n_items);
+    for (int & d: destinations) d = pick(rng);
+
+    {
+        std::atomic<bool> halt(false);
+        work_queue<routed> q(halt, SIZE_MAX, 10);
+        std::atomic<int> sent(0);
+        std::vector<std::thread> consumers;
+        for (int c = 0; c < n_consumers; c++)
+            consumers.emplace_back([&]{
+                while (std::unique_ptr<routed> item = q.dequeue()) {
+                    spin_for(send_overhead + per_item);
+                    sent++;
+                }
+            });
+
+        const auto started = std::chrono::steady_clock::now();
+        for (int d: destinations) q.enqueue(std::unique_ptr<routed>(new routed{ d }));
+        while (sent < n_items) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - started;
+        halt = true;
+        for (auto & consumer: consumers) consumer.join();
+        std::printf("  %-34s %9.0f items/s   %7.1f items/send\n", "item by item", n_items / elapsed.count(), 1.0);
+    }
+
+    const std::pair<size_t, size_t> settings[] = { { 64, SIZE_MAX }, { 64, 8000 }, { 16, SIZE_MAX } };
+    for (const auto & setting: settings) {
+        std::atomic<bool> halt(false);
+        work_queue<routed> q(halt, SIZE_MAX, 10);
+        batch_stage<routed> stage(q, halt, setting.first, std::chrono::milliseconds(20), setting.second);
+        std::atomic<int> sent(0), sends(0);
+        std::vector<std::thread> consumers;
+        for (int c = 0; c < n_consumers; c++)
+            consumers.emplace_back([&]{
+                while (std::unique_ptr<batch_stage<routed>::batch> b = stage.dequeue()) {
+                    spin_for(send_overhead + per_item * b->items.size());
+                    sent += static_cast<int>(b->items.size());
+                    sends++;
+                }
+            });
+
+        const auto started = std::chrono::steady_clock::now();
+        for (int d: destinations) q.enqueue(std::unique_ptr<routed>(new routed{ d }));
+        while (sent < n_items) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - started;
+        const batch_stage<routed>::stats s = stage.snapshot();
+        halt = true;
+        for (auto & consumer: consumers) consumer.join();
+
+        const std::string label = "batch " + std::to_string(setting.first) + ", linger 20ms" +
+            (setting.second < SIZE_MAX ? ", max " + std::to_string(setting.second) : std::string(""));
+        std::printf("  %-34s %9.0f items/s   %7.1f items/send   (released by size %llu, linger %llu, memory %llu)\n",
+                    label.c_str(), n_items / elapsed.count(), double(n_items) / sends,
+                    static_cast<unsigned long long>(s.released_by_size),
+                    static_cast<unsigned long long>(s.released_by_linger),
+                    static_cast<unsigned long long>(s.released_by_memory));
+    }
+}
+
+// ---------------------------------------------------------------------------------------------------------
+// run-next: chains of messages, each hop touching its chain's state and submitting the next hop, on a
+// work_pool with the run-next slots off (every hop through the queue) and on.
+
+struct chain_hop {
+    int chain;
+    int n;
+};
+
+void bench_run_next()
+{
+    const int n_workers = 4, n_chains = 32, n_hops = 2000, state_words = 4096;
+    std::printf("run_next: %d workers, %d chains of %d hops, each hop summing its chain's %dKB of state\n",
+                n_workers, n_chains, n_hops, int(state_words * sizeof(uint64_t) / 1024));
+
+    for (size_t limit: { size_t(0), size_t(8), size_t(64) }) {
+        std::vector<std::vector<uint64_t> > state(n_chains, std::vector<uint64_t>(state_words, 1));
+        std::atomic<bool> halt(false);
+        std::atomic<int> finished_chains(0);
+        std::atomic<uint64_t> checksum(0);
+        work_queue<chain_hop> q(halt, SIZE_MAX, 10);
+
+        work_pool<chain_hop> * pool_of_hops = nullptr;
+        work_pool<chain_hop> pool(q, n_workers, [&](std::unique_ptr<chain_hop> h) {
+            uint64_t sum = 0;
+            for (uint64_t & word: state[h->chain]) sum += ++word;
+            checksum += sum & 1;
+            if (h->n + 1 < n_hops)
+                pool_of_hops->submit(std::unique_ptr<chain_hop>(new chain_hop{ h->chain, h->n + 1 }));
+            else
+                finished_chains++;
+        });
+        pool_of_hops = &pool;
+        pool.setRunNextLimit(limit);
+
+        const auto started = std::chrono::steady_clock::now();
+        for (int c = 0; c < n_chains; c++)
+            q.enqueue(std::unique_ptr<chain_hop>(new chain_hop{ c, 0 }));
+        while (finished_chains < n_chains)
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - started;
+        const work_pool<chain_hop>::stats s = pool.snapshot();
+        halt = true;
+        pool.join();
+
+        const std::string label = limit == 0 ? std::string("run-next off") : "run-next limit " + std::to_string(limit);
+        std::printf("  %-22s %9.0f hops/s   %5.1f%% from a slot   (%llu yielded)\n", label.c_str(),
+                    n_chains * n_hops / elapsed.count(), 100.0 * s.run_next / (double(n_chains) * n_hops),
+                    static_cast<unsigned long long>(s.run_next_yielded));
+    }
+}
+
+// ---------------------------------------------------------------------------------------------------------
+// adaptive backends: producer/consumer pairs through adaptive_queue pinned to each backend, and left to switch.
+
+struct adaptive_run {
+    double mops;
+    adaptive_backend final_backend;
+    uint64_t migrations;
+};
+
+adaptive_run run_adaptive(int n_pairs, uint64_t per_producer, const adaptive_params & p, adaptive_backend start)
+{
+    std::atomic<bool> halt(false), go(false);
+    adaptive_queue<payload> q(halt, SIZE_MAX, 10, p);
+    q.setBackend(start);
+
+    const uint64_t total = n_pairs * per_producer;
+    std::atomic<uint64_t> consumed(0);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < n_pairs; t++) {
+        threads.emplace_back([&]{
+            while (!go) std::this_thread::yield();
+            for (uint64_t i = 0; i < per_producer; i++)
+                q.enqueue(std::unique_ptr<payload>(new payload{ i }));
+        });
+        threads.emplace_back([&]{
+            while (!go) std::this_thread::yield();
+            while (std::unique_ptr<payload> item = q.dequeue()) {
+                if (++consumed == total) halt = true;
+            }
+        });
+    }
+
+    const auto started = std::chrono::steady_clock::now();
+    go = true;
+    for (auto & thread: threads) thread.join();
+    const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - started;
+
+    return adaptive_run{ 2 * total / elapsed.count() / 1e6, q.getBackend(), q.migrations() };
+}
+
+void bench_adaptive()
+{
+    const uint64_t total = 800000;
+    std::printf("adaptive: producer/consumer pairs moving %llu items, Mops/s\n", static_cast<unsigned long long>(total));
+
+    adaptive_params pinned;
+    pinned.persist = 1 << 20;
+    for (int n_pairs: { 1, 2, 4, 8 }) {
+        const uint64_t per_producer = total / n_pairs;
+        const adaptive_run on_mutex = run_adaptive(n_pairs, per_producer, pinned, adaptive_backend::mutex);
+        const adaptive_run on_shards = run_adaptive(n_pairs, per_producer, pinned, adaptive_backend::sharded);
+        const adaptive_run adaptive = run_adaptive(n_pairs, per_producer, adaptive_params(), adaptive_backend::mutex);
+        std::printf("  %d pairs   mutex %6.2f   sharded %6.2f   adaptive %6.2f (ended %s, %llu switches)\n", n_pairs,
+                    on_mutex.mops, on_shards.mops, adaptive.mops,
+                    adaptive.final_backend == adaptive_backend::mutex ? "mutex" : "sharded",
+                    static_cast<unsigned long long>(adaptive.migrations));
+    }
+}
+
+// ---------------------------------------------------------------------------------------------------------
+// deterministic simulation: work_queue under sim_scheduler, reporting virtual latencies that replay exactly.
+
+void print_sim(const char * label, const sim_result & r)
+{
+    auto us = [](sim_scheduler::duration d){ return std::chrono::duration<double, std::micro>(d).count(); };
+    std::printf("  %-22s mean %8.2f  p50 %8.2f  p99 %8.2f  max %9.2f us  (%zu items, %llu dropped)\n", label,
+                us(r.mean()), us(r.percentile(0.5)), us(r.percentile(0.99)), us(r.percentile(1.0)),
+                r.latencies.size(), static_cast<unsigned long long>(r.dropped));
+}
+
+void bench_sim_wakeup()
+{
+    sim_scenario scenario;
+    scenario.producers = 4;
+    scenario.consumers = 4;
+    scenario.items_per_producer = 5000;
+    scenario.mean_interarrival = std::chrono::microseconds(10);
+    scenario.mean_service = std::chrono::microseconds(8);
+
+    std::printf("sim_wakeup: 4 producers, 4 consumers, load 0.8, virtual time (identical on every run)\n");
+    for (int wakeup_us: { 0, 2, 10, 50 }) {
+        scenario.wakeup_latency = std::chrono::microseconds(wakeup_us);
+        const std::string label = "wakeup " + std::to_string(wakeup_us) + "us";
+        print_sim(label.c_str(), run_sim_scenario(scenario));
+    }
+    scenario.wakeup_latency = std::chrono::microseconds(10);
+    print_sim("wakeup 10us, sejf", run_sim_scenario(scenario, sejf_storage<sim_work_item>(0.1)));
+}
+
+const std::vector<std::pair<std::string, std::function<void()> > > scenarios = {
+    { "sejf_sojourn", bench_sejf_sojourn },
+    { "enq_deq", bench_enq_deq },
+    { "owner_only", bench_owner_only },
+    { "lifo_scaling", bench_lifo_scaling },
+    { "priority_scaling", bench_priority_scaling },
+    { "affinity_locality", bench_affinity_locality },
+    { "slack_wakeups", bench_slack_wakeups },
+    { "wake_order", bench_wake_order },
+    { "async_log", bench_async_log },
+    { "batch_stage", bench_batch_stage },
+    { "run_next", bench_run_next },
+    { "adaptive", bench_adaptive },
+    { "sim_wakeup", bench_sim_wakeup },
+};
+
+} // namespace
+
+int main(int argc, char ** argv)
+{
+    std::vector<std::string> selected;
+    for (int i = 1; i < argc; i++) {
+        if (std::strcmp(argv[i], "--perf") == 0)
+            with_perf = true;
+        else
+            selected.push_back(argv[i]);
+    }
+
+    for (const auto & scenario: scenarios) {
+        if (selected.empty() || std::find(selected.begin(), selected.end(), scenario.first) != selected.end())
+            scenario.second();
+    }
+    return 0;
+}
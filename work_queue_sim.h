@@ -0,0 +1,147 @@
+#ifndef WORK_QUEUE_SIM_H
+#define WORK_QUEUE_SIM_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "work_queue.h"
+#include "sim_sync.h"
+
+/*!
+ * sim_work_item - the work item of a simulated scenario: when it was enqueued and how long serving it takes,
+ * both in virtual time.  expected_cost() lets cost-aware storage policies such as sejf_storage order it.
+ */
+struct sim_work_item {
+    sim_scheduler::duration enqueued_at;
+    sim_scheduler::duration service;
+    double expected_cost() const { return static_cast<double>(service.count()); }
+};
+
+/*!
+ * sim_scenario - producers, consumers and service times for run_sim_scenario.
+ */
+struct sim_scenario {
+    size_t producers = 1;
+    size_t consumers = 1;
+    size_t items_per_producer = 1000;
+    sim_scheduler::duration mean_interarrival = std::chrono::microseconds(10);     // per producer
+    sim_scheduler::duration mean_service = std::chrono::microseconds(5);
+    bool exponential = true;    // exponentially distributed gaps and service times; otherwise fixed at the means
+    sim_scheduler::duration wakeup_latency = sim_scheduler::duration(0);
+    size_t max_depth = SIZE_MAX;
+    int wait_interval_ms = 100;
+    uint64_t seed = 1;
+};
+
+/*!
+ * sim_result - what a scenario run measured, in virtual time.
+ */
+struct sim_result {
+    std::vector<sim_scheduler::duration> latencies;    // enqueue to end of service, ascending
+    uint64_t dropped;
+    sim_scheduler::duration makespan;                  // when the last item's service ended
+
+    sim_scheduler::duration percentile(double p) const {
+        if (latencies.empty()) return sim_scheduler::duration(0);
+        const size_t at = static_cast<size_t>(p * latencies.size());
+        return latencies[std::min(at, latencies.size() - 1)];
+    }
+
+    sim_scheduler::duration mean() const {
+        if (latencies.empty()) return sim_scheduler::duration(0);
+        sim_scheduler::duration total(0);
+        for (auto latency: latencies) total += latency;
+        return total / latencies.size();
+    }
+};
+
+/*!
+ * sim_random - splitmix64, so a seed draws the same numbers with any standard library.
+ */
+class sim_random
+{
+public:
+
+    sim_random(uint64_t seed, uint64_t stream) : state(seed * 0x9e3779b97f4a7c15ULL + stream) { }
+
+    uint64_t next() {
+        uint64_t z = (state += 0x9e3779b97f4a7c15ULL);
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+        return z ^ (z >> 31);
+    }
+
+    // mean itself, or an exponentially distributed duration with that mean.
+    sim_scheduler::duration draw(sim_scheduler::duration mean, bool exponential) {
+        if (!exponential) return mean;
+        const double u = (next() >> 11) * (1.0 / 9007199254740992.0);
+        return sim_scheduler::duration(static_cast<int64_t>(-std::log1p(-u) * mean.count()));
+    }
+
+private:
+
+    uint64_t state;
+};
+
+/*!
+ * run_sim_scenario runs the scenario against a work_queue<sim_work_item, Storage, sim_sync> under a
+ * sim_scheduler and returns the latency distribution.  The same scenario always gives the same result.
+ *
+ * Each producer draws its gaps and its items' service times from its own stream of the seed, so the offered
+ * load doesn't depend on the queue under test.  Consumers serve items until every producer is done and the
+ * queue has drained, when the run halts the queue.
+ */
+template <class Storage = fifo_storage<sim_work_item> >
+sim_result run_sim_scenario(const sim_scenario & scenario, Storage storage = Storage())
+{
+    sim_scheduler scheduler(scenario.wakeup_latency);
+    std::atomic<bool> halt(false);
+    work_queue<sim_work_item, Storage, sim_sync> q(halt, scenario.max_depth, scenario.wait_interval_ms,
+                                                   std::move(storage));
+
+    sim_result result{ {}, 0, sim_scheduler::duration(0) };
+    size_t producing = scenario.producers;
+
+    for (size_t p = 0; p < scenario.producers; p++) {
+        scheduler.spawn([&, p]{
+            sim_random rng(scenario.seed, p);
+            for (size_t i = 0; i < scenario.items_per_producer; i++) {
+                scheduler.sleep_for(rng.draw(scenario.mean_interarrival, scenario.exponential));
+                const sim_scheduler::duration service = rng.draw(scenario.mean_service, scenario.exponential);
+                q.enqueue(std::unique_ptr<sim_work_item>(new sim_work_item{ scheduler.now(), service }));
+            }
+            producing--;
+        });
+    }
+
+    for (size_t c = 0; c < scenario.consumers; c++) {
+        scheduler.spawn([&]{
+            while (std::unique_ptr<sim_work_item> item = q.dequeue()) {
+                scheduler.sleep_for(item->service);
+                result.latencies.push_back(scheduler.now() - item->enqueued_at);
+                result.makespan = scheduler.now();
+                q.finished();
+            }
+        });
+    }
+
+    // halts the queue once all the work is done; polls at the queue's wait interval, off the measured path.
+    scheduler.spawn([&]{
+        while (producing > 0 || q.size() > 0 || q.in_service() > 0)
+            scheduler.sleep_for(std::chrono::milliseconds(scenario.wait_interval_ms));
+        halt = true;
+    });
+
+    scheduler.run();
+
+    result.dropped = q.dropped();
+    std::sort(result.latencies.begin(), result.latencies.end());
+    return result;
+}
+
+#endif // WORK_QUEUE_SIM_H
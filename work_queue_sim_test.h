@@ -0,0 +1,123 @@
+#include <cxxtest/TestSuite.h>
+#include <iostream>
+#include "work_queue_sim.h"
+#include "sejf_storage.h"
+
+
+class work_queue_sim_test : public CxxTest::TestSuite
+{
+public:
+
+    void testScenarioReplaysIdentically(void) {
+        sim_scenario scenario;
+        scenario.producers = 3;
+        scenario.consumers = 4;
+        scenario.items_per_producer = 500;
+        scenario.mean_interarrival = std::chrono::microseconds(8);
+        scenario.mean_service = std::chrono::microseconds(6);
+
+        const sim_result first = run_sim_scenario(scenario);
+        const sim_result second = run_sim_scenario(scenario);
+        TS_ASSERT_EQUALS(first.latencies.size(), 1500);
+        TS_ASSERT(first.latencies == second.latencies);
+        TS_ASSERT_EQUALS(first.makespan, second.makespan);
+
+        scenario.seed = 2;
+        TS_ASSERT(run_sim_scenario(scenario).latencies != first.latencies);
+    }
+
+    void testFixedServiceHasFixedLatency(void) {
+        sim_scenario scenario;
+        scenario.exponential = false;
+        scenario.items_per_producer = 100;
+        scenario.wakeup_latency = std::chrono::microseconds(3);
+
+        TS_TRACE("an idle consumer is woken for each item: latency is wakeup plus service");
+        const sim_result r = run_sim_scenario(scenario);
+        TS_ASSERT_EQUALS(r.percentile(0.0), std::chrono::nanoseconds(8us));
+        TS_ASSERT_EQUALS(r.percentile(1.0), std::chrono::nanoseconds(8us));
+        TS_ASSERT_EQUALS(r.dropped, 0);
+        TS_ASSERT_EQUALS(r.makespan, std::chrono::nanoseconds(1008us));
+    }
+
+    void testAdmissionControlUnderOverload(void) {
+        sim_scheduler scheduler;
+        std::atomic<bool> halt(false);
+        work_queue<int, fifo_storage<int>, sim_sync> q(halt, SIZE_MAX, 1);
+        q.setLatencyBudget(std::chrono::microseconds(300));
+
+        size_t admitted = 0, offered = 0;
+        scheduler.spawn([&]{
+            for (int i = 0; i < 1000; i++) {
+                scheduler.sleep_for(10us);
+                std::unique_ptr<int> item(new int(i));
+                offered++;
+                if (q.try_enqueue(item)) admitted++;
+            }
+            halt = true;
+        });
+        scheduler.spawn([&]{
+            while (std::unique_ptr<int> item = q.dequeue()) {
+                scheduler.sleep_for(50us);
+                q.finished();
+            }
+        });
+        scheduler.run();
+
+        TS_TRACE("offered 5x what one consumer serves: the budget caps the backlog instead of letting it grow");
+        work_queue<int, fifo_storage<int>, sim_sync>::stats s = q.snapshot();
+        TS_ASSERT_DELTA(s.arrival_rate, 100000.0, 1.0);
+        TS_ASSERT_DELTA(s.service_rate, 20000.0, 1.0);
+        TS_ASSERT_DELTA(s.utilization, 5.0, 0.01);
+        TS_ASSERT_LESS_THAN(admitted, offered / 4);
+        TS_ASSERT_LESS_THAN(offered / 6, admitted);
+    }
+
+    // the consumer, by the order it started waiting in, that the first of n_items enqueued is served by.
+    static std::vector<int> served_by(wake_order order, int n_items) {
+        sim_scheduler scheduler;
+        std::atomic<bool> halt(false);
+        work_queue<int, fifo_storage<int>, sim_sync> q(halt, SIZE_MAX, 1);
+        q.setWakeOrder(order);
+
+        std::vector<int> served;
+        for (int c = 0; c < 3; c++) {
+            scheduler.spawn([&, c]{
+                scheduler.sleep_for(std::chrono::microseconds(10 * c));
+                while (std::unique_ptr<int> item = q.dequeue()) {
+                    served.push_back(c);
+                    scheduler.sleep_for(100us);
+                }
+            });
+        }
+        scheduler.spawn([&]{
+            scheduler.sleep_for(2500us);   // every consumer has waited through a few wait intervals
+            for (int i = 0; i < n_items; i++)
+                q.enqueue(std::unique_ptr<int>(new int(i)));
+            scheduler.sleep_for(1ms);
+            halt = true;
+        });
+        scheduler.run();
+        return served;
+    }
+
+    void testWakeOrderChoosesTheConsumer(void) {
+        TS_TRACE("consumers keep their place across wait intervals: 0 has waited longest, 2 least");
+        TS_ASSERT_EQUALS(served_by(wake_order::fifo, 1), std::vector<int>({ 0 }));
+        TS_ASSERT_EQUALS(served_by(wake_order::lifo, 1), std::vector<int>({ 2 }));
+        TS_ASSERT_EQUALS(served_by(wake_order::fifo, 2), std::vector<int>({ 0, 1 }));
+        TS_ASSERT_EQUALS(served_by(wake_order::lifo, 2), std::vector<int>({ 2, 1 }));
+    }
+
+    void testOtherStoragePolicies(void) {
+        sim_scenario scenario;
+        scenario.consumers = 2;
+        scenario.mean_interarrival = std::chrono::microseconds(3);
+
+        const sim_result fifo = run_sim_scenario(scenario);
+        const sim_result sejf = run_sim_scenario(scenario, sejf_storage<sim_work_item>(0.0));
+        TS_ASSERT_EQUALS(sejf.latencies.size(), fifo.latencies.size());
+        TS_ASSERT_LESS_THAN(sejf.mean(), fifo.mean());
+    }
+
+};
@@ -1,5 +1,6 @@
 #include <cxxtest/TestSuite.h>
 #include <iostream>
+#include <thread>
 #define development//_trace
 #include "work_queue.h"
 
@@ -183,6 +184,213 @@ public:
 
     }
 
+    void testBulkLargerThanMax(void) {
+        haltflag = false;
+
+        std::vector<std::unique_ptr<workpiece> > workpease;
+        populate_workpieces(workpease);
+
+        work_queue<workpiece> wpq(haltflag, 4);
+        wpq.enqueue(std::make_unique<workpiece>());
+
+        TS_TRACE("the queued item and the six oldest of the bulk are dropped");
+        wpq.enqueue(workpease);
+        TS_ASSERT_EQUALS(wpq.size(), 4);
+        TS_ASSERT_EQUALS(wpq.dropped(), 7);
+        TS_ASSERT_EQUALS(wpq.dequeue()->intvec[6], 6);
+
+        work_queue<workpiece> nullq(haltflag, 0);
+        nullq.enqueue(std::make_unique<workpiece>());
+        TS_ASSERT_EQUALS(nullq.size(), 0);
+        TS_ASSERT_EQUALS(nullq.dropped(), 1);
+    }
+
+    void testLockFreeQueries(void) {
+        haltflag = false;
+
+        work_queue<int> q(haltflag, 3);
+        TS_ASSERT(q.empty());
+        TS_ASSERT(!q.is_halting());
+
+        std::vector<std::unique_ptr<int> > bulk;
+        for (int i = 0; i < 5; i++)
+            bulk.push_back(std::make_unique<int>(i));
+        q.enqueue(bulk);
+        TS_ASSERT_EQUALS(q.approx_size(), 3);
+
+        q.dequeue();
+        TS_ASSERT_EQUALS(q.approx_size(), q.size());
+        TS_ASSERT(!q.empty());
+
+        TS_TRACE("like size(), approx_size reports 0 while halting");
+        haltflag = true;
+        TS_ASSERT(q.is_halting());
+        TS_ASSERT_EQUALS(q.approx_size(), 0);
+        TS_ASSERT(q.empty());
+        haltflag = false;
+        TS_ASSERT_EQUALS(q.approx_size(), 2);
+    }
+
+    void testAdmissionByPredictedWait(void) {
+        haltflag = false;
+
+        work_queue<int> q(haltflag, SIZE_MAX, 10);
+        q.setLatencyBudget(50ms);
+
+        TS_TRACE("with no service time measured yet, everything is admitted");
+        std::unique_ptr<int> item = std::make_unique<int>(0);
+        TS_ASSERT(q.try_enqueue(item));
+        q.dequeue();
+        std::this_thread::sleep_for(20ms);
+        q.finished();
+
+        TS_TRACE("one consumer taking ~20ms per item: a third item queued would wait ~60ms");
+        for (int i = 1; i <= 2; i++) {
+            item = std::make_unique<int>(i);
+            TS_ASSERT(q.try_enqueue(item));
+        }
+        item = std::make_unique<int>(3);
+        TS_ASSERT(!q.try_enqueue(item));
+        TS_ASSERT_EQUALS(*item, 3);
+        TS_ASSERT(q.try_enqueue(item, 100ms));
+        q.enqueue(std::make_unique<int>(4));
+        TS_ASSERT_EQUALS(q.size(), 3);
+        TS_ASSERT_EQUALS(q.rejected(), 2);
+
+        work_queue<int>::stats s = q.snapshot();
+        TS_ASSERT_DELTA(s.service_rate, 50.0, 10.0);
+        TS_ASSERT_DELTA(s.consumers, 1.0, 0.01);
+        TS_ASSERT_LESS_THAN(50ms, s.predicted_wait);
+    }
+
+    void testLatencySlackCoalescesWakeups(void) {
+        haltflag = false;
+
+        work_queue<int> q(haltflag, SIZE_MAX, 10);
+        q.setLatencySlack(200ms, 3);
+        TS_ASSERT_EQUALS(q.getLatencySlack(), 200ms);
+
+        std::atomic<int> got(0);
+        std::chrono::steady_clock::time_point first_served;
+        std::thread consumer([&]{
+            while (std::unique_ptr<int> item = q.dequeue()) {
+                if (got == 0) first_served = std::chrono::steady_clock::now();
+                got++;
+            }
+        });
+        std::this_thread::sleep_for(20ms);
+
+        TS_TRACE("a lone item is held for the slack before the waiting consumer is woken for it");
+        const auto enqueued = std::chrono::steady_clock::now();
+        q.enqueue(std::make_unique<int>(1));
+        std::this_thread::sleep_for(50ms);
+        TS_ASSERT_EQUALS(got, 0);
+        while (got < 1)
+            std::this_thread::sleep_for(1ms);
+        TS_ASSERT_LESS_THAN_EQUALS(190ms, first_served - enqueued);
+
+        TS_TRACE("a full batch wakes the consumer at once");
+        std::this_thread::sleep_for(20ms);
+        const auto started = std::chrono::steady_clock::now();
+        for (int i = 2; i <= 4; i++)
+            q.enqueue(std::make_unique<int>(i));
+        while (got < 4)
+            std::this_thread::sleep_for(1ms);
+        TS_ASSERT_LESS_THAN(std::chrono::steady_clock::now() - started, 150ms);
+
+        TS_TRACE("a consumer arriving in dequeue takes held items without waiting");
+        q.setLatencySlack(std::chrono::microseconds(0));
+        haltflag = true;
+        consumer.join();
+        haltflag = false;
+        q.setLatencySlack(10s, 100);
+        q.enqueue(std::make_unique<int>(5));
+        TS_ASSERT_EQUALS(*q.dequeue(), 5);
+    }
+
+    void testOrderedWakeupsServeEverything(void) {
+        for (wake_order order: { wake_order::fifo, wake_order::lifo, wake_order::preferred_cores }) {
+            haltflag = false;
+            work_queue<int> q(haltflag, SIZE_MAX, 10);
+            q.setWakeOrder(order);
+            q.setPreferredCores({ 0 });
+            TS_ASSERT(q.getWakeOrder() == order);
+
+            std::atomic<int> served(0);
+            std::vector<std::thread> consumers;
+            for (int c = 0; c < 4; c++)
+                consumers.emplace_back([&]{ while (q.dequeue()) served++; });
+
+            for (int i = 0; i < 2000; i++) {
+                q.enqueue(std::make_unique<int>(i));
+                if (i % 100 == 0) std::this_thread::sleep_for(1ms);
+            }
+            while (served < 2000)
+                std::this_thread::sleep_for(1ms);
+            haltflag = true;
+            for (auto & consumer: consumers) consumer.join();
+        }
+    }
+
+    void testConcurrencyLimitParksConsumers(void) {
+        haltflag = false;
+
+        work_queue<int> q(haltflag, SIZE_MAX, 10);
+        q.setConcurrencyLimit(1);
+
+        q.enqueue(std::make_unique<int>(1));
+        q.enqueue(std::make_unique<int>(2));
+
+        std::unique_ptr<int> first = q.dequeue();
+        TS_ASSERT_EQUALS(*first, 1);
+        TS_ASSERT_EQUALS(q.in_service(), 1);
+
+        std::atomic<bool> got_second(false);
+        std::thread consumer([&]{
+            std::unique_ptr<int> second = q.dequeue();
+            got_second = (second && *second == 2);
+        });
+
+        TS_TRACE("second consumer must stay parked while the first item is in service");
+        std::this_thread::sleep_for(50ms);
+        TS_ASSERT(!got_second);
+        TS_ASSERT_EQUALS(q.size(), 1);
+
+        q.finished();
+        consumer.join();
+        TS_ASSERT(got_second);
+        TS_ASSERT_EQUALS(q.size(), 0);
+    }
+
+    void testBatchDequeue(void) {
+        haltflag = false;
+
+        work_queue<int> q(haltflag, SIZE_MAX, 10);
+        for (int i = 0; i < 5; i++)
+            q.enqueue(std::make_unique<int>(i));
+
+        std::vector<std::unique_ptr<int> > batch;
+        TS_ASSERT_EQUALS(q.dequeue(batch, 3), 3);
+        TS_ASSERT_EQUALS(batch.size(), 3);
+        TS_ASSERT_EQUALS(*batch[0], 0);
+        TS_ASSERT_EQUALS(*batch[2], 2);
+        TS_ASSERT_EQUALS(q.in_service(), 3);
+
+        TS_TRACE("a concurrency limit caps the batch at the free slots");
+        q.setConcurrencyLimit(4);
+        batch.clear();
+        TS_ASSERT_EQUALS(q.dequeue(batch, 10), 1);
+        TS_ASSERT_EQUALS(*batch[0], 3);
+        TS_ASSERT_EQUALS(q.size(), 1);
+        TS_ASSERT_EQUALS(q.handled(), 4);
+
+        haltflag = true;
+        batch.clear();
+        TS_ASSERT_EQUALS(q.dequeue(batch, 10), 0);
+        TS_ASSERT(batch.empty());
+        haltflag = false;
+    }
+
     void testWithThreads(void) {
 
 
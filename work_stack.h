@@ -0,0 +1,360 @@
+#ifndef WORK_STACK_H
+#define WORK_STACK_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+using namespace std::chrono_literals;
+
+/*!
+ * work_stack - a lock-free LIFO of work items, for work where recency matters more than order (cache-warm
+ * tasks, free-list-like pools of resources).  Same std::unique_ptr, bulk, halt and bounded-drop conventions as
+ * work_queue, except for which item a full stack drops (see below).
+ *
+ * A Treiber stack: the top is a single atomic word holding a node index and a tag that changes on every
+ * update, so a compare-and-swap can't be fooled by a node popped and pushed back meanwhile (ABA).  Nodes come
+ * from an arena that only grows, in chunks, and is recycled through a free list of its own, so a node is
+ * never freed while another thread may still read it.
+ *
+ * Under contention a push or pop whose compare-and-swap fails tries the elimination array before retrying: a
+ * push parks its item in a random slot for a moment, and a pop finding an item there takes it.  The pair cancels
+ * out without touching the top at all, so contention spreads over the slots instead of piling onto one word.
+ *
+ * Bounded: with max_depth items stacked, a push drops the item being pushed (counted by dropped()).  Dropping
+ * the oldest item, as work_queue does, would mean removing the bottom of the stack, which a lock-free stack
+ * can't do; the newest is the one to lose in any case when everyone pushes at once.
+ *
+ * Consumers with nothing to pop park on a condition variable; producers only take its mutex when some are
+ * parked.  Halting follows work_queue.
+ */
+template <class T>
+class work_stack
+{
+public:
+
+    /*!
+     * \brief work_stack creates a stack; the parameters are as for work_queue.
+     */
+    work_stack(std::atomic<bool> & halt_flag, size_t max_depth = SIZE_MAX, int wait_interval_ms = 100)
+        : shutting_down(halt_flag)
+        , wait_interval(wait_interval_ms)
+        , max(max_depth)
+        , top(pack(null_index, 0))
+        , free_top(pack(null_index, 0))
+        , n_allocated(0)
+        , depth(0)
+        , n_dropped(0)
+        , n_handled(0)
+        , n_eliminated(0)
+        , n_sleeping(0)
+        , m()
+        , cv()
+    {
+        for (auto & chunk: chunks) chunk.store(nullptr, std::memory_order_relaxed);
+        for (auto & slot: exchange) slot.value.store(empty_slot, std::memory_order_relaxed);
+    }
+
+    ~work_stack() {
+        for (uint32_t at = index_of(top.load()); at != null_index; at = node_at(at).next.load())
+            delete node_at(at).item;
+        for (size_t i = 0; i < max_chunks; i++)
+            delete [] chunks[i].load();
+    }
+
+    work_stack(const work_stack &) = delete;
+    work_stack & operator=(const work_stack &) = delete;
+
+    /*!
+     * \brief enqueue pushes the work item on top.  Enqueues while shutting down, and empty std::unique_ptrs,
+     *        are ignored; a full stack drops the item.
+     */
+    void enqueue(std::unique_ptr<T> work_item)
+    {
+        if (shutting_down || !work_item) return;
+        if (!reserve(1)) {
+            n_dropped++;
+            return;
+        }
+
+        T * item = work_item.release();
+        const uint32_t at = allocate();
+        node_at(at).item = item;
+        for (;;) {
+            if (push_chain(top, at, at)) break;
+            if (eliminate_push(item)) {
+                release_node(at);
+                break;
+            }
+        }
+        wake_sleepers();
+    }
+
+    /*!
+     * \brief enqueue pushes all the non-empty elements of bulk with one compare-and-swap, the last ending on top.
+     *        If the stack is shutting down, bulk is left untouched; items beyond max_depth are dropped.
+     */
+    void enqueue(std::vector<std::unique_ptr<T> > & bulk)
+    {
+        if (shutting_down) return;
+
+        size_t n = 0;
+        for (auto & work_item: bulk)
+            if (work_item) n++;
+        if (n == 0) return;
+
+        const size_t admitted = reserve_up_to(n);
+        n_dropped += n - admitted;
+
+        uint32_t first = null_index, last = null_index;
+        size_t linked = 0;
+        for (auto & work_item: bulk) {
+            if (!work_item) continue;
+            if (linked++ >= admitted) {
+                work_item.reset();
+                continue;
+            }
+            const uint32_t at = allocate();
+            node_at(at).item = work_item.release();
+            // the chain runs from the newest (first) down to the oldest (last).
+            node_at(at).next.store(first, std::memory_order_relaxed);
+            if (first == null_index) last = at;
+            first = at;
+        }
+        if (first == null_index) return;
+
+        while (!push_chain(top, first, last)) { }
+        wake_sleepers();
+    }
+
+    /*!
+     * \brief dequeue pops the newest work item, waiting until there is one.
+     * \return the work item, or an empty std::unique_ptr when shutting down.
+     */
+    std::unique_ptr<T> dequeue()
+    {
+        for (;;) {
+            if (shutting_down) return std::unique_ptr<T>{};
+
+            if (T * item = try_pop()) {
+                n_handled++;
+                return std::unique_ptr<T>(item);
+            }
+
+            std::unique_lock<std::mutex> l(m);
+            n_sleeping++;
+            // re-checked after announcing ourselves: a push either sees n_sleeping or is seen here.
+            if (index_of(top.load()) == null_index && !shutting_down)
+                cv.wait_for(l, wait_interval * 1ms);
+            n_sleeping--;
+        }
+    }
+
+    /*!
+     * \brief size returns the number of stacked work items (0 if shutting down), counting pushes in progress.
+     */
+    size_t size() const {
+        if (shutting_down) return 0;
+        return depth.load();
+    }
+
+    /*!
+     * \brief approx_size, empty and is_halting are lock-free, as everything here is; see work_queue.
+     */
+    size_t approx_size() const { return size(); }
+    bool empty() const { return size() == 0; }
+    bool is_halting() const { return shutting_down.load(std::memory_order_relaxed); }
+
+    /*!
+     * \brief dropped returns the number of work items dropped so far because the stack was full,
+     *        and resets the counter to zero.
+     */
+    int dropped() { return static_cast<int>(n_dropped.exchange(0)); }
+
+    /*!
+     * \brief handled returns the number of work items popped so far, and resets the counter to zero.
+     */
+    int handled() { return static_cast<int>(n_handled.exchange(0)); }
+
+    /*!
+     * \brief eliminated returns how many push/pop pairs have met in the elimination array, over the stack's life.
+     */
+    uint64_t eliminated() const { return n_eliminated.load(); }
+
+private:
+
+    struct node {
+        T * item;
+        std::atomic<uint32_t> next;
+    };
+
+    static constexpr uint32_t null_index = UINT32_MAX;
+
+    // the arena: chunk k holds first_chunk << k nodes, so 22 chunks address all 32-bit indices.
+    static constexpr size_t first_chunk = 1024;
+    static constexpr size_t max_chunks = 22;
+
+    // elimination slots hold a parked item's pointer, or one of these.
+    static constexpr uintptr_t empty_slot = 0;
+    static constexpr uintptr_t taken_slot = 1;
+    static constexpr size_t n_slots = 8;
+    static constexpr int patience = 128;    // spins a parked push waits for a partner
+
+    struct alignas(64) slot {
+        std::atomic<uintptr_t> value;
+    };
+
+    static uint64_t pack(uint32_t index, uint32_t tag) { return (uint64_t(tag) << 32) | index; }
+    static uint32_t index_of(uint64_t word) { return static_cast<uint32_t>(word); }
+    static uint32_t tag_of(uint64_t word) { return static_cast<uint32_t>(word >> 32); }
+
+    node & node_at(uint32_t index) const {
+        const uint64_t scaled = uint64_t(index) / first_chunk + 1;
+        const size_t chunk = 63 - __builtin_clzll(scaled);
+        const size_t offset = index - first_chunk * ((size_t(1) << chunk) - 1);
+        return chunks[chunk].load(std::memory_order_acquire)[offset];
+    }
+
+    // a fresh node: recycled from the free list, or else the next in the arena.
+    uint32_t allocate() {
+        uint32_t at = pop_index(free_top);
+        if (at != null_index) return at;
+
+        at = static_cast<uint32_t>(n_allocated++);
+        const uint64_t scaled = uint64_t(at) / first_chunk + 1;
+        const size_t chunk = 63 - __builtin_clzll(scaled);
+        if (!chunks[chunk].load(std::memory_order_acquire)) {
+            node * fresh = new node[first_chunk << chunk];
+            node * expected = nullptr;
+            if (!chunks[chunk].compare_exchange_strong(expected, fresh, std::memory_order_acq_rel))
+                delete [] fresh;    // another thread allocated it first
+        }
+        return at;
+    }
+
+    void release_node(uint32_t at) {
+        while (!push_chain(free_top, at, at)) { }
+    }
+
+    // one attempt at linking the chain first..last (already linked between them) onto the stack at head.
+    bool push_chain(std::atomic<uint64_t> & head, uint32_t first, uint32_t last) {
+        uint64_t old = head.load();
+        node_at(last).next.store(index_of(old), std::memory_order_relaxed);
+        return head.compare_exchange_strong(old, pack(first, tag_of(old) + 1));
+    }
+
+    uint32_t pop_index(std::atomic<uint64_t> & head) {
+        uint64_t old = head.load();
+        while (index_of(old) != null_index) {
+            const uint32_t next = node_at(index_of(old)).next.load(std::memory_order_relaxed);
+            if (head.compare_exchange_weak(old, pack(next, tag_of(old) + 1)))
+                return index_of(old);
+        }
+        return null_index;
+    }
+
+    // one attempt at the top, then one at the elimination array, until the stack is seen empty.
+    T * try_pop() {
+        for (;;) {
+            uint64_t old = top.load();
+            if (index_of(old) == null_index) return eliminate_pop();
+
+            const uint32_t at = index_of(old);
+            const uint32_t next = node_at(at).next.load(std::memory_order_relaxed);
+            if (top.compare_exchange_strong(old, pack(next, tag_of(old) + 1))) {
+                T * item = node_at(at).item;
+                release_node(at);
+                depth--;
+                return item;
+            }
+
+            if (T * item = eliminate_pop()) return item;
+        }
+    }
+
+    // parks item in a random slot for a while.  Returns whether a pop took it.
+    bool eliminate_push(T * item) {
+        std::atomic<uintptr_t> & s = exchange[random_slot()].value;
+        uintptr_t expected = empty_slot;
+        if (!s.compare_exchange_strong(expected, reinterpret_cast<uintptr_t>(item))) return false;
+
+        for (int spin = 0; spin < patience; spin++) {
+            if (s.load(std::memory_order_acquire) == taken_slot) {
+                s.store(empty_slot, std::memory_order_release);
+                n_eliminated++;
+                return true;
+            }
+        }
+
+        expected = reinterpret_cast<uintptr_t>(item);
+        if (s.compare_exchange_strong(expected, empty_slot)) return false;
+        // taken just as we gave up.
+        s.store(empty_slot, std::memory_order_release);
+        n_eliminated++;
+        return true;
+    }
+
+    T * eliminate_pop() {
+        std::atomic<uintptr_t> & s = exchange[random_slot()].value;
+        uintptr_t parked = s.load(std::memory_order_acquire);
+        if (parked == empty_slot || parked == taken_slot) return nullptr;
+        if (!s.compare_exchange_strong(parked, taken_slot)) return nullptr;
+        depth--;
+        return reinterpret_cast<T *>(parked);
+    }
+
+    static size_t random_slot() {
+        static thread_local uint32_t state = 0x9e3779b9u ^ static_cast<uint32_t>(
+                    reinterpret_cast<uintptr_t>(&state) >> 4);
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        return state % n_slots;
+    }
+
+    // claims room for one item; false when the stack is full.
+    bool reserve(size_t n) { return reserve_up_to(n) == n; }
+
+    size_t reserve_up_to(size_t n) {
+        size_t current = depth.load();
+        for (;;) {
+            const size_t room = current >= max ? 0 : max - current;
+            const size_t granted = n < room ? n : room;
+            if (granted == 0) return 0;
+            if (depth.compare_exchange_weak(current, current + granted)) return granted;
+        }
+    }
+
+    void wake_sleepers() {
+        if (n_sleeping.load() == 0) return;
+        std::unique_lock<std::mutex> l(m);
+        cv.notify_one();
+    }
+
+    std::atomic<bool> & shutting_down;
+
+    const int wait_interval; // units 1msec
+    const size_t max;
+
+    alignas(64) std::atomic<uint64_t> top;         // index and tag of the top node
+    alignas(64) std::atomic<uint64_t> free_top;    // likewise for the free list
+    alignas(64) std::atomic<size_t> n_allocated;
+    mutable std::atomic<node *> chunks[max_chunks];
+
+    alignas(64) std::atomic<size_t> depth;         // stacked items plus pushes in progress
+    std::atomic<uint64_t> n_dropped;
+    std::atomic<uint64_t> n_handled;
+    std::atomic<uint64_t> n_eliminated;
+
+    slot exchange[n_slots];
+
+    alignas(64) std::atomic<int> n_sleeping;
+    std::mutex m;
+    std::condition_variable cv;
+};
+
+#endif // WORK_STACK_H
@@ -0,0 +1,92 @@
+#include <cxxtest/TestSuite.h>
+#include <iostream>
+#include <thread>
+#include "work_stack.h"
+
+
+class work_stack_test : public CxxTest::TestSuite
+{
+public:
+
+    void testLastInFirstOut(void) {
+        std::atomic<bool> haltflag(false);
+        work_stack<int> s(haltflag, SIZE_MAX, 10);
+
+        for (int i = 0; i < 5; i++)
+            s.enqueue(std::make_unique<int>(i));
+
+        std::vector<std::unique_ptr<int> > bulk;
+        for (int i = 5; i < 8; i++)
+            bulk.push_back(std::make_unique<int>(i));
+        bulk.push_back(std::unique_ptr<int>());
+        s.enqueue(bulk);
+        TS_ASSERT_EQUALS(s.size(), 8);
+
+        for (int i = 7; i >= 0; i--)
+            TS_ASSERT_EQUALS(*s.dequeue(), i);
+        TS_ASSERT(s.empty());
+        TS_ASSERT_EQUALS(s.handled(), 8);
+    }
+
+    void testFullStackDropsThePush(void) {
+        std::atomic<bool> haltflag(false);
+        work_stack<int> s(haltflag, 3, 10);
+
+        for (int i = 0; i < 4; i++)
+            s.enqueue(std::make_unique<int>(i));
+        TS_ASSERT_EQUALS(s.size(), 3);
+        TS_ASSERT_EQUALS(s.dropped(), 1);
+
+        std::vector<std::unique_ptr<int> > bulk;
+        bulk.push_back(std::make_unique<int>(9));
+        s.dequeue();
+        s.dequeue();
+        bulk.push_back(std::make_unique<int>(10));
+        bulk.push_back(std::make_unique<int>(11));
+        s.enqueue(bulk);
+        TS_ASSERT_EQUALS(s.size(), 3);
+        TS_ASSERT_EQUALS(s.dropped(), 1);
+        TS_ASSERT_EQUALS(*s.dequeue(), 10);
+    }
+
+    void testHaltReleasesConsumers(void) {
+        std::atomic<bool> haltflag(false);
+        work_stack<int> s(haltflag, SIZE_MAX, 10);
+
+        std::unique_ptr<int> got = std::make_unique<int>(0);
+        std::thread consumer([&]{ got = s.dequeue(); });
+        std::this_thread::sleep_for(20ms);
+        haltflag = true;
+        consumer.join();
+        TS_ASSERT_EQUALS(got.get(), nullptr);
+
+        s.enqueue(std::make_unique<int>(1));
+        haltflag = false;
+        TS_ASSERT(s.empty());
+    }
+
+    void testConcurrentPushPopLosesNothing(void) {
+        std::atomic<bool> haltflag(false);
+        work_stack<int> s(haltflag, SIZE_MAX, 10);
+
+        const int n_threads = 8, per_thread = 20000;
+        std::atomic<long> popped_sum(0);
+        std::vector<std::thread> threads;
+        for (int t = 0; t < n_threads; t++) {
+            threads.emplace_back([&, t]{
+                long sum = 0;
+                for (int i = 0; i < per_thread; i++) {
+                    s.enqueue(std::make_unique<int>(t * per_thread + i));
+                    sum += *s.dequeue();
+                }
+                popped_sum += sum;
+            });
+        }
+        for (auto & thread: threads) thread.join();
+
+        const long n = long(n_threads) * per_thread;
+        TS_ASSERT_EQUALS(popped_sum, n * (n - 1) / 2);
+        TS_ASSERT(s.empty());
+    }
+
+};